@@ -0,0 +1,141 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "exr.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Arbitrary output variables (AOVs)
+
+Besides the final color, the camera can record what each camera ray hit first: how far away it was, the surface
+normal there and the surface's albedo (its base color, without any lighting). They're collected while rendering,
+from the same rays, so they cost next to nothing, and they're what the denoiser (denoise.h) uses to tell
+real edges in the image from noise.
+
+Like the color buffer they're sums over the samples of a pixel; divide by the sample count for the average.
+A camera ray that leaves the scene adds depth 0, normal 0 and albedo 1.
+
+Material and object IDs (index in the scene plus 1, 0 for nothing) can't be averaged; a pixel keeps the IDs its
+first sample hit. The sample count says how many samples the pixel got, and cost what they took to render, in
+nanoseconds or BVH work (see pixel_cost_metric), summed rather than averaged.
+
+write_exr puts the averaged color and every AOV in one multi-layer OpenEXR file (see exr.h):
+R G B, Z (depth), N.X N.Y N.Z (normal), albedo.R albedo.G albedo.B, material_id, object_id, sample_count, cost.
+*/
+
+// what the per pixel cost measures
+enum pixel_cost_metric {
+    cost_time, // nanoseconds of wall time
+    cost_work  // BVH node visits plus primitive tests, needs ray statistics compiled in (ray_stats.h)
+};
+
+// what one camera ray hit first
+struct aov_sample {
+    bool   hit = false;
+    double depth = 0;      // distance from the ray origin
+    vec3   normal;         // unit, facing the ray
+    color  albedo = color(1, 1, 1);
+    uint32_t object_id = 0;
+    uint32_t material_id = 0;
+};
+
+class aov_buffers {
+    public:
+        int width = 0, height = 0;
+        std::vector<float> depth;             // 1 per pixel
+        std::vector<float> normal;            // 3 per pixel
+        std::vector<float> albedo;            // 3 per pixel
+        std::vector<float> luminance_squares; // 1 per pixel, sum of each sample's luminance squared, for the variance
+        std::vector<uint32_t> material_id;    // 1 per pixel
+        std::vector<uint32_t> object_id;      // 1 per pixel
+        std::vector<uint32_t> sample_count;   // 1 per pixel
+        std::vector<float> cost;              // 1 per pixel
+
+        // size for a width x height image (or tile) and clear everything
+        void resize(int _width, int _height) {
+            width = _width;
+            height = _height;
+            size_t pixels = static_cast<size_t>(width) * height;
+            depth.assign(pixels, 0.0f);
+            normal.assign(3 * pixels, 0.0f);
+            albedo.assign(3 * pixels, 0.0f);
+            luminance_squares.assign(pixels, 0.0f);
+            material_id.assign(pixels, 0);
+            object_id.assign(pixels, 0);
+            sample_count.assign(pixels, 0);
+            cost.assign(pixels, 0.0f);
+        }
+
+        // copy a single row buffer (height 1, same width) into row y
+        void copy_row(const aov_buffers& row, int y) {
+            size_t offset = static_cast<size_t>(y) * width;
+            std::copy(row.depth.begin(), row.depth.end(), depth.begin() + offset);
+            std::copy(row.normal.begin(), row.normal.end(), normal.begin() + 3 * offset);
+            std::copy(row.albedo.begin(), row.albedo.end(), albedo.begin() + 3 * offset);
+            std::copy(row.luminance_squares.begin(), row.luminance_squares.end(), luminance_squares.begin() + offset);
+            std::copy(row.material_id.begin(), row.material_id.end(), material_id.begin() + offset);
+            std::copy(row.object_id.begin(), row.object_id.end(), object_id.begin() + offset);
+            std::copy(row.sample_count.begin(), row.sample_count.end(), sample_count.begin() + offset);
+            std::copy(row.cost.begin(), row.cost.end(), cost.begin() + offset);
+        }
+
+        // add one sample of pixel (row-major index), whose ray hit first and came back with color c
+        void add(size_t pixel, const aov_sample& first, const color& c) {
+            depth[pixel] += static_cast<float>(first.depth);
+            for (int k = 0; k < 3; ++k) {
+                normal[3*pixel + k] += static_cast<float>(first.normal[k]);
+                albedo[3*pixel + k] += static_cast<float>(first.albedo[k]);
+            }
+            double l = luminance(c);
+            luminance_squares[pixel] += static_cast<float>(l * l);
+            if (sample_count[pixel]++ == 0) {
+                material_id[pixel] = first.material_id;
+                object_id[pixel] = first.object_id;
+            }
+        }
+
+        // Write the color (sums over each pixel's samples, 3 floats per pixel) and the AOVs, all averaged, as one EXR
+        bool write_exr(const std::string& path, const float* sums) const {
+            size_t pixels = static_cast<size_t>(width) * height;
+            std::vector<float> beauty(3 * pixels), mean_depth(pixels), mean_normal(3 * pixels), mean_albedo(3 * pixels);
+            for (size_t p = 0; p < pixels; ++p) {
+                float inv = sample_count[p] ? 1.0f / sample_count[p] : 0.0f;
+                mean_depth[p] = depth[p] * inv;
+                for (int k = 0; k < 3; ++k) {
+                    beauty[3*p + k] = sums[3*p + k] * inv;
+                    mean_normal[3*p + k] = normal[3*p + k] * inv;
+                    mean_albedo[3*p + k] = albedo[3*p + k] * inv;
+                }
+            }
+
+            exr_writer exr;
+            exr.add_float("R", beauty.data(), 3);
+            exr.add_float("G", beauty.data() + 1, 3);
+            exr.add_float("B", beauty.data() + 2, 3);
+            exr.add_float("Z", mean_depth.data());
+            exr.add_float("N.X", mean_normal.data(), 3);
+            exr.add_float("N.Y", mean_normal.data() + 1, 3);
+            exr.add_float("N.Z", mean_normal.data() + 2, 3);
+            exr.add_float("albedo.R", mean_albedo.data(), 3);
+            exr.add_float("albedo.G", mean_albedo.data() + 1, 3);
+            exr.add_float("albedo.B", mean_albedo.data() + 2, 3);
+            exr.add_uint("material_id", material_id.data());
+            exr.add_uint("object_id", object_id.data());
+            exr.add_uint("sample_count", sample_count.data());
+            exr.add_float("cost", cost.data());
+            return exr.write(path, width, height);
+        }
+
+        static double luminance(const color& c) {
+            return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+        }
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef BENCH_SCENES_H
+#define BENCH_SCENES_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "scene_file.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Reference scenes for benchmarking
+
+Each scene is built from its own fixed seed with its own random number generator, so it comes out exactly the
+same in every build and every run, however much anything else has drawn from random_double() before. Keep them that way:
+numbers measured on these scenes are only comparable across versions as long as the scenes don't change. A new
+or changed workload gets a new name.
+
+    spheres_small     main.cpp's demo field, about 100 small spheres and three big ones
+    spheres_medium    the book cover's field, about 480 spheres
+    spheres_large     the same field out to 80 x 80, about 6400 spheres
+    spheres_huge      240 x 240, about 57000 spheres, mostly about BVH build and traversal depth
+    glass             the medium field all in glass, rays split at every sphere
+    deep_bounce       a closed white room with mirror and diffuse balls and one small lamp, paths end at max_depth
+    defocus           the medium field through a wide open lens focused close, every ray through a different point
+    rough_metal       a fully fuzzy metal floor and a few balls under one sphere lamp, light sampling on rough metal
+
+All use the demo's 16:9 camera unless said otherwise; the harness sets the resolution and sample count.
+*/
+
+// deterministic random numbers for building scenes (splitmix64), independent of random_double()
+class scene_random {
+    public:
+        explicit scene_random(uint64_t seed) : state(seed) {}
+
+        // in [0,1)
+        double next() {
+            state += 0x9E3779B97F4A7C15ull;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            z ^= z >> 31;
+            return (z >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        double next(double min, double max) {
+            return min + (max - min) * next();
+        }
+
+        color next_color(double min = 0, double max = 1) {
+            double r = next(min, max), g = next(min, max);
+            return color(r, g, next(min, max));
+        }
+
+    private:
+        uint64_t state;
+};
+
+inline const std::vector<std::string>& bench_scene_names() {
+    static const std::vector<std::string> names = {
+        "spheres_small", "spheres_medium", "spheres_large", "spheres_huge", "glass", "deep_bounce", "defocus",
+        "rough_metal"
+    };
+    return names;
+}
+
+// the demo camera, looking at the sphere fields from (13, 2, 3)
+inline void bench_demo_camera(camera& cam) {
+    cam.aspect_ratio  = 16.0 / 9.0;
+    cam.max_depth     = 25;
+    cam.vfov          = 20;
+    cam.lookfrom      = point3(13, 2, 3);
+    cam.lookat        = point3(0, 0, 0);
+    cam.vup           = vec3(0, 1, 0);
+    cam.defocus_angle = 1.0;
+    cam.focus_dist    = 10.0;
+}
+
+// main.cpp's sphere field over the grid [-extent, extent)^2, optionally all glass, with the three big balls
+inline void bench_sphere_field(scene_description& scene, int extent, bool all_glass, uint64_t seed) {
+    scene_random random(seed);
+    scene.add_sphere(point3(0, -1000, 0), 1000, scene.add_lambertian(color(0.5, 0.5, 0.5)));
+
+    uint32_t glass = scene.add_dielectric(1.5);
+    for (int x = -extent; x < extent; ++x) {
+        for (int y = -extent; y < extent; ++y) {
+            double choose_material = random.next();
+            point3 center(x + 0.9*random.next(), 0.2, y + 0.9*random.next());
+            if ((center - point3(4, 1, 0)).length() <= 1.2) {
+                continue;
+            }
+            if (all_glass || choose_material >= 0.95) {
+                scene.add_sphere(center, 0.2, glass);
+            }
+            else if (choose_material < 0.75) {
+                scene.add_sphere(center, 0.2, scene.add_lambertian(random.next_color() * random.next_color()));
+            }
+            else {
+                color albedo = random.next_color(0.5, 1);
+                scene.add_sphere(center, 0.2, scene.add_metal(albedo, random.next(0, 0.5)));
+            }
+        }
+    }
+
+    scene.add_sphere(point3(-4, 1, 0), 1.0, all_glass ? glass : scene.add_lambertian(color(0.7, 0.3, 0.2)));
+    scene.add_sphere(point3(0, 1, 0), 1.0, all_glass ? glass : scene.add_metal(color(0.4, 0.7, 0.1), 0.0));
+    scene.add_sphere(point3(4, 1, 0), 1.0, glass);
+}
+
+// a white room (the inside of a big sphere) full of balls, lit only by one small lamp
+inline void bench_deep_bounce(scene_description& scene, uint64_t seed) {
+    scene_random random(seed);
+    scene.add_sphere(point3(0, 0, 0), 20, scene.add_lambertian(color(0.8, 0.8, 0.8)));
+    scene.add_sphere(point3(0, 12, 0), 1.5, scene.add_light(color(6, 5.7, 5.1)));
+
+    uint32_t mirror = scene.add_metal(color(0.95, 0.95, 0.95), 0.02);
+    for (int k = 0; k < 60; ++k) {
+        point3 center(random.next(-12, 12), random.next(-8, 8), random.next(-12, 12));
+        double radius = random.next(0.8, 2.5);
+        uint32_t mat = (random.next() < 0.5) ? mirror : scene.add_lambertian(random.next_color(0.6, 0.95));
+        scene.add_sphere(center, radius, mat);
+    }
+
+    camera& cam = scene.cam;
+    cam.aspect_ratio  = 16.0 / 9.0;
+    cam.max_depth     = 16;
+    cam.vfov          = 70;
+    cam.lookfrom      = point3(0, 0, 18);
+    cam.lookat        = point3(0, 0, 0);
+    cam.vup           = vec3(0, 1, 0);
+    cam.sky_gradient  = false;
+    cam.background    = color(0, 0, 0);
+}
+
+// a rough (fuzz 1) metal floor under a sphere lamp, with a diffuse and a half fuzzy metal ball, in the dark
+inline void bench_rough_metal(scene_description& scene) {
+    scene.add_sphere(point3(0, -1000, 0), 1000, scene.add_metal(color(0.8, 0.8, 0.8), 1.0));
+    scene.add_sphere(point3(0, 2.5, 0), 0.5, scene.add_light(color(10, 9.5, 8.5)));
+    scene.add_sphere(point3(-1.2, 0.6, 0), 0.6, scene.add_lambertian(color(0.7, 0.3, 0.2)));
+    scene.add_sphere(point3(1.2, 0.6, 0), 0.6, scene.add_metal(color(0.6, 0.7, 0.9), 0.5));
+
+    camera& cam = scene.cam;
+    cam.aspect_ratio  = 16.0 / 9.0;
+    cam.max_depth     = 8;
+    cam.vfov          = 40;
+    cam.lookfrom      = point3(0, 2, 7);
+    cam.lookat        = point3(0, 0.6, 0);
+    cam.vup           = vec3(0, 1, 0);
+    cam.sky_gradient  = false;
+    cam.background    = color(0, 0, 0);
+}
+
+// Build the named scene (see bench_scene_names()) into an empty scene, false for an unknown name
+inline bool build_bench_scene(const std::string& name, scene_description& scene) {
+    if (name == "spheres_small") {
+        bench_sphere_field(scene, 5, false, 1);
+    }
+    else if (name == "spheres_medium") {
+        bench_sphere_field(scene, 11, false, 2);
+    }
+    else if (name == "spheres_large") {
+        bench_sphere_field(scene, 40, false, 3);
+    }
+    else if (name == "spheres_huge") {
+        bench_sphere_field(scene, 120, false, 4);
+    }
+    else if (name == "glass") {
+        bench_sphere_field(scene, 11, true, 5);
+    }
+    else if (name == "deep_bounce") {
+        bench_deep_bounce(scene, 6);
+        return true;
+    }
+    else if (name == "defocus") {
+        bench_sphere_field(scene, 11, false, 7);
+        bench_demo_camera(scene.cam);
+        scene.cam.defocus_angle = 6.0;
+        scene.cam.focus_dist    = 6.0;
+        return true;
+    }
+    else if (name == "rough_metal") {
+        bench_rough_metal(scene);
+        return true;
+    }
+    else {
+        return false;
+    }
+    bench_demo_camera(scene.cam);
+    return true;
+}
+
+#endif
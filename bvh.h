@@ -0,0 +1,401 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+
+#include "ray_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/*
+Bounding volume hierarchy stored as one flat array of nodes
+
+Instead of a tree of heap allocated nodes pointing at each other, every node lives in a single array
+and children are referred to by index. That makes the whole structure position independent:
+it can be written to disk and memory mapped back in, and it's friendlier to the cache while traversing.
+
+Nodes are laid out depth first, so an interior node's first child is always the next node in the array
+and only the second child's index needs storing. A leaf covers a contiguous run of primitives, which means the
+builder hands back the order the caller has to put its primitives in (the "order" permutation).
+
+Bounds are floats to keep nodes at 32 bytes, two per cache line.
+*/
+
+struct bvh_box {
+    float min[3];
+    float max[3];
+
+    static bvh_box empty() {
+        bvh_box b;
+        for (int a = 0; a < 3; ++a) {
+            b.min[a] = std::numeric_limits<float>::infinity();
+            b.max[a] = -std::numeric_limits<float>::infinity();
+        }
+        return b;
+    }
+
+    void grow(const bvh_box& other) {
+        for (int a = 0; a < 3; ++a) {
+            min[a] = std::min(min[a], other.min[a]);
+            max[a] = std::max(max[a], other.max[a]);
+        }
+    }
+
+    // smallest float box containing the double box [lo, hi], rounded outwards
+    static bvh_box around(const point3& lo, const point3& hi) {
+        bvh_box b;
+        for (int a = 0; a < 3; ++a) {
+            b.min[a] = static_cast<float>(lo[a]);
+            b.max[a] = static_cast<float>(hi[a]);
+            if (b.min[a] > lo[a]) b.min[a] = std::nextafter(b.min[a], -std::numeric_limits<float>::infinity());
+            if (b.max[a] < hi[a]) b.max[a] = std::nextafter(b.max[a], std::numeric_limits<float>::infinity());
+        }
+        return b;
+    }
+
+    bool is_empty() const {
+        return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+    }
+
+    float centroid(int axis) const {
+        return 0.5f * (min[axis] + max[axis]);
+    }
+
+    // half the surface area, the SAH only ever compares areas so the factor 2 doesn't matter
+    float half_area() const {
+        float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+        if (dx < 0 || dy < 0 || dz < 0) {
+            return 0;
+        }
+        return dx*dy + dy*dz + dz*dx;
+    }
+};
+
+// bump whenever the node layout or the builder's output changes, anything cached on disk is keyed on it
+const uint32_t bvh_format_version = 1;
+
+struct bvh_node {
+    bvh_box bounds;
+    uint32_t offset; // interior: index of the second child; leaf: index of the first primitive
+    uint32_t count;  // interior: 0; leaf: number of primitives
+};
+
+// Binned surface area heuristic builder
+class bvh_builder {
+    public:
+        int max_leaf_size = 4;
+
+        // Build nodes over the given primitive bounds. order[k] is the index of the primitive that has to end up
+        // at position k of the caller's primitive array for the leaf ranges to be right.
+        void build(const std::vector<bvh_box>& prim_bounds, std::vector<bvh_node>& nodes, std::vector<uint32_t>& order) {
+            bounds = &prim_bounds;
+            nodes.clear();
+            order.resize(prim_bounds.size());
+            for (size_t k = 0; k < order.size(); ++k) {
+                order[k] = static_cast<uint32_t>(k);
+            }
+            if (order.empty()) {
+                return;
+            }
+            nodes.reserve(2 * order.size() / max_leaf_size + 1);
+            build_node(nodes, order, 0, static_cast<uint32_t>(order.size()), 0);
+        }
+
+    private:
+        static const int bin_count = 16;
+        static const int max_depth = 96; // past this always split at the median, keeps traversal stacks bounded
+        const std::vector<bvh_box>* bounds = nullptr;
+
+        struct bin {
+            bvh_box box = bvh_box::empty();
+            uint32_t count = 0;
+        };
+
+        void build_node(std::vector<bvh_node>& nodes, std::vector<uint32_t>& order, uint32_t begin, uint32_t end, int depth) {
+            const std::vector<bvh_box>& prims = *bounds;
+            uint32_t index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(bvh_node());
+
+            bvh_box box = bvh_box::empty();
+            bvh_box centroids = bvh_box::empty();
+            for (uint32_t k = begin; k < end; ++k) {
+                const bvh_box& b = prims[order[k]];
+                box.grow(b);
+                for (int a = 0; a < 3; ++a) {
+                    float c = b.centroid(a);
+                    centroids.min[a] = std::min(centroids.min[a], c);
+                    centroids.max[a] = std::max(centroids.max[a], c);
+                }
+            }
+            nodes[index].bounds = box;
+
+            uint32_t count = end - begin;
+            int axis = 0;
+            for (int a = 1; a < 3; ++a) {
+                if (centroids.max[a] - centroids.min[a] > centroids.max[axis] - centroids.min[axis]) {
+                    axis = a;
+                }
+            }
+            float extent = centroids.max[axis] - centroids.min[axis];
+
+            if (count <= static_cast<uint32_t>(max_leaf_size)) {
+                make_leaf(nodes[index], begin, count);
+                return;
+            }
+            if (!(extent > 0)) {
+                // every centroid in the same spot, no SAH split can separate them, so just halve big ranges
+                if (count <= 16) {
+                    make_leaf(nodes[index], begin, count);
+                }
+                else {
+                    build_children(nodes, order, index, begin, begin + count / 2, end, depth);
+                }
+                return;
+            }
+
+            if (depth >= max_depth) {
+                uint32_t mid = begin + count / 2;
+                std::nth_element(order.data() + begin, order.data() + mid, order.data() + end, [&](uint32_t p, uint32_t q) {
+                    return prims[p].centroid(axis) < prims[q].centroid(axis);
+                });
+                build_children(nodes, order, index, begin, mid, end, depth);
+                return;
+            }
+
+            // drop every centroid into one of the bins along the widest axis
+            bin bins[bin_count];
+            float scale = bin_count / extent;
+            for (uint32_t k = begin; k < end; ++k) {
+                const bvh_box& b = prims[order[k]];
+                int slot = std::min(bin_count - 1, static_cast<int>((b.centroid(axis) - centroids.min[axis]) * scale));
+                bins[slot].box.grow(b);
+                bins[slot].count++;
+            }
+
+            // sweep from both ends to evaluate all bin_count-1 split planes
+            float right_area[bin_count];
+            uint32_t right_count[bin_count];
+            bvh_box acc = bvh_box::empty();
+            uint32_t acc_count = 0;
+            for (int k = bin_count - 1; k > 0; --k) {
+                acc.grow(bins[k].box);
+                acc_count += bins[k].count;
+                right_area[k] = acc.half_area();
+                right_count[k] = acc_count;
+            }
+
+            float best_cost = std::numeric_limits<float>::infinity();
+            int best_split = -1;
+            acc = bvh_box::empty();
+            acc_count = 0;
+            for (int k = 0; k < bin_count - 1; ++k) {
+                acc.grow(bins[k].box);
+                acc_count += bins[k].count;
+                if (acc_count == 0 || right_count[k+1] == 0) {
+                    continue;
+                }
+                float cost = acc_count * acc.half_area() + right_count[k+1] * right_area[k+1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_split = k;
+                }
+            }
+
+            // only stop early if splitting is no cheaper than intersecting everything, and the leaf stays small
+            float leaf_cost = count * box.half_area();
+            if (best_split < 0 || (best_cost >= leaf_cost && count <= 16)) {
+                make_leaf(nodes[index], begin, count);
+                return;
+            }
+
+            uint32_t* first = order.data() + begin;
+            uint32_t* last = order.data() + end;
+            float split_min = centroids.min[axis];
+            uint32_t* mid = std::partition(first, last, [&](uint32_t p) {
+                int slot = std::min(bin_count - 1, static_cast<int>((prims[p].centroid(axis) - split_min) * scale));
+                return slot <= best_split;
+            });
+
+            uint32_t mid_index = static_cast<uint32_t>(mid - order.data());
+            if (mid_index == begin || mid_index == end) {
+                mid_index = begin + count / 2; // can't happen with sane floats, but never recurse on an empty side
+            }
+            build_children(nodes, order, index, begin, mid_index, end, depth);
+        }
+
+        void build_children(std::vector<bvh_node>& nodes, std::vector<uint32_t>& order,
+                            uint32_t index, uint32_t begin, uint32_t mid, uint32_t end, int depth) {
+            build_node(nodes, order, begin, mid, depth + 1); // first child lands at index + 1
+            nodes[index].offset = static_cast<uint32_t>(nodes.size());
+            nodes[index].count = 0;
+            build_node(nodes, order, mid, end, depth + 1);
+        }
+
+        static void make_leaf(bvh_node& node, uint32_t begin, uint32_t count) {
+            node.offset = begin;
+            node.count = count;
+        }
+};
+
+// Whether every node points somewhere sensible: an interior node at two children after it, a leaf at primitives
+// below prim_count. For trees read from files, which could be damaged, before anything traverses them.
+inline bool bvh_nodes_consistent(const bvh_node* nodes, size_t node_count, size_t prim_count) {
+    for (size_t n = 0; n < node_count; ++n) {
+        const bvh_node& node = nodes[n];
+        bool ok = (node.count > 0)
+            ? static_cast<uint64_t>(node.offset) + node.count <= prim_count
+            : node.offset > n + 1 && node.offset < node_count && n + 1 < node_count;
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Refitting: when primitives move but stay roughly where they were relative to each other, the tree topology
+can be kept and only the bounds recomputed. Children always come after their parent in the array, so one
+backwards pass over the nodes is enough. prim_bounds has to be in leaf order (the order the builder handed back).
+Only the instance tree is refitted (instance_bvh::update, as sequences move instances); nothing moves single
+spheres or triangles, so the sphere and mesh trees have no refit path.
+*/
+inline void bvh_refit(std::vector<bvh_node>& nodes, const std::vector<bvh_box>& prim_bounds) {
+    for (size_t n = nodes.size(); n-- > 0;) {
+        bvh_node& node = nodes[n];
+        bvh_box box = bvh_box::empty();
+        if (node.count > 0) {
+            for (uint32_t k = node.offset; k < node.offset + node.count; ++k) {
+                box.grow(prim_bounds[k]);
+            }
+        }
+        else {
+            box.grow(nodes[n + 1].bounds);
+            box.grow(nodes[node.offset].bounds);
+        }
+        node.bounds = box;
+    }
+}
+
+// Expected cost of tracing a random ray through the tree, by the same measure the builder minimizes:
+// each node costs its area (relative to the root) for the box test, each leaf also its area times its primitive count.
+// Refitting keeps the topology but lets boxes grow and overlap, which shows up here as a rising cost.
+inline float bvh_sah_cost(const std::vector<bvh_node>& nodes) {
+    if (nodes.empty() || !(nodes[0].bounds.half_area() > 0)) {
+        return 0;
+    }
+    double cost = 0;
+    for (const auto& node : nodes) {
+        cost += node.bounds.half_area() * (1.0 + node.count);
+    }
+    return static_cast<float>(cost / nodes[0].bounds.half_area());
+}
+
+// Precomputed per-ray values for the slab test
+class bvh_ray {
+    public:
+        double origin[3];
+        double inv_dir[3];
+
+        bvh_ray(const ray& r) {
+            for (int a = 0; a < 3; ++a) {
+                origin[a] = r.origin()[a];
+                inv_dir[a] = 1.0 / r.direction()[a];
+            }
+        }
+
+        // entry distance into the box if the ray overlaps it within [t_min, t_max], otherwise infinity
+        double enter(const bvh_box& b, double t_min, double t_max) const {
+            for (int a = 0; a < 3; ++a) {
+                double t0 = (b.min[a] - origin[a]) * inv_dir[a];
+                double t1 = (b.max[a] - origin[a]) * inv_dir[a];
+                if (inv_dir[a] < 0) {
+                    std::swap(t0, t1);
+                }
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if (t_max < t_min) {
+                    return infinity;
+                }
+            }
+            return t_min;
+        }
+
+        // entry distances into both children of a node, which is what traversal asks for at every interior node
+        void enter2(const bvh_box& a, const bvh_box& b, double t_min, double t_max, double& t_a, double& t_b) const {
+            t_a = enter(a, t_min, t_max);
+            t_b = enter(b, t_min, t_max);
+        }
+};
+
+/*
+Closest-hit traversal. leaf_hit(first, count, ray_t) tests primitives [first, first+count) and returns true
+if it found a closer hit, in which case it has also pulled ray_t.max in to that hit's t.
+Children are visited nearest first so ray_t.max shrinks as early as possible and far subtrees get culled.
+BoxRay does the box tests; the SIMD variants in simd_kernels.h have the same interface as bvh_ray.
+Child indices are checked on the way (children come after their parent, inside the array), so a damaged tree in a
+memory mapped file, which isn't checked up front, ends the traversal instead of reading outside the nodes or looping;
+leaf_hit checks its own primitive range.
+*/
+template <typename LeafHit, typename BoxRay = bvh_ray>
+bool bvh_traverse(const bvh_node* nodes, size_t node_count, const ray& r, interval& ray_t, LeafHit& leaf_hit) {
+    if (node_count == 0) {
+        return false;
+    }
+
+    BoxRay br(r);
+    if (br.enter(nodes[0].bounds, ray_t.min, ray_t.max) == infinity) {
+        return false;
+    }
+
+    bool hit_anything = false;
+    uint32_t stack[128]; // the builder keeps trees shallower than this
+    int top = 0;
+    uint32_t current = 0;
+    while (true) {
+        const bvh_node& node = nodes[current];
+        RAY_STAT(node_visits);
+        if (node.count > 0) {
+            if (leaf_hit(node.offset, node.count, ray_t)) {
+                hit_anything = true;
+            }
+        }
+        else {
+            uint32_t near_child = current + 1;
+            uint32_t far_child = node.offset;
+            if (far_child <= near_child || far_child >= node_count) {
+                return hit_anything; // damaged tree
+            }
+            double t_near, t_far;
+            br.enter2(nodes[near_child].bounds, nodes[far_child].bounds, ray_t.min, ray_t.max, t_near, t_far);
+            if (t_far < t_near) {
+                std::swap(near_child, far_child);
+                std::swap(t_near, t_far);
+            }
+            if (t_near != infinity) {
+                if (t_far != infinity && top < 128) {
+                    stack[top++] = far_child;
+                }
+                current = near_child;
+                continue;
+            }
+        }
+
+        // pop the next subtree that can still contain something closer than what we've got
+        bool found = false;
+        while (top > 0) {
+            current = stack[--top];
+            if (br.enter(nodes[current].bounds, ray_t.min, ray_t.max) != infinity) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return hit_anything;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "packed_scene.h"
+#include "scene_file.h"
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+On-disk cache of the BVH built for a scene file
+
+Building the BVH is by far the slowest part of starting a render of a big text scene, and re-rendering the same
+scene with a different camera builds the exact same tree again. So after building we write the tree out next to the
+scene (scene.txt -> scene.txt.bvhcache) together with a hash of everything that went into it, and next time a hash
+match lets us skip the build entirely.
+
+The hash covers the materials and sphere records in file order, and the BVH format version. The camera is left out
+on purpose, changing it doesn't change the tree.
+
+Cache file layout (host byte order):
+    bvh_cache_header
+    uint32_t order[sphere_count]   the sphere permutation the builder produced
+    bvh_node nodes[node_count]
+*/
+
+const char     bvh_cache_magic[4] = {'R', 'T', 'B', 'C'};
+const uint32_t bvh_cache_version  = 1;
+
+struct bvh_cache_header {
+    char magic[4];
+    uint32_t version;     // bvh_cache_version
+    uint32_t bvh_version; // bvh_format_version the tree was built with
+    uint32_t reserved;
+    uint64_t scene_hash;
+    uint64_t sphere_count;
+    uint64_t node_count;
+};
+
+// Fast 64 bit hash over a byte range, eight bytes at a time. Not cryptographic, just good at telling scenes apart.
+inline uint64_t hash_bytes(const void* data, size_t len, uint64_t h) {
+    const uint64_t mul = 0x9E3779B97F4A7C15ull;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    while (len >= 8) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        h = (h ^ w) * mul;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
+    uint64_t tail = 0;
+    if (len > 0) {
+        std::memcpy(&tail, p, len); // p is null for an empty vector's data()
+    }
+    h = (h ^ tail ^ (static_cast<uint64_t>(len) << 56)) * mul;
+
+    // final avalanche so nearby inputs end up far apart
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t scene_hash(const scene_description& scene) {
+    uint64_t counts[3] = { scene.materials.size(), scene.spheres.size(), bvh_format_version };
+    uint64_t h = hash_bytes(counts, sizeof(counts), 0xCBF29CE484222325ull);
+    h = hash_bytes(scene.materials.data(), scene.materials.size() * sizeof(material_record), h);
+    return hash_bytes(scene.spheres.data(), scene.spheres.size() * sizeof(sphere_record), h);
+}
+
+inline std::string bvh_cache_path(const std::string& scene_path) {
+    return scene_path + ".bvhcache";
+}
+
+// Check that order is a permutation and every node points somewhere sensible, so a damaged cache can't crash a render
+inline bool bvh_cache_consistent(const std::vector<uint32_t>& order, const std::vector<bvh_node>& nodes) {
+    std::vector<bool> seen(order.size(), false);
+    for (uint32_t k : order) {
+        if (k >= order.size() || seen[k]) {
+            return false;
+        }
+        seen[k] = true;
+    }
+    return bvh_nodes_consistent(nodes.data(), nodes.size(), order.size());
+}
+
+// If the cache at path matches the scene, apply the cached sphere order and BVH to the scene and return true
+inline bool load_bvh_cache(const std::string& path, scene_description& scene, uint64_t hash) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    // the file is exactly the header, the order and the nodes, so its size says how many nodes there can be
+    long file_size = (std::fseek(file, 0, SEEK_END) == 0) ? std::ftell(file) : -1;
+    std::rewind(file);
+    uint64_t tree_offset = sizeof(bvh_cache_header) + scene.spheres.size() * sizeof(uint32_t);
+
+    bvh_cache_header header;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+           && std::memcmp(header.magic, bvh_cache_magic, sizeof(header.magic)) == 0
+           && header.version == bvh_cache_version
+           && header.bvh_version == bvh_format_version
+           && header.scene_hash == hash
+           && header.sphere_count == scene.spheres.size()
+           && file_size >= 0 && static_cast<uint64_t>(file_size) >= tree_offset
+           && header.node_count == (static_cast<uint64_t>(file_size) - tree_offset) / sizeof(bvh_node);
+
+    std::vector<uint32_t> order;
+    std::vector<bvh_node> nodes;
+    if (ok) {
+        order.resize(header.sphere_count);
+        nodes.resize(header.node_count);
+        ok = std::fread(order.data(), sizeof(uint32_t), order.size(), file) == order.size()
+          && std::fread(nodes.data(), sizeof(bvh_node), nodes.size(), file) == nodes.size()
+          && std::fgetc(file) == EOF
+          && bvh_cache_consistent(order, nodes);
+    }
+    std::fclose(file);
+
+    if (!ok) {
+        return false;
+    }
+    reorder_spheres(scene, order);
+    scene.nodes.swap(nodes);
+    return true;
+}
+
+// Write the cache to a temporary file and rename it into place, so a reader (say another render worker
+// starting on the same scene) never sees a half written file
+inline bool save_bvh_cache(const std::string& path, uint64_t hash,
+                           const std::vector<uint32_t>& order, const std::vector<bvh_node>& nodes) {
+    std::string tmp = path + ".tmp" + std::to_string(static_cast<long>(getpid()));
+    std::FILE* file = std::fopen(tmp.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bvh_cache_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, bvh_cache_magic, sizeof(header.magic));
+    header.version = bvh_cache_version;
+    header.bvh_version = bvh_format_version;
+    header.scene_hash = hash;
+    header.sphere_count = order.size();
+    header.node_count = nodes.size();
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+           && std::fwrite(order.data(), sizeof(uint32_t), order.size(), file) == order.size()
+           && std::fwrite(nodes.data(), sizeof(bvh_node), nodes.size(), file) == nodes.size();
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*
+Give the scene a BVH, from the cache next to scene_path when it's still valid, otherwise by building it
+and refreshing the cache. Returns true on a cache hit.
+*/
+inline bool build_scene_bvh_cached(const std::string& scene_path, scene_description& scene) {
+    uint64_t hash = scene_hash(scene);
+    std::string path = bvh_cache_path(scene_path);
+    if (load_bvh_cache(path, scene, hash)) {
+        return true;
+    }
+
+    std::vector<uint32_t> order;
+    build_scene_bvh(scene, order);
+    if (!save_bvh_cache(path, hash, order, scene.nodes)) {
+        std::clog << "could not write BVH cache " << path << '\n';
+    }
+    return false;
+}
+
+#endif
@@ -2,11 +2,21 @@
 #define CAMERA_H
 
 #include "rtweekend.h"
+#include "aov.h"
 #include "color.h"
+#include "denoise.h"
+#include "heatmap.h"
 #include "hittable.h"
+#include "lights.h"
 #include "material.h"
+#include "progress.h"
+#include "ray_stats.h"
+#include "sampler.h"
+#include "trace.h"
 
+#include <chrono>
 #include <iostream>
+#include <string>
 
 class camera {
     public:
@@ -36,29 +46,125 @@ class camera {
         double defocus_angle = 0; // variation angle of rays through each pixel
         double focus_dist = 10; // distance from camera lookfrom point to plane of perfect focus
 
+        // motion blur
+        /*
+            A frame covers times 0 to 1, and moving objects are described by where they are over that span.
+            The shutter is open for [shutter_open, shutter_close] of it and every camera ray gets a random time
+            in there, so moving objects smear across the image within a single render.
+            With shutter_close <= shutter_open every ray is cast at shutter_open (no blur, and no extra random numbers drawn).
+            Both are clamped to [0,1]: the BVH bounds moving spheres over the frame, and misses them at other times.
+        */
+        double shutter_open = 0;
+        double shutter_close = 0;
+
+        // what rays that leave the scene see: the blue-white sky gradient, or a flat background color
+        bool  sky_gradient = true;
+        color background = color(0, 0, 0);
+
+        // Emissive primitives for next event estimation (see lights.h). Null or empty means no explicit light
+        // sampling, light then only arrives by rays bouncing into it (or the sky).
+        // With lights, a surface that has a BSDF gets light both ways, from the light sample and from its scattered
+        // ray hitting a light, and the two are combined with multiple importance sampling (power heuristic).
+        const light_list* lights = nullptr;
+
+        // Where the random numbers for pixel position, lens position, time, scattering and light sampling come from (see sampler.h).
+        // The default draws independent uniform numbers; the others reach the same noise level with fewer samples.
+        sampler_type sampling = sampler_independent;
+        uint32_t sample_seed = 0; // picks the independent sampler's numbers, a render with another seed gets other noise
+
+        // Run the denoiser (denoise.h) over the image before writing it out. The camera rays then also record
+        // depth, normal and albedo of their first hit, which guide it.
+        bool denoise = false;
+
+        // If set, render() also writes the color and every AOV (depth, normal, albedo, material and object IDs,
+        // sample count) into this multi-layer OpenEXR file, see aov.h
+        std::string aov_path;
+
+        // If set, render() also writes a false color picture of what every pixel cost to render (see heatmap.h),
+        // measured as heatmap_metric says
+        std::string heatmap_path;
+        pixel_cost_metric heatmap_metric = cost_time;
+
+        // how render() reports its progress: a terminal line, none, and/or a JSON lines stream (see progress.h)
+        progress_options progress;
+
         void render(const hittable& world) {
             // initialize
             initialize();
 
+            if (denoise || !aov_path.empty() || !heatmap_path.empty()) {
+                render_buffered(world);
+                return;
+            }
+
             // Render
             std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
 
+            progress_reporter reporter(total_samples(), progress);
             for (int j = 0; j < image_height; ++j) {
-                // progress logging
-                std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
+                TRACE_TILE(0, j, image_width, j + 1);
                 // pixel by pixel, shoot out rays into the world that map to a pixel location
                 for (int i = 0; i < image_width; ++i) {
                     color pixel_color(0,0,0);
                     for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                        ray r = get_ray(i, j);
+                        ray r = get_ray(i, j, sample);
                         pixel_color += ray_color(r, max_depth, world);
                     }
                     write_color(std::cout, pixel_color, samples_per_pixel);
                 }
+                reporter.add(static_cast<uint64_t>(image_width) * samples_per_pixel);
             }
 
-            // progress logging
-            std::clog << "\rDone.                  \n" << std::flush;
+            reporter.finish();
+            if (!progress.quiet) {
+                std::clog << "\rDone.                  \n" << std::flush;
+            }
+        }
+
+        // Render only the pixels in [x0,x1) x [y0,y1), taking samples [s0,s1) of each pixel.
+        // Colors are accumulated un-normalized (sum over samples) into out, a tile-local row-major
+        // buffer of 3 floats per pixel, so tiles and sample ranges from different renders can be summed.
+        // If aov isn't null the first hits and each pixel's cost go there as well, it has to be sized to the tile (see aov.h)
+        void render_tile(const hittable& world, int x0, int y0, int x1, int y1, int s0, int s1, float* out, aov_buffers* aov = nullptr) {
+            initialize();
+
+            for (int j = y0; j < y1; ++j) {
+                for (int i = x0; i < x1; ++i) {
+                    size_t pixel = static_cast<size_t>(j - y0) * (x1 - x0) + (i - x0);
+                    double cost_start = (aov != nullptr) ? pixel_cost_now() : 0;
+                    color pixel_color(0,0,0);
+                    for (int sample = s0; sample < s1; ++sample) {
+                        ray r = get_ray(i, j, sample);
+                        if (aov != nullptr) {
+                            aov_sample first;
+                            color c = ray_color(r, max_depth, world, 0, &first);
+                            aov->add(pixel, first, c);
+                            pixel_color += c;
+                        }
+                        else {
+                            pixel_color += ray_color(r, max_depth, world);
+                        }
+                    }
+                    if (aov != nullptr) {
+                        aov->cost[pixel] += static_cast<float>(pixel_cost_now() - cost_start);
+                    }
+                    float* px = out + 3 * pixel;
+                    px[0] += static_cast<float>(pixel_color.x());
+                    px[1] += static_cast<float>(pixel_color.y());
+                    px[2] += static_cast<float>(pixel_color.z());
+                }
+            }
+        }
+
+        // height of the generated image, derived from image_width and aspect_ratio
+        int get_image_height() const {
+            int height = static_cast<int>(image_width / aspect_ratio);
+            return (height < 1) ? 1 : height;
+        }
+
+        // samples in a whole image, what a progress_reporter counts up to
+        uint64_t total_samples() const {
+            return static_cast<uint64_t>(image_width) * get_image_height() * samples_per_pixel;
         }
 
     private:
@@ -73,10 +179,13 @@ class camera {
         vec3 defocus_disk_u; // defocus disk horizontal radius
         vec3 defocus_disk_v; // defocus disk vertical radius
 
+        double time_open, time_close; // the shutter, clamped to the frame
+
+        shared_ptr<sampler> samples; // numbers for the sample being traced, restarted for every camera ray
+
         void initialize() {
             // image_height
-            image_height = static_cast<int>(image_width / aspect_ratio);
-            image_height = (image_height < 1) ? 1 : image_height;
+            image_height = get_image_height();
 
             // set center
             center = lookfrom;
@@ -109,57 +218,220 @@ class camera {
             auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
             defocus_disk_u = u * defocus_radius;
             defocus_disk_v = v * defocus_radius;
+
+            time_open = std::min(1.0, std::max(0.0, shutter_open));
+            time_close = std::min(1.0, std::max(0.0, shutter_close));
+
+            samples = make_sampler(sampling, samples_per_pixel, sample_seed);
+        }
+
+        // running total of the per pixel cost measure: a clock in nanoseconds, or the thread's BVH work count
+        double pixel_cost_now() const {
+            if (heatmap_metric == cost_work) {
+                return static_cast<double>(ray_stats::thread_work());
+            }
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+        }
+
+        // Power heuristic (Veach): the weight of a strategy that picked a direction with pdf a, when the other one
+        // would have picked it with pdf b. Each strategy gets the say where it's the better of the two.
+        static double power_heuristic(double a, double b) {
+            double a2 = a * a, b2 = b * b;
+            return (a2 + b2 > 0) ? a2 / (a2 + b2) : 0;
         }
 
-        color ray_color(const ray& r, int depth, const hittable& world) const {
+        // Next event estimation: light arriving straight from one sampled point on a light, for a material with a BSDF.
+        // radiance * bsdf * cos / pdf, if a shadow ray says nothing is in between. With mis it's weighted against the
+        // chance of the material's own scattered ray having found the same light.
+        color direct_light(const ray& r_in, const hit_record& hit, const hittable& world, bool mis) const {
+            double time = r_in.time();
+            light_sample ls;
+            double pick = samples->get_1d();
+            double su, sv;
+            samples->get_2d(su, sv);
+            if (!lights->sample(hit.point, time, pick, su, sv, ls)) {
+                return color(0,0,0);
+            }
+            color f = hit.mat->eval(r_in, hit, ls.direction);
+            if (light_list::is_black(f)) {
+                return color(0,0,0);
+            }
+            hit_record blocker;
+            ray shadow(hit.point, ls.direction, time);
+            RAY_STAT(shadow_rays);
+            if (world.hit(shadow, interval(0.001, ls.distance - 0.001), blocker)) {
+                return color(0,0,0);
+            }
+            double weight = mis ? power_heuristic(ls.pdf, hit.mat->pdf(r_in, hit, ls.direction)) : 1.0;
+            return f * ls.radiance * (weight / ls.pdf);
+        }
+
+        // The whole image into a float framebuffer with AOVs, denoised if asked to, then written out
+        void render_buffered(const hittable& world) {
+            std::vector<float> framebuffer(3 * static_cast<size_t>(image_width) * image_height, 0.0f);
+            aov_buffers aov;
+            aov.resize(image_width, image_height);
+
+            // a row at a time, for the progress report; each row of the tile is a row of the image
+            progress_reporter reporter(total_samples(), progress);
+            for (int j = 0; j < image_height; ++j) {
+                TRACE_TILE(0, j, image_width, j + 1);
+                aov_buffers row;
+                row.resize(image_width, 1);
+                render_tile(world, 0, j, image_width, j + 1, 0, samples_per_pixel, framebuffer.data() + 3 * static_cast<size_t>(j) * image_width, &row);
+                aov.copy_row(row, j);
+                reporter.add(static_cast<uint64_t>(image_width) * samples_per_pixel);
+            }
+            reporter.finish();
+
+            if (denoise) {
+                if (!progress.quiet) {
+                    std::clog << "\rDenoising...              " << std::flush;
+                }
+                TRACE_SCOPE("denoise", "output");
+                denoiser filter;
+                filter.run(framebuffer.data(), aov, samples_per_pixel);
+            }
+
+            {
+                TRACE_SCOPE("write image", "output");
+                write_ppm(std::cout, framebuffer.data(), image_width, image_height, samples_per_pixel);
+            }
+            if (!aov_path.empty()) {
+                TRACE_SCOPE("write aov", "output");
+                if (!aov.write_exr(aov_path, framebuffer.data())) {
+                    std::cerr << "\ncould not write " << aov_path << '\n';
+                }
+            }
+            if (!heatmap_path.empty()) {
+                TRACE_SCOPE("write heatmap", "output");
+                double scale = heatmap_scale(aov.cost);
+                if (!write_heatmap(heatmap_path, aov.cost, image_width, image_height, scale)) {
+                    std::cerr << "\ncould not write " << heatmap_path << '\n';
+                }
+                std::clog << "\rHeatmap scale: dark red is " << scale << (heatmap_metric == cost_work ? " node visits and primitive tests" : " ns")
+                          << " per pixel or more\n";
+            }
+            if (!progress.quiet) {
+                std::clog << "\rDone.                  \n" << std::flush;
+            }
+        }
+
+        // bsdf_pdf is the pdf with which the previous surface's material picked r when that surface also sampled
+        // the lights, 0 for camera rays and specular bounces (whose light isn't counted anywhere else).
+        // first, if not null, gets what r hits
+        color ray_color(const ray& r, int depth, const hittable& world, double bsdf_pdf = 0, aov_sample* first = nullptr) const {
             hit_record hit;
 
             // reached max depth of recursive ray bounces, generate no further color
             if (depth <= 0) {
+                RAY_STAT(depth_limits);
                 return color(0,0,0);
             }
+            if (depth < max_depth) {
+                RAY_STAT(secondary_rays);
+            }
 
             // generate light on another surface from ray bouncing
             if (world.hit(r, interval(0.001, infinity), hit)) { // 0.001 to avoid self-intersections with a previously hit point on a surface
+                RAY_STAT(surface_hits);
+                if (first != nullptr) {
+                    first->hit = true;
+                    first->depth = hit.t * r.direction().length();
+                    first->normal = hit.normal;
+                    first->albedo = hit.mat->albedo_at(hit);
+                    first->object_id = hit.object_id;
+                    first->material_id = hit.material_id;
+                }
+
+                // light sources give off their own light; if the surface this ray bounced off sampled the lights as
+                // well, only with the MIS weight of having been found by the scattered ray
+                color emitted = hit.mat->emitted(hit);
+                if (bsdf_pdf > 0 && !light_list::is_black(emitted)) {
+                    emitted = emitted * power_heuristic(bsdf_pdf, lights->pdf(r, hit));
+                }
+
                 ray scattered;
                 color attenuation;
                 // scatter light from a ray bounce
-                if (hit.mat->scatter(r, hit, attenuation, scattered) == true) {
-                    return attenuation * ray_color(scattered, depth-1, world);
+                double u, v;
+                samples->get_2d(u, v);
+
+                // The light sample is taken whether or not sample() scatters: a BSDF sample that gets absorbed (fuzzy
+                // metal reflecting below the surface) still leaves the light sample's share of the direct light to count.
+                // Before recursing, so it always takes the same sampler dimensions of this bounce.
+                // At the last bounce the scattered ray isn't traced, so the light sample takes all the weight
+                bool sample_lights = lights != nullptr && !lights->empty() && hit.mat->has_bsdf();
+                bool mis = sample_lights && depth > 1;
+                color direct = sample_lights ? direct_light(r, hit, world, mis) : color(0,0,0);
+
+                if (hit.mat->sample(r, hit, u, v, attenuation, scattered) == true) {
+                    double pdf = mis ? hit.mat->pdf(r, hit, unit_vector(scattered.direction())) : 0;
+                    return emitted + direct + attenuation * ray_color(scattered, depth-1, world, pdf);
                 }
 
                 // we didn't hit another surface, do not generate any more light on a given point
-                return color(0,0,0);
+                RAY_STAT(scatter_absorbs);
+                return emitted + direct;
             }
 
+            RAY_STAT(sky_escapes);
+
+            if (!sky_gradient) {
+                return background;
+            }
             vec3 unit_direction = unit_vector(r.direction());
             auto a = 0.5 * (unit_direction.y() + 1.0);
             return (1.0-a)*color(1.0, 1.0, 1.0) + a*color(0.5, 0.7, 1.0);
         }
 
-        ray get_ray(int i, int j) {
+        ray get_ray(int i, int j, int sample) {
             // Get a randomly sampled camera ray for the pixel at location i,j, originating from the defocus disk
+            samples->start(i, j, sample);
+            RAY_STAT(primary_rays);
             auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
             auto pixel_sample = pixel_center + pixel_sample_square();
 
             // if our defocus angle is not 0, then we have a defocus disc (lens) from which we generate rays
             auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
             auto ray_direction = pixel_sample - ray_origin;
+            auto ray_time = (time_close > time_open)
+                ? time_open + (time_close - time_open) * samples->get_1d()
+                : time_open;
 
-            return ray(ray_origin, ray_direction);
+            return ray(ray_origin, ray_direction, ray_time);
         }
 
         vec3 pixel_sample_square() const {
             // Return a random point in a square surrounding a pixel at the origin
-            auto px = -0.5 + random_double();
-            auto py = -0.5 + random_double();
+            double px, py;
+            samples->get_2d(px, py);
+            px -= 0.5;
+            py -= 0.5;
             return (px * pixel_delta_u) + (py * pixel_delta_v);
         }
         
         point3 defocus_disk_sample() const {
-            // returns a random point on the defocus disk
-            auto p = random_in_unit_disk();
-            return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
+            // returns a random point on the defocus disk, the square sample mapped onto it with Shirley's concentric
+            // map (rejection sampling like random_in_unit_disk would use up a varying number of dimensions)
+            double a, b;
+            samples->get_2d(a, b);
+            a = 2 * a - 1;
+            b = 2 * b - 1;
+            double r, theta;
+            if (a == 0 && b == 0) {
+                return center;
+            }
+            if (a*a > b*b) {
+                r = a;
+                theta = (pi / 4) * (b / a);
+            }
+            else {
+                r = b;
+                theta = (pi / 2) - (pi / 4) * (a / b);
+            }
+            return center + (r * std::cos(theta) * defocus_disk_u) + (r * std::sin(theta) * defocus_disk_v);
         }
 };
 
@@ -0,0 +1,105 @@
+# Rays per second of the same benchmark built four ways, run by the build_report target
+# (cmake -DSOURCE_DIR=... -DBUILD_DIR=... -P build_report.cmake):
+#
+#     debug        no optimization, what an empty build type used to give
+#     release      -O3, no LTO
+#     release-lto  -O3 with link time optimization, the default build
+#     pgo          release-lto trained and rebuilt with profile guided optimization (cmake/pgo.cmake)
+#
+# Every build runs render_bench with the same arguments (REPORT_ARGS, ;-separated, to override), the results go to
+# BUILD_DIR/<config>.json and a table of camera rays per second per scene, relative to release, to
+# BUILD_DIR/report.md and the terminal. When pgo isn't faster than release-lto on average over the scenes, the
+# report says so and this warns: a profile is only worth using where it has been measured to win.
+# Optional: CXX_COMPILER, GENERATOR.
+
+cmake_minimum_required (VERSION 3.19)
+
+if (NOT SOURCE_DIR OR NOT BUILD_DIR)
+    message (FATAL_ERROR "build_report.cmake needs -DSOURCE_DIR=... and -DBUILD_DIR=...")
+endif ()
+if (NOT REPORT_ARGS)
+    set (REPORT_ARGS --width 200 --spp 8 --repeat 3)
+endif ()
+
+set (common_args "")
+if (CXX_COMPILER)
+    list (APPEND common_args "-DCXX_COMPILER=${CXX_COMPILER}")
+endif ()
+set (configure_args "")
+if (CXX_COMPILER)
+    list (APPEND configure_args "-DCMAKE_CXX_COMPILER=${CXX_COMPILER}")
+endif ()
+if (GENERATOR)
+    list (APPEND configure_args -G "${GENERATOR}")
+    list (APPEND common_args "-DGENERATOR=${GENERATOR}")
+endif ()
+
+function (run)
+    execute_process (COMMAND ${ARGN} RESULT_VARIABLE result)
+    if (result)
+        message (FATAL_ERROR "failed (${result}): ${ARGN}")
+    endif ()
+endfunction ()
+
+function (build config)
+    message (STATUS "Report: building ${config}")
+    run (${CMAKE_COMMAND} -S "${SOURCE_DIR}" -B "${BUILD_DIR}/${config}" ${configure_args} ${ARGN})
+    run (${CMAKE_COMMAND} --build "${BUILD_DIR}/${config}" --target render_bench)
+endfunction ()
+
+build (debug -DCMAKE_BUILD_TYPE=Debug)
+build (release -DCMAKE_BUILD_TYPE=Release -DRENDER_LTO=OFF)
+build (release-lto -DCMAKE_BUILD_TYPE=Release -DRENDER_LTO=ON)
+message (STATUS "Report: building pgo")
+run (${CMAKE_COMMAND} "-DSOURCE_DIR=${SOURCE_DIR}" "-DBUILD_DIR=${BUILD_DIR}/pgo" ${common_args} -P "${CMAKE_CURRENT_LIST_DIR}/pgo.cmake")
+
+set (configs debug release release-lto pgo)
+foreach (config IN LISTS configs)
+    message (STATUS "Report: benchmarking ${config}")
+    run (${BUILD_DIR}/${config}/render_bench ${REPORT_ARGS} --json "${BUILD_DIR}/${config}.json")
+    file (READ "${BUILD_DIR}/${config}.json" json_${config})
+endforeach ()
+
+# one row per scene, camera rays per second of each build and its speedup over release
+string (JSON scene_count LENGTH "${json_release}" scenes)
+math (EXPR last_scene "${scene_count} - 1")
+string (JOIN " | " header ${configs})
+string (REPLACE ";" " " args "${REPORT_ARGS}")
+set (report "Camera rays per second (k), render_bench ${args}\n\n| scene | ${header} |\n|---|---|---|---|---|\n")
+set (pgo_over_lto 0)
+foreach (k RANGE ${last_scene})
+    string (JSON name GET "${json_release}" scenes ${k} name)
+    string (JSON base GET "${json_release}" scenes ${k} rays_per_second)
+    # CMake's math is integer only
+    string (REGEX REPLACE "\\..*" "" base "${base}")
+    if (base EQUAL 0)
+        set (base 1)
+    endif ()
+    set (row "| ${name} |")
+    foreach (config IN LISTS configs)
+        string (JSON rate GET "${json_${config}}" scenes ${k} rays_per_second)
+        string (REGEX REPLACE "\\..*" "" rate "${rate}")
+        math (EXPR thousands "${rate} / 1000")
+        math (EXPR percent "${rate} * 100 / ${base}")
+        string (APPEND row " ${thousands} (${percent}%) |")
+        set (rate_${config} ${rate})
+    endforeach ()
+    string (APPEND report "${row}\n")
+    if (rate_release-lto GREATER 0)
+        math (EXPR pgo_over_lto "${pgo_over_lto} + ${rate_pgo} * 100 / ${rate_release-lto}")
+    endif ()
+endforeach ()
+
+# pgo relative to release-lto, averaged over the scenes
+math (EXPR pgo_over_lto "${pgo_over_lto} / ${scene_count}")
+if (pgo_over_lto LESS 100)
+    set (verdict "pgo is slower than release-lto (${pgo_over_lto}% of its rays per second on average), use release-lto")
+    string (APPEND report "\n${verdict}\n")
+    message (WARNING "${verdict}")
+else ()
+    string (APPEND report "\npgo: ${pgo_over_lto}% of release-lto's rays per second on average\n")
+endif ()
+
+file (WRITE "${BUILD_DIR}/report.md" "${report}")
+message ("${report}")
+message (STATUS "Report: results in ${BUILD_DIR}")
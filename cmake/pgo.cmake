@@ -0,0 +1,79 @@
+# Profile guided build, run by the pgo target (cmake -DSOURCE_DIR=... -DBUILD_DIR=... -P pgo.cmake):
+# an instrumented Release build, training runs of render_bench on its reference scenes and of inOneWeekend on
+# its built-in scene (each executable is one translation unit with a profile of its own), and a rebuild of the
+# same tree with the profile. The rebuild has to reuse the build directory: GCC finds each object's profile by
+# the object's path. The optimized binaries end up in BUILD_DIR.
+#
+# render_bench trains once per instruction set (RENDER_ISA, see cpu_dispatch.h) on x86, so every dispatched kernel
+# this CPU can run has a profile, not just the one it picks. Kernels it can't run still lack one.
+# Whether the result beats plain Release is for build_report to say, it hasn't always.
+#
+# Optional: CXX_COMPILER, GENERATOR, TRAINING_ARGS (render_bench arguments, ;-separated).
+
+cmake_minimum_required (VERSION 3.10)
+
+if (NOT SOURCE_DIR OR NOT BUILD_DIR)
+    message (FATAL_ERROR "pgo.cmake needs -DSOURCE_DIR=... and -DBUILD_DIR=...")
+endif ()
+if (NOT TRAINING_ARGS)
+    set (TRAINING_ARGS --width 160 --spp 8 --repeat 1)
+endif ()
+
+set (profile_dir "${BUILD_DIR}/pgo-profile")
+set (configure_args -DCMAKE_BUILD_TYPE=Release "-DRENDER_PGO_DIR=${profile_dir}")
+if (CXX_COMPILER)
+    list (APPEND configure_args "-DCMAKE_CXX_COMPILER=${CXX_COMPILER}")
+endif ()
+if (GENERATOR)
+    list (APPEND configure_args -G "${GENERATOR}")
+endif ()
+
+function (run)
+    execute_process (COMMAND ${ARGN} RESULT_VARIABLE result)
+    if (result)
+        message (FATAL_ERROR "failed (${result}): ${ARGN}")
+    endif ()
+endfunction ()
+
+message (STATUS "PGO: instrumented build in ${BUILD_DIR}")
+file (REMOVE_RECURSE "${profile_dir}")
+run (${CMAKE_COMMAND} -S "${SOURCE_DIR}" -B "${BUILD_DIR}" ${configure_args} -DRENDER_PGO=GENERATE)
+run (${CMAKE_COMMAND} --build "${BUILD_DIR}")
+
+message (STATUS "PGO: training on the benchmark scenes")
+cmake_host_system_information (RESULT platform QUERY OS_PLATFORM)
+if (platform MATCHES "^(x86_64|AMD64|amd64|i.86)$")
+    set (training_isas sse2 avx2 avx512)
+else ()
+    set (training_isas "")
+endif ()
+if (NOT training_isas)
+    run (${BUILD_DIR}/render_bench ${TRAINING_ARGS} --json "${BUILD_DIR}/training.json")
+endif ()
+foreach (isa IN LISTS training_isas)
+    # a set the CPU doesn't have falls back to the detected one with a warning, which only trains that again
+    run (${CMAKE_COMMAND} -E env RENDER_ISA=${isa} ${BUILD_DIR}/render_bench ${TRAINING_ARGS} --json "${BUILD_DIR}/training-${isa}.json")
+endforeach ()
+run (${BUILD_DIR}/inOneWeekend --save-scene "${BUILD_DIR}/training_scene.txt")
+file (APPEND "${BUILD_DIR}/training_scene.txt" "camera image_width 160 samples_per_pixel 8\n")
+execute_process (COMMAND ${BUILD_DIR}/inOneWeekend --scene "${BUILD_DIR}/training_scene.txt" --no-bvh-cache --quiet
+                 OUTPUT_FILE "${BUILD_DIR}/training.ppm" RESULT_VARIABLE result)
+if (result)
+    message (FATAL_ERROR "inOneWeekend training run failed (${result})")
+endif ()
+
+# clang writes raw profiles that have to be merged into one file first
+file (GLOB raw_profiles "${profile_dir}/*.profraw")
+if (raw_profiles)
+    get_filename_component (compiler_dir "${CXX_COMPILER}" DIRECTORY)
+    find_program (LLVM_PROFDATA NAMES llvm-profdata HINTS "${compiler_dir}")
+    if (NOT LLVM_PROFDATA)
+        message (FATAL_ERROR "clang profiles need llvm-profdata to merge them")
+    endif ()
+    run (${LLVM_PROFDATA} merge "-output=${profile_dir}/merged.profdata" ${raw_profiles})
+endif ()
+
+message (STATUS "PGO: optimized rebuild")
+run (${CMAKE_COMMAND} -S "${SOURCE_DIR}" -B "${BUILD_DIR}" ${configure_args} -DRENDER_PGO=USE)
+run (${CMAKE_COMMAND} --build "${BUILD_DIR}")
+message (STATUS "PGO: done, binaries in ${BUILD_DIR}")
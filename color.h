@@ -34,4 +34,13 @@ void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
         << static_cast<int>(256 * intensity.clamp(b)) << '\n';
 }
 
+// write a whole image of un-normalized color sums (3 floats per pixel, rows top to bottom) as a plain PPM
+inline void write_ppm(std::ostream &out, const float* sums, int width, int height, int samples_per_pixel) {
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    size_t count = 3 * static_cast<size_t>(width) * height;
+    for (size_t p = 0; p < count; p += 3) {
+        write_color(out, color(sums[p], sums[p+1], sums[p+2]), samples_per_pixel);
+    }
+}
+
 #endif
\ No newline at end of file
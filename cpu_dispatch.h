@@ -0,0 +1,86 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+/*
+Runtime CPU dispatch
+
+The binary is built for the baseline instruction set (SSE2 on x86-64), so it runs on every node. The hot kernels
+(BVH box tests and sphere tests, see simd_kernels.h) are additionally compiled for AVX2 and AVX-512 through
+function target attributes, and selected_cpu_isa() picks the widest one this CPU and OS support, once, at startup.
+No -march flags are involved.
+
+None of the targets enable FMA: contracting a*b+c changes the rounding, and tiles rendered on differently
+equipped machines have to add up to the same image. Every variant does the same double precision operations
+in the same order, so the images are identical whichever one runs.
+
+RENDER_ISA=sse2|avx2|avx512 in the environment asks for a narrower set than the detected one, for comparing
+them; asking for more than the CPU has is refused with a warning.
+*/
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RENDER_X86_DISPATCH 1
+#define RENDER_TARGET_AVX2 __attribute__((target("avx2")))
+#define RENDER_TARGET_AVX512 __attribute__((target("avx2,avx512f")))
+// inline everything a dispatched entry point calls, so the whole kernel is compiled for its target
+#define RENDER_FLATTEN __attribute__((flatten))
+#else
+#define RENDER_X86_DISPATCH 0
+#endif
+
+enum cpu_isa {
+    cpu_isa_generic,
+    cpu_isa_avx2,
+    cpu_isa_avx512
+};
+
+inline const char* cpu_isa_name(cpu_isa isa) {
+    switch (isa) {
+        case cpu_isa_avx512: return "avx512";
+        case cpu_isa_avx2:   return "avx2";
+        default:             return RENDER_X86_DISPATCH ? "sse2" : "generic";
+    }
+}
+
+// the widest instruction set with kernels here that this CPU (and the OS, for the register state) supports
+inline cpu_isa detect_cpu_isa() {
+#if RENDER_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return cpu_isa_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return cpu_isa_avx2;
+    }
+#endif
+    return cpu_isa_generic;
+}
+
+// detect_cpu_isa(), possibly lowered by RENDER_ISA; worked out on first use and fixed from then on
+inline cpu_isa selected_cpu_isa() {
+    static const cpu_isa selected = []() {
+        cpu_isa isa = detect_cpu_isa();
+        const char* wanted = std::getenv("RENDER_ISA");
+        if (wanted == nullptr || *wanted == '\0') {
+            return isa;
+        }
+        for (int k = cpu_isa_generic; k <= cpu_isa_avx512; ++k) {
+            cpu_isa candidate = static_cast<cpu_isa>(k);
+            if (std::strcmp(wanted, cpu_isa_name(candidate)) == 0) {
+                if (candidate > isa) {
+                    std::cerr << "RENDER_ISA=" << wanted << " is not supported here, using " << cpu_isa_name(isa) << '\n';
+                    return isa;
+                }
+                return candidate;
+            }
+        }
+        std::cerr << "unknown RENDER_ISA=" << wanted << ", using " << cpu_isa_name(isa) << '\n';
+        return isa;
+    }();
+    return selected;
+}
+
+#endif
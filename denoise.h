@@ -0,0 +1,224 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "rtweekend.h"
+
+#include "aov.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+/*
+Denoiser
+
+An edge-avoiding a-trous wavelet filter (Dammertz et al. 2010, "Edge-Avoiding A-Trous Wavelet Transform for fast
+Global Illumination Filtering"), with the luminance variance guiding it as in SVGF (Schied et al. 2017).
+
+Every pass blurs each pixel with a 5x5 B3 spline kernel whose taps are spread out further each time (1, 2, 4, 8, 16
+pixels apart), so five passes cover an 80 pixel wide area at the cost of 25 taps each. Each tap is weighted down when
+the neighbour is on a different surface (normal, depth and albedo from the AOVs differ) or its color differs by much
+more than the noise would explain (the per pixel variance, which shrinks with every pass as noise gets averaged out).
+
+The filter runs on the lighting alone: the color divided by the first hit's albedo. Texture and color detail comes back
+when multiplying the albedo in again afterwards, so it doesn't get blurred away with the noise.
+
+Passes are split across threads by rows.
+*/
+
+struct denoise_settings {
+    int iterations = 5;          // a-trous passes, the kernel footprint doubles with each
+    double color_sigma = 4.0;    // how many standard deviations of noise a color difference may be
+    double normal_power = 64.0;  // weight is dot(n, n')^normal_power
+    double depth_sigma = 1.0;    // in units of 2% of the depth per kernel step
+    double albedo_sigma = 0.1;
+    int threads = 0;             // 0 picks the hardware thread count
+};
+
+class denoiser {
+    public:
+        denoise_settings settings;
+
+        denoiser() {}
+        denoiser(const denoise_settings& _settings) : settings(_settings) {}
+
+        // Denoise a width x height image given as color sums over spp samples per pixel (3 floats each, as render_tile
+        // makes them), in place. The result is still sums over spp, so write_ppm takes it unchanged.
+        void run(float* sums, const aov_buffers& aov, int spp) {
+            width = aov.width;
+            height = aov.height;
+            size_t pixels = static_cast<size_t>(width) * height;
+            if (pixels == 0 || spp <= 0) {
+                return;
+            }
+
+            // per pixel averages; the lighting is the color with the albedo divided out
+            double inv_spp = 1.0 / spp;
+            features.resize(pixels);
+            std::vector<pixel_state> current(pixels), next(pixels);
+            for (size_t p = 0; p < pixels; ++p) {
+                feature& f = features[p];
+                f.depth = aov.depth[p] * inv_spp;
+                vec3 n(aov.normal[3*p], aov.normal[3*p + 1], aov.normal[3*p + 2]);
+                f.normal = (n.length_squared() > 0) ? unit_vector(n) : vec3(0, 0, 0);
+                f.albedo = color(aov.albedo[3*p], aov.albedo[3*p + 1], aov.albedo[3*p + 2]) * inv_spp;
+
+                color mean = color(sums[3*p], sums[3*p + 1], sums[3*p + 2]) * inv_spp;
+                pixel_state& s = current[p];
+                s.light = demodulate(mean, f.albedo);
+
+                // variance of the pixel's mean luminance, from the spread of its samples, moved into lighting units
+                double l = aov_buffers::luminance(mean);
+                double sample_variance = (spp > 1) ? std::fmax(0.0, aov.luminance_squares[p] * inv_spp - l*l) * spp / (spp - 1) : 1.0;
+                double a = std::fmax(aov_buffers::luminance(f.albedo), albedo_floor());
+                s.variance = sample_variance * inv_spp / (a * a);
+            }
+
+            for (int iteration = 0; iteration < settings.iterations; ++iteration) {
+                int step = 1 << iteration;
+                for_rows([&](int y0, int y1) { filter_rows(current, next, step, y0, y1); });
+                current.swap(next);
+            }
+
+            for (size_t p = 0; p < pixels; ++p) {
+                color c = remodulate(current[p].light, features[p].albedo) * spp;
+                sums[3*p] = static_cast<float>(c.x());
+                sums[3*p + 1] = static_cast<float>(c.y());
+                sums[3*p + 2] = static_cast<float>(c.z());
+            }
+        }
+
+    private:
+        struct feature {
+            double depth;
+            vec3 normal;
+            color albedo;
+        };
+
+        struct pixel_state {
+            color light;
+            double variance;
+        };
+
+        // albedo is clamped to at least this before dividing by it, black surfaces would blow the lighting up
+        static double albedo_floor() { return 0.01; }
+
+        // the image being denoised
+        int width = 0, height = 0;
+        std::vector<feature> features;
+
+        static color demodulate(const color& c, const color& albedo) {
+            return color(c.x() / std::fmax(albedo.x(), albedo_floor()),
+                         c.y() / std::fmax(albedo.y(), albedo_floor()),
+                         c.z() / std::fmax(albedo.z(), albedo_floor()));
+        }
+
+        static color remodulate(const color& light, const color& albedo) {
+            return color(light.x() * std::fmax(albedo.x(), albedo_floor()),
+                         light.y() * std::fmax(albedo.y(), albedo_floor()),
+                         light.z() * std::fmax(albedo.z(), albedo_floor()));
+        }
+
+        // run f(y0, y1) over bands of rows on all threads
+        template <typename F>
+        void for_rows(F f) const {
+            int threads = settings.threads > 0 ? settings.threads : static_cast<int>(std::thread::hardware_concurrency());
+            threads = std::max(1, std::min(threads, height));
+            if (threads == 1) {
+                f(0, height);
+                return;
+            }
+            std::vector<std::thread> pool;
+            for (int t = 0; t < threads; ++t) {
+                int y0 = static_cast<int>(static_cast<long long>(height) * t / threads);
+                int y1 = static_cast<int>(static_cast<long long>(height) * (t + 1) / threads);
+                pool.emplace_back([=]() { f(y0, y1); });
+            }
+            for (auto& thread : pool) {
+                thread.join();
+            }
+        }
+
+        // 3x3 gaussian blur of the variance around (x, y): the estimate from a few samples alone is too noisy
+        // to trust for a single pixel
+        double blurred_variance(const std::vector<pixel_state>& in, int x, int y) const {
+            static const double kernel[2] = { 1.0 / 2.0, 1.0 / 4.0 };
+            double sum = 0, sum_weight = 0;
+            for (int dy = -1; dy <= 1; ++dy) {
+                int qy = y + dy;
+                if (qy < 0 || qy >= height) {
+                    continue;
+                }
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int qx = x + dx;
+                    if (qx < 0 || qx >= width) {
+                        continue;
+                    }
+                    double w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                    sum += w * in[static_cast<size_t>(qy) * width + qx].variance;
+                    sum_weight += w;
+                }
+            }
+            return sum / sum_weight;
+        }
+
+        // one a-trous pass over rows [y0, y1) from in to out, taps step pixels apart
+        void filter_rows(const std::vector<pixel_state>& in, std::vector<pixel_state>& out, int step, int y0, int y1) const {
+            static const double kernel[3] = { 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0 };
+
+            for (int y = y0; y < y1; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    size_t p = static_cast<size_t>(y) * width + x;
+                    const feature& fp = features[p];
+                    const pixel_state& sp = in[p];
+                    double lp = aov_buffers::luminance(sp.light);
+                    double color_scale = settings.color_sigma * std::sqrt(blurred_variance(in, x, y)) + 1e-6;
+
+                    color sum_light(0, 0, 0);
+                    double sum_variance = 0, sum_weight = 0;
+                    for (int dy = -2; dy <= 2; ++dy) {
+                        int qy = y + dy * step;
+                        if (qy < 0 || qy >= height) {
+                            continue;
+                        }
+                        for (int dx = -2; dx <= 2; ++dx) {
+                            int qx = x + dx * step;
+                            if (qx < 0 || qx >= width) {
+                                continue;
+                            }
+                            size_t q = static_cast<size_t>(qy) * width + qx;
+                            const feature& fq = features[q];
+                            const pixel_state& sq = in[q];
+
+                            double w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                            if (q != p) {
+                                double w_color = std::exp(-std::fabs(lp - aov_buffers::luminance(sq.light)) / color_scale);
+                                double w_normal = std::pow(std::fmax(0.0, dot(fp.normal, fq.normal)), settings.normal_power);
+                                if (dot(fp.normal, fp.normal) == 0 && dot(fq.normal, fq.normal) == 0) {
+                                    w_normal = 1; // both missed everything
+                                }
+                                double far = std::fmax(fp.depth, fq.depth);
+                                double w_depth = (far > 0)
+                                    ? std::exp(-std::fabs(fp.depth - fq.depth) / (settings.depth_sigma * 0.02 * step * far))
+                                    : 1.0;
+                                vec3 da = fp.albedo - fq.albedo;
+                                double w_albedo = std::exp(-da.length_squared() / (settings.albedo_sigma * settings.albedo_sigma));
+                                w *= w_color * w_normal * w_depth * w_albedo;
+                            }
+
+                            sum_light += w * sq.light;
+                            sum_variance += w * w * sq.variance;
+                            sum_weight += w;
+                        }
+                    }
+
+                    // the center tap always has weight, so sum_weight > 0
+                    out[p].light = sum_light / sum_weight;
+                    out[p].variance = sum_variance / (sum_weight * sum_weight);
+                }
+            }
+        }
+};
+
+#endif
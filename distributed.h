@@ -0,0 +1,492 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "hittable.h"
+#include "camera.h"
+#include "progress.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Distributed rendering over TCP
+
+A coordinator splits the frame into jobs (a tile of pixels plus a range of samples for each pixel)
+and hands them to worker processes. Workers connect to the coordinator, build the scene once,
+and then render job after job against that same world, sending back the tile as raw float sums.
+The coordinator adds every returned tile into one float framebuffer and only converts to 8 bit color at the end,
+so splitting a pixel's samples across several workers gives the same image as rendering them in one go.
+
+If a worker disconnects (crash, killed, network loss) while it holds a job, that job goes back on the queue
+and the next free worker picks it up. So does a job a worker has held for longer than job_timeout_s (a hung worker,
+or a network that silently stopped delivering): the coordinator drops that worker's connection, so a late result
+can't be counted twice. If no worker is connected (and no spawned one is still starting) for worker_wait_s, the
+render fails instead of waiting forever for workers that aren't coming.
+
+Protocol (host byte order, coordinator and workers are expected to be the same build on the same kind of machine):
+    worker -> coordinator   hello  { magic, version, image_width, image_height, samples_per_pixel }
+    coordinator -> worker   job    { id, x0, y0, x1, y1, s0, s1 }    (id == render_job_done means we're finished)
+    worker -> coordinator   result { id, float_count } followed by float_count floats
+*/
+
+const uint32_t render_protocol_magic   = 0x5254574B; // "RTWK"
+const uint32_t render_protocol_version = 1;
+const uint32_t render_job_done         = 0xFFFFFFFF;
+
+struct render_hello {
+    uint32_t magic;
+    uint32_t version;
+    int32_t image_width;
+    int32_t image_height;
+    int32_t samples_per_pixel;
+};
+
+struct render_job {
+    uint32_t id;
+    int32_t x0, y0, x1, y1; // pixel rectangle [x0,x1) x [y0,y1)
+    int32_t s0, s1;         // sample range [s0,s1) of every pixel in the rectangle
+};
+
+struct render_result_header {
+    uint32_t id;
+    uint32_t float_count;
+};
+
+// jobs and results are small request/response messages, don't let Nagle sit on them waiting for ACKs
+inline void set_no_delay(int fd) {
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
+// keep writing until the whole buffer is out, false if the peer went away
+inline bool send_all(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// recv_all, but also false if deadline passes before the whole buffer is there
+inline bool recv_all_until(int fd, void* data, size_t len, std::chrono::steady_clock::time_point deadline) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) {
+            return false;
+        }
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ready = poll(&pfd, 1, static_cast<int>(std::min<long long>(left, 1000 * 1000)));
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+        if (ready <= 0) {
+            continue; // interrupted, or a long deadline's wait ran out in pieces
+        }
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// keep reading until the whole buffer is filled, false on error or disconnect
+inline bool recv_all(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+class render_worker {
+    public:
+        render_worker(camera& _cam, const hittable& _world) : cam(_cam), world(_world) {}
+
+        // Connect to the coordinator at host:port and render jobs until told we're done.
+        // Returns the number of jobs rendered, or -1 if we never managed to connect.
+        int run(const std::string& host, int port) {
+            int fd = connect_to(host, port);
+            if (fd < 0) {
+                std::clog << "worker: could not connect to " << host << ':' << port << '\n';
+                return -1;
+            }
+
+            render_hello hello;
+            hello.magic = render_protocol_magic;
+            hello.version = render_protocol_version;
+            hello.image_width = cam.image_width;
+            hello.image_height = cam.get_image_height();
+            hello.samples_per_pixel = cam.samples_per_pixel;
+            if (!send_all(fd, &hello, sizeof(hello))) {
+                close(fd);
+                return -1;
+            }
+
+            // the world (and anything built on top of it) stays loaded across jobs, only the tile buffer is reused
+            int jobs_done = 0;
+            std::vector<float> tile;
+            render_job job;
+            while (recv_all(fd, &job, sizeof(job)) && job.id != render_job_done) {
+                size_t float_count = 3 * static_cast<size_t>(job.x1 - job.x0) * (job.y1 - job.y0);
+                tile.assign(float_count, 0.0f);
+
+                // the samplers' numbers depend only on the pixel and sample index, so a retried job reproduces the same noise
+                cam.render_tile(world, job.x0, job.y0, job.x1, job.y1, job.s0, job.s1, tile.data());
+
+                render_result_header header;
+                header.id = job.id;
+                header.float_count = static_cast<uint32_t>(float_count);
+                if (!send_all(fd, &header, sizeof(header)) || !send_all(fd, tile.data(), float_count * sizeof(float))) {
+                    break;
+                }
+                ++jobs_done;
+            }
+
+            close(fd);
+            return jobs_done;
+        }
+
+    private:
+        camera& cam;
+        const hittable& world;
+
+        static int connect_to(const std::string& host, int port) {
+            addrinfo hints;
+            std::memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+
+            // the coordinator might still be starting up, so give it a few seconds
+            for (int attempt = 0; attempt < 50; ++attempt) {
+                addrinfo* result = nullptr;
+                if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) == 0) {
+                    for (addrinfo* a = result; a != nullptr; a = a->ai_next) {
+                        int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                        if (fd < 0) {
+                            continue;
+                        }
+                        if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                            set_no_delay(fd);
+                            freeaddrinfo(result);
+                            return fd;
+                        }
+                        close(fd);
+                    }
+                    freeaddrinfo(result);
+                }
+                usleep(200 * 1000);
+            }
+            return -1;
+        }
+};
+
+class render_coordinator {
+    public:
+        int tile_size = 32;    // edge length of the square pixel tiles handed out as jobs
+        int sample_splits = 1; // number of sample ranges each tile is split into (more, smaller jobs)
+        double job_timeout_s = 600; // how long a worker may take over one job before it's requeued, 0 for no limit
+        double worker_wait_s = 30;  // how long to go on with no worker at all before giving up
+
+        render_coordinator(camera& _cam, const hittable& _world) : cam(_cam), world(_world) {}
+
+        ~render_coordinator() {
+            if (listen_fd >= 0) {
+                close(listen_fd);
+            }
+        }
+
+        // open the listening socket, false if the port can't be bound
+        bool listen_on(int port) {
+            listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (listen_fd < 0) {
+                return false;
+            }
+            int yes = 1;
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+            sockaddr_in addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            addr.sin_port = htons(static_cast<uint16_t>(port));
+            if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+                close(listen_fd);
+                listen_fd = -1;
+                return false;
+            }
+            listen_port = port;
+            return true;
+        }
+
+        // Fork n worker processes that connect back over localhost. They share the already built world
+        // copy-on-write, so call this after the scene is loaded and before render() starts any threads.
+        void spawn_local_workers(int n) {
+            for (int k = 0; k < n; ++k) {
+                pid_t pid = fork();
+                if (pid == 0) {
+                    close(listen_fd);
+                    render_worker worker(cam, world);
+                    _exit(worker.run("127.0.0.1", listen_port) < 0 ? 1 : 0);
+                }
+                if (pid > 0) {
+                    children.push_back(pid);
+                }
+            }
+        }
+
+        // Hand out jobs to whichever workers connect until every job is merged, then write the image as PPM.
+        // False, with nothing written, if the workers ran out first.
+        bool render(std::ostream& out) {
+            // a worker dying mid-send must not take the coordinator down with it
+            signal(SIGPIPE, SIG_IGN);
+
+            image_width = cam.image_width;
+            image_height = cam.get_image_height();
+            framebuffer.assign(3 * static_cast<size_t>(image_width) * image_height, 0.0f);
+            make_jobs();
+            progress_reporter reporter(cam.total_samples(), cam.progress);
+            progress = &reporter;
+
+            std::vector<std::thread> connections;
+            auto last_worker = std::chrono::steady_clock::now();
+            bool failed = false;
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    if (remaining == 0) {
+                        break;
+                    }
+                    auto now = std::chrono::steady_clock::now();
+                    if (connected > 0 || children_running()) {
+                        last_worker = now;
+                    }
+                    else if (std::chrono::duration<double>(now - last_worker).count() > worker_wait_s) {
+                        std::cerr << "\ncoordinator: no workers left, " << remaining << " jobs not rendered\n";
+                        failed = true;
+                        break;
+                    }
+                }
+
+                // poll with a timeout so we notice when the last job comes back
+                pollfd pfd;
+                pfd.fd = listen_fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, 100) > 0 && (pfd.revents & POLLIN)) {
+                    int fd = accept(listen_fd, nullptr, nullptr);
+                    if (fd >= 0) {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        ++connected;
+                        connections.push_back(std::thread(&render_coordinator::serve_worker, this, fd));
+                    }
+                }
+            }
+
+            // wake anyone still waiting for a job so they can tell their worker to stop
+            cv.notify_all();
+            for (auto& t : connections) {
+                t.join();
+            }
+            for (pid_t pid : children) {
+                waitpid(pid, nullptr, 0);
+            }
+            children.clear();
+            reporter.finish(!failed);
+            progress = nullptr;
+            if (failed) {
+                return false;
+            }
+
+            if (!cam.progress.quiet) {
+                std::clog << "\rDone.                  \n" << std::flush;
+            }
+
+            write_ppm(out, framebuffer.data(), image_width, image_height, cam.samples_per_pixel);
+            return true;
+        }
+
+    private:
+        camera& cam;
+        const hittable& world;
+
+        int listen_fd = -1;
+        int listen_port = 0;
+        std::vector<pid_t> children;
+
+        int image_width = 0;
+        int image_height = 0;
+        std::vector<float> framebuffer; // un-normalized color sums, 3 floats per pixel
+
+        // job queue shared by all connection threads
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<render_job> pending;
+        size_t remaining = 0; // jobs not yet merged, including ones currently out at a worker
+        int connected = 0;    // connection threads still serving a worker
+        progress_reporter* progress = nullptr; // counts merged samples while render() runs
+
+        // whether any spawned worker process hasn't exited yet, reaping the ones that have
+        bool children_running() {
+            for (size_t k = 0; k < children.size(); ) {
+                if (waitpid(children[k], nullptr, WNOHANG) == children[k]) {
+                    children.erase(children.begin() + k);
+                }
+                else {
+                    ++k;
+                }
+            }
+            return !children.empty();
+        }
+
+        void make_jobs() {
+            pending.clear();
+            int spp = cam.samples_per_pixel;
+            int splits = (sample_splits < 1) ? 1 : (sample_splits > spp ? spp : sample_splits);
+            uint32_t id = 0;
+            for (int y = 0; y < image_height; y += tile_size) {
+                for (int x = 0; x < image_width; x += tile_size) {
+                    for (int k = 0; k < splits; ++k) {
+                        render_job job;
+                        job.id = id++;
+                        job.x0 = x;
+                        job.y0 = y;
+                        job.x1 = (x + tile_size < image_width) ? x + tile_size : image_width;
+                        job.y1 = (y + tile_size < image_height) ? y + tile_size : image_height;
+                        job.s0 = spp * k / splits;
+                        job.s1 = spp * (k + 1) / splits;
+                        pending.push_back(job);
+                    }
+                }
+            }
+            remaining = pending.size();
+        }
+
+        void serve_worker(int fd) {
+            serve(fd);
+            close(fd);
+            std::lock_guard<std::mutex> lock(mtx);
+            --connected;
+        }
+
+        void serve(int fd) {
+            // don't let a silent client hold up shutdown forever while we wait for its hello
+            timeval timeout;
+            timeout.tv_sec = 10;
+            timeout.tv_usec = 0;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            int yes = 1;
+            setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+            set_no_delay(fd);
+
+            render_hello hello;
+            if (!recv_all(fd, &hello, sizeof(hello)) || hello.magic != render_protocol_magic
+                || hello.version != render_protocol_version || hello.image_width != image_width
+                || hello.image_height != image_height || hello.samples_per_pixel != cam.samples_per_pixel) {
+                std::clog << "coordinator: rejected worker with mismatched hello\n";
+                return;
+            }
+            // tiles can legitimately take a long time, job_timeout_s is what limits them from here on
+            timeout.tv_sec = 0;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            std::vector<float> tile;
+            while (true) {
+                render_job job;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    cv.wait(lock, [this] { return !pending.empty() || remaining == 0; });
+                    if (remaining == 0) {
+                        break;
+                    }
+                    job = pending.front();
+                    pending.pop_front();
+                }
+
+                size_t float_count = 3 * static_cast<size_t>(job.x1 - job.x0) * (job.y1 - job.y0);
+                tile.resize(float_count);
+                render_result_header header;
+                auto start = std::chrono::steady_clock::now();
+                auto deadline = (job_timeout_s > 0)
+                    ? start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(job_timeout_s))
+                    : std::chrono::steady_clock::time_point::max();
+                bool ok = send_all(fd, &job, sizeof(job))
+                       && recv_all_until(fd, &header, sizeof(header), deadline)
+                       && header.id == job.id && header.float_count == float_count
+                       && recv_all_until(fd, tile.data(), float_count * sizeof(float), deadline);
+
+                std::unique_lock<std::mutex> lock(mtx);
+                if (!ok) {
+                    // worker lost or too slow, put the job back at the front so it's retried next; the connection
+                    // is closed on the way out, so whatever the worker still sends is never counted
+                    bool late = std::chrono::steady_clock::now() >= deadline;
+                    std::clog << "\ncoordinator: worker " << (late ? "timed out" : "lost") << ", requeueing job " << job.id << '\n';
+                    pending.push_front(job);
+                    cv.notify_all();
+                    return;
+                }
+
+                int tile_width = job.x1 - job.x0;
+                for (int j = job.y0; j < job.y1; ++j) {
+                    const float* src = tile.data() + 3 * static_cast<size_t>(j - job.y0) * tile_width;
+                    float* dst = framebuffer.data() + 3 * (static_cast<size_t>(j) * image_width + job.x0);
+                    for (int k = 0; k < 3 * tile_width; ++k) {
+                        dst[k] += src[k];
+                    }
+                }
+                --remaining;
+                progress->add(static_cast<uint64_t>(tile_width) * (job.y1 - job.y0) * (job.s1 - job.s0));
+                if (remaining == 0) {
+                    cv.notify_all();
+                }
+            }
+
+            render_job done;
+            std::memset(&done, 0, sizeof(done));
+            done.id = render_job_done;
+            send_all(fd, &done, sizeof(done));
+        }
+};
+
+#endif
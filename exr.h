@@ -0,0 +1,164 @@
+#ifndef EXR_H
+#define EXR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+OpenEXR output
+
+Just enough of the format to write one multi-channel image: a single part, scanline file, one scanline per block,
+no compression, 32 bit float and unsigned int channels. Any EXR reader (compositing packages, oiiotool, Python's
+OpenEXR module) opens it, and channels named "layer.X" show up as layers.
+
+Layout: magic and version, the header (a list of name, type, size, value attributes ending with an empty name),
+a table with the file offset of each scanline block, then the blocks: y, byte count, and the scanline's values one
+channel after the other, channels in the header's (alphabetical) order.
+
+EXR is little endian throughout; values are written in host order, which is fine on the little endian machines
+this renderer runs on.
+*/
+
+struct exr_channel {
+    std::string name;
+    bool is_uint = false;            // unsigned int channel (IDs, counts), float otherwise
+    const float* floats = nullptr;   // width*height values, stride apart
+    const uint32_t* uints = nullptr;
+    size_t stride = 1;               // distance between a pixel's value and the next pixel's, in values
+};
+
+class exr_writer {
+    public:
+        std::vector<exr_channel> channels;
+
+        void add_float(const std::string& name, const float* values, size_t stride = 1) {
+            exr_channel c;
+            c.name = name;
+            c.floats = values;
+            c.stride = stride;
+            channels.push_back(c);
+        }
+
+        void add_uint(const std::string& name, const uint32_t* values, size_t stride = 1) {
+            exr_channel c;
+            c.name = name;
+            c.is_uint = true;
+            c.uints = values;
+            c.stride = stride;
+            channels.push_back(c);
+        }
+
+        bool write(const std::string& path, int width, int height) const {
+            std::vector<exr_channel> sorted = channels;
+            std::sort(sorted.begin(), sorted.end(), [](const exr_channel& a, const exr_channel& b) { return a.name < b.name; });
+
+            std::vector<char> out;
+            put_u32(out, 20000630); // magic
+            put_u32(out, 2);        // version 2, single part scanline
+
+            // header
+            std::vector<char> chlist;
+            for (const auto& c : sorted) {
+                chlist.insert(chlist.end(), c.name.begin(), c.name.end());
+                chlist.push_back('\0');
+                put_u32(chlist, c.is_uint ? 0 : 2); // pixel type: UINT 0, HALF 1, FLOAT 2
+                put_u32(chlist, 0);                 // pLinear and reserved bytes
+                put_u32(chlist, 1);                 // x sampling
+                put_u32(chlist, 1);                 // y sampling
+            }
+            chlist.push_back('\0');
+            attribute(out, "channels", "chlist", chlist);
+
+            std::vector<char> value;
+            value.push_back(0); // NO_COMPRESSION
+            attribute(out, "compression", "compression", value);
+
+            value.clear();
+            put_u32(value, 0);
+            put_u32(value, 0);
+            put_u32(value, static_cast<uint32_t>(width - 1));
+            put_u32(value, static_cast<uint32_t>(height - 1));
+            attribute(out, "dataWindow", "box2i", value);
+            attribute(out, "displayWindow", "box2i", value);
+
+            value.assign(1, 0); // INCREASING_Y
+            attribute(out, "lineOrder", "lineOrder", value);
+
+            value.clear();
+            put_f32(value, 1.0f);
+            attribute(out, "pixelAspectRatio", "float", value);
+
+            value.clear();
+            put_f32(value, 0.0f);
+            put_f32(value, 0.0f);
+            attribute(out, "screenWindowCenter", "v2f", value);
+
+            value.clear();
+            put_f32(value, 1.0f);
+            attribute(out, "screenWindowWidth", "float", value);
+
+            out.push_back('\0'); // end of header
+
+            // offset table, then one block per scanline
+            uint32_t line_bytes = static_cast<uint32_t>(4 * width * sorted.size());
+            uint64_t first_block = out.size() + 8 * static_cast<uint64_t>(height);
+            for (int y = 0; y < height; ++y) {
+                put_u64(out, first_block + static_cast<uint64_t>(y) * (8 + line_bytes));
+            }
+            for (int y = 0; y < height; ++y) {
+                put_u32(out, static_cast<uint32_t>(y));
+                put_u32(out, line_bytes);
+                for (const auto& c : sorted) {
+                    size_t row = static_cast<size_t>(y) * width;
+                    for (int x = 0; x < width; ++x) {
+                        size_t k = (row + x) * c.stride;
+                        if (c.is_uint) {
+                            put_u32(out, c.uints[k]);
+                        }
+                        else {
+                            put_f32(out, c.floats[k]);
+                        }
+                    }
+                }
+            }
+
+            FILE* file = std::fopen(path.c_str(), "wb");
+            if (file == nullptr) {
+                return false;
+            }
+            bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+            return (std::fclose(file) == 0) && ok;
+        }
+
+    private:
+        static void put_u32(std::vector<char>& out, uint32_t v) {
+            char bytes[4];
+            std::memcpy(bytes, &v, 4);
+            out.insert(out.end(), bytes, bytes + 4);
+        }
+
+        static void put_u64(std::vector<char>& out, uint64_t v) {
+            char bytes[8];
+            std::memcpy(bytes, &v, 8);
+            out.insert(out.end(), bytes, bytes + 8);
+        }
+
+        static void put_f32(std::vector<char>& out, float v) {
+            char bytes[4];
+            std::memcpy(bytes, &v, 4);
+            out.insert(out.end(), bytes, bytes + 4);
+        }
+
+        static void attribute(std::vector<char>& out, const char* name, const char* type, const std::vector<char>& value) {
+            out.insert(out.end(), name, name + std::strlen(name) + 1);
+            out.insert(out.end(), type, type + std::strlen(type) + 1);
+            put_u32(out, static_cast<uint32_t>(value.size()));
+            out.insert(out.end(), value.begin(), value.end());
+        }
+};
+
+#endif
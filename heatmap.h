@@ -0,0 +1,62 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+Per pixel cost heatmap
+
+A false color picture of how expensive each pixel was to render, in the same layout as the image, so hot spots
+(dense clusters of small spheres, glass, wide defocus, BVH nodes that overlap badly) show up where they are.
+
+Cost is whatever the camera measured per pixel (see camera::heatmap_metric): nanoseconds spent on its samples, or
+BVH node visits plus primitive tests when ray statistics are compiled in. The counts don't depend on what else the
+machine is doing, the times include shading and everything else.
+
+The scale runs from 0 (dark blue) to the 99th percentile of the pixel costs (dark red) through the Turbo colormap,
+so a handful of outliers can't squash everything else into one color. Pixels above it are clamped.
+*/
+
+// Turbo colormap (Mikhailov 2019), the polynomial approximation; x in [0,1]
+inline color turbo_color(double x) {
+    x = std::min(1.0, std::max(0.0, x));
+    double x2 = x * x, x3 = x2 * x, x4 = x3 * x, x5 = x4 * x;
+    double r = 0.13572138 + 4.61539260*x - 42.66032258*x2 + 132.13108234*x3 - 152.94239396*x4 + 59.28637943*x5;
+    double g = 0.09140261 + 2.19418839*x + 4.84296658*x2 - 14.18503333*x3 + 4.27729857*x4 + 2.82956604*x5;
+    double b = 0.10667330 + 12.64194608*x - 60.58204836*x2 + 110.36276771*x3 - 89.90310912*x4 + 27.34824973*x5;
+    return color(std::min(1.0, std::max(0.0, r)), std::min(1.0, std::max(0.0, g)), std::min(1.0, std::max(0.0, b)));
+}
+
+// cost the top of the scale stands for: the 99th percentile of the pixel costs
+inline double heatmap_scale(const std::vector<float>& cost) {
+    if (cost.empty()) {
+        return 0;
+    }
+    std::vector<float> sorted(cost);
+    size_t k = std::min(sorted.size() - 1, static_cast<size_t>(0.99 * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
+
+// Write a width x height heatmap of cost (1 value per pixel, rows top to bottom) as a plain PPM, colored up to scale
+inline bool write_heatmap(const std::string& path, const std::vector<float>& cost, int width, int height, double scale) {
+    std::ofstream out(path.c_str());
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    size_t pixels = static_cast<size_t>(width) * height;
+    for (size_t p = 0; p < pixels && p < cost.size(); ++p) {
+        color c = turbo_color(scale > 0 ? cost[p] / scale : 0.0);
+        out << static_cast<int>(255.999 * c.x()) << ' '
+            << static_cast<int>(255.999 * c.y()) << ' '
+            << static_cast<int>(255.999 * c.z()) << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define HITTABLE_H
 
 #include "ray.h"
+#include "bvh.h"
 
 class material; // circular reference issue
 
@@ -18,6 +19,13 @@ class hit_record {
         // remembering which side of the surface was hit (normals point against the ray implementation)
         bool front_face;
 
+        // what was hit, for the ID AOVs: 0 when the hittable doesn't say, otherwise an index into the scene plus 1
+        uint32_t object_id = 0;
+        uint32_t material_id = 0;
+
+        // which of the object's primitives was hit: the triangle of a mesh, 0 for objects that are one primitive
+        uint32_t primitive = 0;
+
         void set_face_normal(const ray& r, const vec3& outward_normal) {
             // outward_normal assumed to be unit_length (why is this important ?)
 
@@ -33,6 +41,9 @@ class hittable {
     public:
         virtual ~hittable() = default;
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+        // box around everything the hittable can be hit on, so it can sit inside a BVH of its own
+        virtual bvh_box bounding_box() const = 0;
 };
 
 /* NOTES:
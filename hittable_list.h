@@ -44,6 +44,14 @@ class hittable_list : public hittable {
             // return the hit status
             return hit_anything;
         }
+
+        bvh_box bounding_box() const override {
+            bvh_box box = bvh_box::empty();
+            for (const auto& object : objects) {
+                box.grow(object->bounding_box());
+            }
+            return box;
+        }
 };
 
 /* Notes about shared_ptr:
@@ -0,0 +1,387 @@
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "image_metrics.h"
+#include "json.h"
+#include "lights.h"
+#include "packed_scene.h"
+#include "progress.h"
+#include "sampler.h"
+#include "scene_file.h"
+#include "tile_renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+Statistical image equivalence check
+
+Renders the reference scenes of bench_scenes.h at a modest sample count and compares each image with a converged
+reference stored in the source tree (reference/NAME.pfm), using the metrics of image_metrics.h. Meant to be run
+after any change to sampling, shading, intersection or math that is supposed to leave the picture alone, where
+comparing image bytes says nothing.
+
+A scene fails if
+    - its bias z score, of the whole image or of any of the 4x4 blocks, in any channel, reaches --z-limit (default 5):
+      the render converges to a different picture, not just to different noise
+    - its relative MSE grew by more than --noise-tolerance (default 0.3, 30%) over the baseline recorded with the
+      references, or its SSIM dropped by more than 0.02: the picture got noisier at the same sample count
+The noise checks only apply with the sampler and sample count the baseline was recorded with; --sampler and --spp
+check other ones for bias alone. The width is the references', --width only applies to --update.
+
+The references are rendered with the independent sampler and a sample seed of their own per scene, so they share
+no sample points with what they check, and regenerating them is reproducible. They also leave out light sampling
+and take their light from BSDF samples alone, a different estimator of the same picture: a mistake in light
+sampling or its MIS weights then makes the checked render differ from the reference, rather than being in both.
+
+Usage:
+    image_check [--reference DIR] [--scenes NAME,...] [--sampler NAME] [--spp N] [--threads T] [--z-limit Z]
+                [--noise-tolerance F] [--json FILE] [--images DIR] [--quiet]
+    image_check --update [--reference DIR] [--width W] [--spp N] [--reference-spp N] [--sampler NAME] [--quiet]
+
+    --reference   directory with the references and manifest.json (default: reference)
+    --images      also write every render as DIR/NAME.pfm
+    --quiet       no progress line while a scene renders
+    --update      render new references and record the baseline metrics in DIR/manifest.json; only after a change
+                  that is meant to change the pictures (defaults: --width 64 --spp 64 --reference-spp 2048, sobol)
+Exit status 0 if every scene passes, 1 if any fails, 2 if the check couldn't run.
+*/
+
+struct check_settings {
+    std::string reference_dir = "reference";
+    std::vector<std::string> scenes;
+    int width = 64;
+    int spp = 64;
+    int reference_spp = 2048;
+    bool width_given = false;
+    bool spp_given = false;
+    sampler_type sampling = sampler_sobol;
+    bool sampler_given = false;
+    int threads = 0;
+    double z_limit = 5.0;
+    double noise_tolerance = 0.3;
+    double ssim_tolerance = 0.02;
+    std::string images;
+    progress_options progress;
+};
+
+struct scene_baseline {
+    double rel_mse = 0;
+    double ssim = 0;
+};
+
+// The scene rendered with every sample into image, as per pixel means; without sample_lights, lights are only
+// found by the paths that happen to hit them
+static bool render_scene(const std::string& name, int width, int spp, sampler_type sampling, uint32_t seed, bool sample_lights,
+                         int threads, const progress_options& progress, image_float& image) {
+    scene_description scene;
+    if (!build_bench_scene(name, scene)) {
+        return false;
+    }
+    auto spheres = make_shared<packed_scene>();
+    spheres->adopt(scene);
+    hittable_list world;
+    world.add(spheres);
+    light_list lights;
+    spheres->add_lights(lights);
+
+    camera cam = scene.cam;
+    cam.image_width = width;
+    cam.samples_per_pixel = spp;
+    cam.sampling = sampling;
+    cam.sample_seed = seed;
+    if (sample_lights && !lights.empty()) {
+        cam.lights = &lights;
+    }
+
+    tile_renderer renderer;
+    renderer.threads = threads;
+    std::vector<float> framebuffer;
+    progress_reporter reporter(cam.total_samples(), progress);
+    renderer.render(cam, world, framebuffer, &reporter);
+    reporter.finish();
+
+    image.resize(cam.image_width, cam.get_image_height());
+    for (size_t k = 0; k < framebuffer.size(); ++k) {
+        image.pixels[k] = framebuffer[k] / spp;
+    }
+    return true;
+}
+
+static std::string reference_path(const check_settings& settings, const std::string& name) {
+    return settings.reference_dir + "/" + name + ".pfm";
+}
+
+static std::string manifest_path(const check_settings& settings) {
+    return settings.reference_dir + "/manifest.json";
+}
+
+static uint32_t name_seed(const std::string& name) {
+    uint32_t seed = 0;
+    for (char c : name) {
+        seed = hash_combine(seed, static_cast<unsigned char>(c));
+    }
+    return seed;
+}
+
+static int update_references(check_settings& settings) {
+    if (settings.scenes.empty()) {
+        settings.scenes = bench_scene_names();
+    }
+    image_comparer comparer;
+    std::ostringstream manifest;
+    manifest << "{\n";
+    manifest << "  \"format\": \"image_check\",\n";
+    manifest << "  \"version\": 1,\n";
+    manifest << "  \"width\": " << settings.width << ",\n";
+    manifest << "  \"spp\": " << settings.spp << ",\n";
+    manifest << "  \"reference_spp\": " << settings.reference_spp << ",\n";
+    manifest << "  \"sampler\": " << json_quote(sampler_name(settings.sampling)) << ",\n";
+    manifest << "  \"scenes\": [";
+    for (size_t k = 0; k < settings.scenes.size(); ++k) {
+        const std::string& name = settings.scenes[k];
+        std::cerr << "rendering reference " << name << " at " << settings.reference_spp << " spp\n";
+        image_float reference, render;
+        if (!render_scene(name, settings.width, settings.reference_spp, sampler_independent, name_seed(name), false, settings.threads,
+                          settings.progress, reference)) {
+            std::cerr << "unknown scene '" << name << "'\n";
+            return 2;
+        }
+        if (!write_pfm(reference_path(settings, name), reference)) {
+            std::cerr << "could not write " << reference_path(settings, name) << '\n';
+            return 2;
+        }
+        render_scene(name, settings.width, settings.spp, settings.sampling, 0, true, settings.threads, settings.progress, render);
+        image_comparison c = comparer.compare(render, reference);
+        manifest << (k ? ",\n" : "\n") << "    { \"name\": " << json_quote(name)
+                 << ", \"rel_mse\": " << json_number(c.rel_mse) << ", \"ssim\": " << json_number(c.ssim) << " }";
+    }
+    manifest << "\n  ]\n}\n";
+
+    std::ofstream out(manifest_path(settings).c_str());
+    out << manifest.str();
+    if (!out) {
+        std::cerr << "could not write " << manifest_path(settings) << '\n';
+        return 2;
+    }
+    return 0;
+}
+
+static bool load_manifest(check_settings& settings, std::vector<std::string>& names, std::vector<scene_baseline>& baselines) {
+    std::ifstream in(manifest_path(settings).c_str());
+    std::stringstream text;
+    text << in.rdbuf();
+    json_value manifest;
+    json_parser parser;
+    std::string error;
+    if (!in || !parser.parse(text.str(), manifest, error) || manifest["format"].string_or("") != "image_check") {
+        std::cerr << "could not read " << manifest_path(settings) << (error.empty() ? "" : ": " + error)
+                  << " (image_check --update makes one)\n";
+        return false;
+    }
+    int recorded_width = static_cast<int>(manifest["width"].number_or(settings.width));
+    if (settings.width_given && settings.width != recorded_width) {
+        std::cerr << "the references are " << recorded_width << " pixels wide, --width only applies to --update\n";
+        return false;
+    }
+    settings.width = recorded_width;
+    int recorded_spp = static_cast<int>(manifest["spp"].number_or(settings.spp));
+    if (!settings.spp_given) {
+        settings.spp = recorded_spp;
+    }
+    else if (settings.spp != recorded_spp) {
+        std::cerr << "baseline was recorded at " << recorded_spp << " spp, only checking for bias\n";
+        settings.noise_tolerance = -1;
+    }
+    sampler_type recorded = sampler_sobol;
+    sampler_from_name(manifest["sampler"].string_or("sobol"), recorded);
+    if (!settings.sampler_given) {
+        settings.sampling = recorded;
+    }
+    else if (settings.sampling != recorded) {
+        std::cerr << "baseline was recorded with the " << sampler_name(recorded) << " sampler, only checking for bias\n";
+        settings.noise_tolerance = -1;
+    }
+    for (const json_value& scene : manifest["scenes"].array) {
+        scene_baseline baseline;
+        baseline.rel_mse = scene["rel_mse"].number_or(0);
+        baseline.ssim = scene["ssim"].number_or(0);
+        names.push_back(scene["name"].string_or(""));
+        baselines.push_back(baseline);
+    }
+    return true;
+}
+
+static int check_references(check_settings& settings, const std::string& json_path) {
+    std::vector<std::string> names;
+    std::vector<scene_baseline> baselines;
+    if (!load_manifest(settings, names, baselines)) {
+        return 2;
+    }
+    if (settings.scenes.empty()) {
+        settings.scenes = names;
+    }
+
+    image_comparer comparer;
+    bool all_passed = true;
+    std::ostringstream json;
+    json << "{\n  \"format\": \"image_check\",\n  \"sampler\": " << json_quote(sampler_name(settings.sampling))
+         << ",\n  \"spp\": " << settings.spp << ",\n  \"scenes\": [";
+    std::fprintf(stderr, "%-16s %10s %19s %15s %9s %9s  %s\n", "scene", "rmse", "rel mse (base)", "ssim (base)", "global z", "block z", "result");
+    for (size_t k = 0; k < settings.scenes.size(); ++k) {
+        const std::string& name = settings.scenes[k];
+        auto known = std::find(names.begin(), names.end(), name);
+        if (known == names.end()) {
+            std::cerr << "no reference for scene '" << name << "'\n";
+            return 2;
+        }
+        const scene_baseline& baseline = baselines[known - names.begin()];
+
+        image_float reference, render;
+        if (!read_pfm(reference_path(settings, name), reference)) {
+            std::cerr << "could not read " << reference_path(settings, name) << '\n';
+            return 2;
+        }
+        if (!render_scene(name, settings.width, settings.spp, settings.sampling, 0, true, settings.threads, settings.progress, render)
+            || render.width != reference.width || render.height != reference.height) {
+            std::cerr << "could not render " << name << " at the reference's size\n";
+            return 2;
+        }
+        if (!settings.images.empty() && !write_pfm(settings.images + "/" + name + ".pfm", render)) {
+            std::cerr << "could not write " << settings.images << "/" << name << ".pfm\n";
+        }
+
+        image_comparison c = comparer.compare(render, reference);
+        double global_z = 0;
+        for (int ch = 0; ch < 3; ++ch) {
+            if (std::fabs(c.global_z[ch]) > std::fabs(global_z)) {
+                global_z = c.global_z[ch];
+            }
+        }
+        std::string verdict;
+        if (std::fabs(global_z) >= settings.z_limit) {
+            verdict += " biased";
+        }
+        else if (std::fabs(c.worst_block_z) >= settings.z_limit) {
+            char where[64];
+            std::snprintf(where, sizeof(where), " biased in block %d channel %d", c.worst_block, c.worst_channel);
+            verdict += where;
+        }
+        if (settings.noise_tolerance >= 0) {
+            if (c.rel_mse > baseline.rel_mse * (1 + settings.noise_tolerance)) {
+                verdict += " noisier";
+            }
+            if (c.ssim < baseline.ssim - settings.ssim_tolerance) {
+                verdict += " less similar";
+            }
+        }
+        bool passed = verdict.empty();
+        all_passed = all_passed && passed;
+
+        std::fprintf(stderr, "%-16s %10.5f %9.5f (%7.5f) %6.4f (%6.4f) %9.2f %9.2f  %s\n", name.c_str(), c.rmse,
+                     c.rel_mse, baseline.rel_mse, c.ssim, baseline.ssim, global_z, c.worst_block_z,
+                     passed ? "ok" : ("FAIL:" + verdict).c_str());
+        json << (k ? ",\n" : "\n") << "    { \"name\": " << json_quote(name) << ", \"rmse\": " << json_number(c.rmse)
+             << ", \"rel_mse\": " << json_number(c.rel_mse) << ", \"ssim\": " << json_number(c.ssim)
+             << ", \"global_z\": [" << json_number(c.global_z[0]) << ", " << json_number(c.global_z[1]) << ", " << json_number(c.global_z[2])
+             << "], \"worst_block_z\": " << json_number(c.worst_block_z) << ", \"passed\": " << (passed ? "true" : "false") << " }";
+    }
+    json << "\n  ],\n  \"passed\": " << (all_passed ? "true" : "false") << "\n}\n";
+
+    if (!json_path.empty()) {
+        std::ofstream out(json_path.c_str());
+        out << json.str();
+        if (!out) {
+            std::cerr << "could not write " << json_path << '\n';
+        }
+    }
+    std::cerr << (all_passed ? "all scenes match their references\n" : "some scenes differ from their references\n");
+    return all_passed ? 0 : 1;
+}
+
+static std::vector<std::string> split_names(const std::string& list) {
+    std::vector<std::string> names;
+    std::string::size_type begin = 0;
+    while (begin <= list.size()) {
+        std::string::size_type end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > begin) {
+            names.push_back(list.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return names;
+}
+
+int main(int argc, char* argv[]) {
+    check_settings settings;
+    std::string json_path;
+    bool update = false;
+
+    for (int a = 1; a < argc; ++a) {
+        bool has_value = a + 1 < argc;
+        if (std::strcmp(argv[a], "--reference") == 0 && has_value) {
+            settings.reference_dir = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--scenes") == 0 && has_value) {
+            settings.scenes = split_names(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--width") == 0 && has_value) {
+            settings.width = std::max(8, std::atoi(argv[++a]));
+            settings.width_given = true;
+        }
+        else if (std::strcmp(argv[a], "--spp") == 0 && has_value) {
+            settings.spp = std::max(1, std::atoi(argv[++a]));
+            settings.spp_given = true;
+        }
+        else if (std::strcmp(argv[a], "--reference-spp") == 0 && has_value) {
+            settings.reference_spp = std::max(1, std::atoi(argv[++a]));
+        }
+        else if (std::strcmp(argv[a], "--sampler") == 0 && has_value) {
+            if (!sampler_from_name(argv[++a], settings.sampling)) {
+                std::cerr << "unknown sampler '" << argv[a] << "', expected independent, stratified, sobol or blue_noise\n";
+                return 2;
+            }
+            settings.sampler_given = true;
+        }
+        else if (std::strcmp(argv[a], "--threads") == 0 && has_value) {
+            settings.threads = std::max(0, std::atoi(argv[++a]));
+        }
+        else if (std::strcmp(argv[a], "--z-limit") == 0 && has_value) {
+            settings.z_limit = std::atof(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--noise-tolerance") == 0 && has_value) {
+            settings.noise_tolerance = std::atof(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--json") == 0 && has_value) {
+            json_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--images") == 0 && has_value) {
+            settings.images = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--quiet") == 0) {
+            settings.progress.quiet = true;
+        }
+        else if (std::strcmp(argv[a], "--update") == 0) {
+            update = true;
+        }
+        else {
+            std::cerr << "unknown or incomplete argument: " << argv[a] << '\n';
+            return 2;
+        }
+    }
+
+    return update ? update_references(settings) : check_references(settings, json_path);
+}
@@ -0,0 +1,192 @@
+#ifndef IMAGE_METRICS_H
+#define IMAGE_METRICS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+Comparing noisy renders
+
+Two renders of a scene with different sampling or math never match byte for byte, even when both are right, so
+image_check compares a render against a converged reference with statistics instead:
+
+    RMSE, relative MSE   per pixel error, relative MSE divides each pixel's squared error by its squared
+                         reference value (plus 0.01), so dark and bright areas count alike
+    SSIM                 structural similarity of the tone mapped luminance over 8x8 windows, 1 is identical
+    bias z score         whether the render is systematically brighter or darker than the reference, over the
+                         whole image and over blocks of it, per channel
+
+The bias test relies on the samplers hashing their randomness per pixel, which makes the errors of different pixels
+independent. Under "no bias" every difference d = render - reference has mean zero, so z = sum(d) / sqrt(sum(d^2))
+is approximately standard normal whatever the individual pixels' noise levels are; an |z| of 5 or more happens
+by chance less than once in a million tests. Blue noise sampling correlates neighbouring pixels negatively,
+which only makes the test more conservative.
+
+Images here are linear floats, 3 per pixel, row major from the top, already divided by the sample count.
+*/
+
+struct image_float {
+    int width = 0, height = 0;
+    std::vector<float> pixels; // 3 per pixel
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        pixels.assign(3 * static_cast<size_t>(w) * h, 0.0f);
+    }
+};
+
+// Portable float map, little endian, the usual format for HDR reference images; PFM stores rows bottom up
+inline bool write_pfm(const std::string& path, const image_float& image) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::fprintf(file, "PF\n%d %d\n-1.0\n", image.width, image.height);
+    size_t row = 3 * static_cast<size_t>(image.width);
+    bool ok = true;
+    for (int y = image.height - 1; y >= 0 && ok; --y) {
+        ok = std::fwrite(image.pixels.data() + y * row, sizeof(float), row, file) == row;
+    }
+    return (std::fclose(file) == 0) && ok;
+}
+
+inline bool read_pfm(const std::string& path, image_float& image) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    char magic[3] = {0, 0, 0};
+    int w = 0, h = 0;
+    double scale = 0;
+    bool ok = std::fscanf(file, "%2s %d %d %lf", magic, &w, &h, &scale) == 4 && std::string(magic) == "PF"
+              && w > 0 && h > 0 && scale < 0 && std::fgetc(file) == '\n';
+    if (ok) {
+        image.resize(w, h);
+        size_t row = 3 * static_cast<size_t>(w);
+        for (int y = h - 1; y >= 0 && ok; --y) {
+            ok = std::fread(image.pixels.data() + y * row, sizeof(float), row, file) == row;
+        }
+    }
+    std::fclose(file);
+    return ok;
+}
+
+struct image_comparison {
+    double rmse = 0;
+    double rel_mse = 0;
+    double ssim = 0;
+    double global_z[3] = {0, 0, 0};  // bias z score of the whole image, per channel
+    double worst_block_z = 0;        // largest |z| of any block and channel
+    int worst_block = -1;            // its index, row major over blocks x blocks
+    int worst_channel = 0;
+};
+
+class image_comparer {
+    public:
+        int blocks = 4; // the bias test also runs on blocks x blocks tiles of the image
+
+        image_comparison compare(const image_float& render, const image_float& reference) const {
+            image_comparison result;
+            size_t count = render.pixels.size();
+            double squared = 0, relative = 0;
+            for (size_t k = 0; k < count; ++k) {
+                double d = static_cast<double>(render.pixels[k]) - reference.pixels[k];
+                squared += d * d;
+                relative += d * d / (static_cast<double>(reference.pixels[k]) * reference.pixels[k] + 0.01);
+            }
+            result.rmse = std::sqrt(squared / count);
+            result.rel_mse = relative / count;
+            result.ssim = ssim(render, reference);
+
+            for (int c = 0; c < 3; ++c) {
+                result.global_z[c] = bias_z(render, reference, c, 0, 0, render.width, render.height);
+            }
+            for (int by = 0; by < blocks; ++by) {
+                for (int bx = 0; bx < blocks; ++bx) {
+                    int x0 = bx * render.width / blocks, x1 = (bx + 1) * render.width / blocks;
+                    int y0 = by * render.height / blocks, y1 = (by + 1) * render.height / blocks;
+                    for (int c = 0; c < 3; ++c) {
+                        double z = bias_z(render, reference, c, x0, y0, x1, y1);
+                        if (std::fabs(z) > std::fabs(result.worst_block_z)) {
+                            result.worst_block_z = z;
+                            result.worst_block = by * blocks + bx;
+                            result.worst_channel = c;
+                        }
+                    }
+                }
+            }
+            return result;
+        }
+
+        // sum(d) / sqrt(sum(d^2)) over channel c of the pixels in [x0,x1) x [y0,y1), 0 if they match exactly
+        static double bias_z(const image_float& render, const image_float& reference, int c, int x0, int y0, int x1, int y1) {
+            double sum = 0, squared = 0;
+            for (int y = y0; y < y1; ++y) {
+                for (int x = x0; x < x1; ++x) {
+                    size_t k = 3 * (static_cast<size_t>(y) * render.width + x) + c;
+                    double d = static_cast<double>(render.pixels[k]) - reference.pixels[k];
+                    sum += d;
+                    squared += d * d;
+                }
+            }
+            return (squared > 0) ? sum / std::sqrt(squared) : 0.0;
+        }
+
+        // mean SSIM of the luminance after clamping to [0,1] and gamma 2, over every 8x8 window (Wang et al. 2004)
+        static double ssim(const image_float& a, const image_float& b) {
+            const int window = 8;
+            const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+            std::vector<double> la = luminance(a), lb = luminance(b);
+            int w = a.width, h = a.height;
+            if (w < window || h < window) {
+                return 1.0;
+            }
+            double total = 0;
+            int windows = 0;
+            for (int y0 = 0; y0 + window <= h; ++y0) {
+                for (int x0 = 0; x0 + window <= w; ++x0) {
+                    double ma = 0, mb = 0, vaa = 0, vbb = 0, vab = 0;
+                    for (int y = y0; y < y0 + window; ++y) {
+                        for (int x = x0; x < x0 + window; ++x) {
+                            ma += la[y * w + x];
+                            mb += lb[y * w + x];
+                        }
+                    }
+                    const double n = window * window;
+                    ma /= n;
+                    mb /= n;
+                    for (int y = y0; y < y0 + window; ++y) {
+                        for (int x = x0; x < x0 + window; ++x) {
+                            double da = la[y * w + x] - ma, db = lb[y * w + x] - mb;
+                            vaa += da * da;
+                            vbb += db * db;
+                            vab += da * db;
+                        }
+                    }
+                    vaa /= n - 1;
+                    vbb /= n - 1;
+                    vab /= n - 1;
+                    total += ((2 * ma * mb + c1) * (2 * vab + c2)) / ((ma * ma + mb * mb + c1) * (vaa + vbb + c2));
+                    ++windows;
+                }
+            }
+            return total / windows;
+        }
+
+    private:
+        static std::vector<double> luminance(const image_float& image) {
+            std::vector<double> l(static_cast<size_t>(image.width) * image.height);
+            for (size_t k = 0; k < l.size(); ++k) {
+                const float* p = &image.pixels[3 * k];
+                double y = 0.2126 * p[0] + 0.7152 * p[1] + 0.0722 * p[2];
+                l[k] = std::sqrt(std::min(1.0, std::max(0.0, y)));
+            }
+            return l;
+        }
+};
+
+#endif
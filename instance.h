@@ -0,0 +1,299 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/*
+Geometry instancing
+
+An instance is a reference to a shared, already built piece of geometry (usually a triangle_mesh with its own BVH,
+the "bottom level") plus a transform placing it in the world. A forest of a thousand trees is one tree mesh and a
+thousand instances, so memory grows with the number of distinct meshes, not with the number of copies.
+
+Rays are moved into the object's space instead of moving the geometry: the origin goes through the inverse
+transform as a point and the direction as a vector, without renormalizing it, so the ray parameter t means the
+same thing on both sides and hits can be compared with the rest of the world directly.
+
+The instances themselves sit in a small BVH of their own (instance_bvh, the "top level"). When instances move only
+that top level has to be rebuilt, the meshes' BVHs stay as they are.
+*/
+
+// Affine transform as a 3x4 matrix, row major: the last column is the translation
+class transform {
+    public:
+        double m[3][4];
+
+        transform() {
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 4; ++c) {
+                    m[r][c] = (r == c) ? 1.0 : 0.0;
+                }
+            }
+        }
+
+        bool operator==(const transform& other) const {
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 4; ++c) {
+                    if (m[r][c] != other.m[r][c]) return false;
+                }
+            }
+            return true;
+        }
+
+        bool operator!=(const transform& other) const { return !(*this == other); }
+
+        static transform translate(const vec3& offset) {
+            transform t;
+            for (int r = 0; r < 3; ++r) {
+                t.m[r][3] = offset[r];
+            }
+            return t;
+        }
+
+        static transform scale(const vec3& factors) {
+            transform t;
+            for (int r = 0; r < 3; ++r) {
+                t.m[r][r] = factors[r];
+            }
+            return t;
+        }
+
+        // rotation by degrees around axis 0, 1 or 2 (x, y, z), counter-clockwise looking down the axis
+        static transform rotate(int axis, double degrees) {
+            transform t;
+            double theta = degrees_to_radians(degrees);
+            double cos_theta = std::cos(theta), sin_theta = std::sin(theta);
+            int u = (axis + 1) % 3, v = (axis + 2) % 3;
+            t.m[u][u] = cos_theta;
+            t.m[u][v] = -sin_theta;
+            t.m[v][u] = sin_theta;
+            t.m[v][v] = cos_theta;
+            return t;
+        }
+
+        // the transform that does other first, then this one
+        transform operator*(const transform& other) const {
+            transform t;
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 4; ++c) {
+                    double sum = (c == 3) ? m[r][3] : 0.0;
+                    for (int k = 0; k < 3; ++k) {
+                        sum += m[r][k] * other.m[k][c];
+                    }
+                    t.m[r][c] = sum;
+                }
+            }
+            return t;
+        }
+
+        transform inverse() const {
+            // inverse of the 3x3 part via the adjugate, then the translation follows from it
+            double a = m[0][0], b = m[0][1], c = m[0][2];
+            double d = m[1][0], e = m[1][1], f = m[1][2];
+            double g = m[2][0], h = m[2][1], i = m[2][2];
+            double det = a*(e*i - f*h) - b*(d*i - f*g) + c*(d*h - e*g);
+            double inv_det = (det != 0.0) ? 1.0 / det : 0.0;
+
+            transform t;
+            t.m[0][0] = (e*i - f*h) * inv_det;
+            t.m[0][1] = (c*h - b*i) * inv_det;
+            t.m[0][2] = (b*f - c*e) * inv_det;
+            t.m[1][0] = (f*g - d*i) * inv_det;
+            t.m[1][1] = (a*i - c*g) * inv_det;
+            t.m[1][2] = (c*d - a*f) * inv_det;
+            t.m[2][0] = (d*h - e*g) * inv_det;
+            t.m[2][1] = (b*g - a*h) * inv_det;
+            t.m[2][2] = (a*e - b*d) * inv_det;
+            for (int r = 0; r < 3; ++r) {
+                t.m[r][3] = -(t.m[r][0]*m[0][3] + t.m[r][1]*m[1][3] + t.m[r][2]*m[2][3]);
+            }
+            return t;
+        }
+
+        point3 apply_point(const point3& p) const {
+            return point3(m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+                          m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+                          m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]);
+        }
+
+        vec3 apply_vector(const vec3& v) const {
+            return vec3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                        m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                        m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+        }
+
+        // multiply by the transpose of the 3x3 part, called on the inverse this is how normals go to world space
+        vec3 apply_transposed(const vec3& v) const {
+            return vec3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                        m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                        m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+        }
+
+        // world box around a transformed object box: transform the eight corners and box those
+        bvh_box apply_box(const bvh_box& box) const {
+            if (box.is_empty()) {
+                return box;
+            }
+            point3 lo(infinity, infinity, infinity), hi(-infinity, -infinity, -infinity);
+            for (int corner = 0; corner < 8; ++corner) {
+                point3 p = apply_point(point3((corner & 1) ? box.max[0] : box.min[0],
+                                              (corner & 2) ? box.max[1] : box.min[1],
+                                              (corner & 4) ? box.max[2] : box.min[2]));
+                for (int a = 0; a < 3; ++a) {
+                    lo[a] = fmin(lo[a], p[a]);
+                    hi[a] = fmax(hi[a], p[a]);
+                }
+            }
+            return bvh_box::around(lo, hi);
+        }
+};
+
+class instance : public hittable {
+    public:
+        // IDs reported in hits on this instance, for the ID AOVs (0 leaves what the object reports)
+        uint32_t object_id = 0;
+        uint32_t material_id = 0;
+
+        instance(shared_ptr<hittable> _object, const transform& _to_world, shared_ptr<material> _mat = nullptr)
+          : object(_object), mat(_mat) {
+            set_transform(_to_world);
+        }
+
+        void set_transform(const transform& _to_world) {
+            to_world = _to_world;
+            to_object = _to_world.inverse();
+        }
+
+        const transform& get_transform() const { return to_world; }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            ray object_ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+            if (!object->hit(object_ray, ray_t, rec)) {
+                return false;
+            }
+
+            // t carries over unchanged, the point and normal have to go back to world space
+            rec.point = r.at(rec.t);
+            vec3 outward_normal = unit_vector(to_object.apply_transposed(rec.front_face ? rec.normal : -rec.normal));
+            rec.set_face_normal(r, outward_normal);
+            if (mat) {
+                rec.mat = mat;
+            }
+            if (object_id != 0) {
+                rec.object_id = object_id;
+            }
+            if (material_id != 0) {
+                rec.material_id = material_id;
+            }
+            return true;
+        }
+
+        bvh_box bounding_box() const override {
+            return to_world.apply_box(object->bounding_box());
+        }
+
+    private:
+        shared_ptr<hittable> object;
+        transform to_world;
+        transform to_object;
+        shared_ptr<material> mat; // overrides the object's own material when set
+};
+
+// Top level acceleration structure: a flat BVH over a set of instances
+class instance_bvh : public hittable {
+    public:
+        std::vector<shared_ptr<instance>> instances;
+
+        // update() rebuilds instead of refitting once the tree costs this many times what it did when built
+        float rebuild_threshold = 1.5f;
+
+        void add(shared_ptr<instance> inst) { instances.push_back(inst); }
+
+        size_t size() const { return instances.size(); }
+
+        // Rebuild the top level tree from the instances' current transforms. The objects' own BVHs are left alone.
+        // Call it once after adding instances.
+        void rebuild() {
+            std::vector<bvh_box> bounds = instance_bounds();
+            std::vector<uint32_t> order;
+            bvh_builder builder;
+            builder.build(bounds, nodes, order);
+
+            std::vector<shared_ptr<instance>> sorted(order.size());
+            for (size_t k = 0; k < order.size(); ++k) {
+                sorted[k] = instances[order[k]];
+            }
+            instances.swap(sorted);
+            built_cost = bvh_sah_cost(nodes);
+            built_count = instances.size();
+        }
+
+        // Bring the tree up to date after instances moved (set_transform). Normally that's a refit, one linear
+        // pass over the nodes keeping the topology; if the motion has degraded the tree past rebuild_threshold
+        // it's rebuilt from scratch instead. Returns true if it rebuilt.
+        bool update() {
+            if (instances.size() != built_count) {
+                rebuild(); // instances were added since the last build, the old topology doesn't cover them
+                return true;
+            }
+            bvh_refit(nodes, instance_bounds());
+            if (bvh_sah_cost(nodes) > built_cost * rebuild_threshold) {
+                rebuild();
+                return true;
+            }
+            return false;
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            instance_leaf leaf(instances.data(), r, rec);
+            return bvh_traverse(nodes.data(), nodes.size(), r, ray_t, leaf);
+        }
+
+        bvh_box bounding_box() const override {
+            return nodes.empty() ? bvh_box::empty() : nodes[0].bounds;
+        }
+
+    private:
+        std::vector<bvh_node> nodes;
+        float built_cost = 0;
+        size_t built_count = 0;
+
+        // current world boxes of the instances, in their (leaf) order
+        std::vector<bvh_box> instance_bounds() const {
+            std::vector<bvh_box> bounds(instances.size());
+            for (size_t k = 0; k < instances.size(); ++k) {
+                bounds[k] = instances[k]->bounding_box();
+            }
+            return bounds;
+        }
+
+        class instance_leaf {
+            public:
+                const shared_ptr<instance>* instances;
+                const ray& r;
+                hit_record& rec;
+
+                instance_leaf(const shared_ptr<instance>* _instances, const ray& _r, hit_record& _rec)
+                  : instances(_instances), r(_r), rec(_rec) {}
+
+                bool operator()(uint32_t first, uint32_t count, interval& ray_t) {
+                    bool found = false;
+                    for (uint32_t k = first; k < first + count; ++k) {
+                        if (instances[k]->hit(r, ray_t, rec)) {
+                            ray_t.max = rec.t;
+                            found = true;
+                        }
+                    }
+                    return found;
+                }
+        };
+};
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+Minimal JSON
+
+Enough to write the benchmark results and read them back in for comparing: null, booleans, numbers, strings,
+arrays and objects. Strings are kept as UTF-8 bytes; \uXXXX escapes are only decoded for ASCII, which is all
+the renderer writes. Object keys are kept sorted (std::map), which is fine since nothing here depends on their order.
+*/
+
+class json_value {
+    public:
+        enum kind_type { null_kind, bool_kind, number_kind, string_kind, array_kind, object_kind };
+
+        kind_type kind = null_kind;
+        bool boolean = false;
+        double number = 0;
+        std::string string;
+        std::vector<json_value> array;
+        std::map<std::string, json_value> object;
+
+        bool is_number() const { return kind == number_kind; }
+        bool is_string() const { return kind == string_kind; }
+        bool is_array() const { return kind == array_kind; }
+        bool is_object() const { return kind == object_kind; }
+
+        // member of an object, null if there's no such key (or this isn't an object)
+        const json_value& operator[](const std::string& key) const {
+            auto it = object.find(key);
+            return (it == object.end()) ? null_value() : it->second;
+        }
+
+        double number_or(double fallback) const { return is_number() ? number : fallback; }
+        std::string string_or(const std::string& fallback) const { return is_string() ? string : fallback; }
+
+    private:
+        static const json_value& null_value() {
+            static const json_value none;
+            return none;
+        }
+};
+
+// text as a JSON string literal, quotes included
+inline std::string json_quote(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escape[8];
+                    std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    out += escape;
+                }
+                else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+// a number as JSON; NaN and infinity aren't allowed there, they become null
+inline std::string json_number(double value) {
+    if (!std::isfinite(value)) {
+        return "null";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.10g", value);
+    return text;
+}
+
+class json_parser {
+    public:
+        // Parse text into value; on failure error says where and why
+        bool parse(const std::string& text, json_value& value, std::string& error) {
+            in = text.c_str();
+            start = in;
+            failure.clear();
+            if (!parse_value(value, 0)) {
+                error = failure;
+                return false;
+            }
+            skip_space();
+            if (*in != '\0') {
+                error = message("unexpected text after the value");
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        const char* in = nullptr;
+        const char* start = nullptr;
+        std::string failure;
+
+        std::string message(const char* what) const {
+            return std::string(what) + " at offset " + std::to_string(in - start);
+        }
+
+        bool fail(const char* what) {
+            if (failure.empty()) {
+                failure = message(what);
+            }
+            return false;
+        }
+
+        void skip_space() {
+            while (*in == ' ' || *in == '\t' || *in == '\n' || *in == '\r') {
+                ++in;
+            }
+        }
+
+        bool literal(const char* word) {
+            size_t n = std::strlen(word);
+            if (std::strncmp(in, word, n) != 0) {
+                return fail("unknown literal");
+            }
+            in += n;
+            return true;
+        }
+
+        bool parse_value(json_value& value, int depth) {
+            if (depth > 64) {
+                return fail("nested too deep");
+            }
+            skip_space();
+            switch (*in) {
+                case '{': return parse_object(value, depth);
+                case '[': return parse_array(value, depth);
+                case '"':
+                    value.kind = json_value::string_kind;
+                    return parse_string(value.string);
+                case 't':
+                    value.kind = json_value::bool_kind;
+                    value.boolean = true;
+                    return literal("true");
+                case 'f':
+                    value.kind = json_value::bool_kind;
+                    value.boolean = false;
+                    return literal("false");
+                case 'n':
+                    value.kind = json_value::null_kind;
+                    return literal("null");
+                default:
+                    return parse_number(value);
+            }
+        }
+
+        bool parse_number(json_value& value) {
+            char* end = nullptr;
+            value.number = std::strtod(in, &end);
+            if (end == in) {
+                return fail("expected a value");
+            }
+            value.kind = json_value::number_kind;
+            in = end;
+            return true;
+        }
+
+        bool parse_string(std::string& out) {
+            ++in; // opening quote
+            out.clear();
+            while (*in != '"') {
+                if (*in == '\0') {
+                    return fail("unterminated string");
+                }
+                if (*in != '\\') {
+                    out += *in++;
+                    continue;
+                }
+                ++in;
+                switch (*in) {
+                    case '"':  out += '"'; break;
+                    case '\\': out += '\\'; break;
+                    case '/':  out += '/'; break;
+                    case 'b':  out += '\b'; break;
+                    case 'f':  out += '\f'; break;
+                    case 'n':  out += '\n'; break;
+                    case 'r':  out += '\r'; break;
+                    case 't':  out += '\t'; break;
+                    case 'u': {
+                        unsigned code = 0;
+                        for (int k = 1; k <= 4; ++k) {
+                            char h = in[k];
+                            int digit = (h >= '0' && h <= '9') ? h - '0'
+                                      : (h >= 'a' && h <= 'f') ? h - 'a' + 10
+                                      : (h >= 'A' && h <= 'F') ? h - 'A' + 10 : -1;
+                            if (digit < 0) {
+                                return fail("bad \\u escape");
+                            }
+                            code = code * 16 + digit;
+                        }
+                        out += (code < 0x80) ? static_cast<char>(code) : '?';
+                        in += 4;
+                        break;
+                    }
+                    default:
+                        return fail("bad escape");
+                }
+                ++in;
+            }
+            ++in; // closing quote
+            return true;
+        }
+
+        bool parse_array(json_value& value, int depth) {
+            value.kind = json_value::array_kind;
+            ++in;
+            skip_space();
+            if (*in == ']') {
+                ++in;
+                return true;
+            }
+            while (true) {
+                value.array.push_back(json_value());
+                if (!parse_value(value.array.back(), depth + 1)) {
+                    return false;
+                }
+                skip_space();
+                if (*in == ']') {
+                    ++in;
+                    return true;
+                }
+                if (*in++ != ',') {
+                    return fail("expected , or ] in array");
+                }
+            }
+        }
+
+        bool parse_object(json_value& value, int depth) {
+            value.kind = json_value::object_kind;
+            ++in;
+            skip_space();
+            if (*in == '}') {
+                ++in;
+                return true;
+            }
+            while (true) {
+                skip_space();
+                std::string key;
+                if (*in != '"' || !parse_string(key)) {
+                    return fail("expected a string key in object");
+                }
+                skip_space();
+                if (*in++ != ':') {
+                    return fail("expected : after key");
+                }
+                if (!parse_value(value.object[key], depth + 1)) {
+                    return false;
+                }
+                skip_space();
+                if (*in == '}') {
+                    ++in;
+                    return true;
+                }
+                if (*in++ != ',') {
+                    return fail("expected , or } in object");
+                }
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "hittable.h"
+#include "instance.h"
+#include "material.h"
+#include "onb.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+/*
+Light list for next event estimation
+
+Every emissive primitive in the scene (spheres and mesh triangles with a diffuse_light material) is copied in here
+in world space (see packed_scene::add_lights and add_emissive_mesh), so that at a diffuse bounce the renderer can pick a point on a light directly and check with one
+shadow ray whether it's visible, instead of hoping a randomly bounced ray happens to run into a small light.
+
+Lights are picked with probability proportional to their power (emitted radiance times area), and then:
+    spheres   sample a direction uniformly inside the cone the sphere covers as seen from the shading point
+    triangles sample a point uniformly over the area, converted to a solid angle pdf
+Both hand back the pdf with respect to solid angle at the shading point, which is what the estimator divides by.
+
+A light can also be reached by a ray the material scattered, so the renderer weighs the two ways against each other
+(multiple importance sampling, see camera::ray_color). For that it needs pdf(): how likely light sampling would
+have been to pick the direction of a scattered ray that hit a light. That's why every emissive primitive has to be in
+this list; a light missing from it would have its BSDF sampled hits weighed against a strategy that never ran.
+pdf() finds the light that was hit from the hit's object ID and primitive, through a hash map filled as the lights
+are added, so a hit on a light costs the same however many lights there are.
+*/
+
+struct light_sample {
+    vec3 direction;   // unit vector from the shading point towards the light
+    double distance;  // to the sampled point on the light
+    double pdf;       // solid angle pdf of the direction, including the choice of light
+    color radiance;   // emitted towards the shading point
+};
+
+class light_list {
+    public:
+        bool empty() const { return lights.empty(); }
+        size_t size() const { return lights.size(); }
+
+        // Moving spheres are sampled where they are at the ray's time. object_id is what hits on the sphere report
+        // (hit_record::object_id), for pdf() to find it by; 0 if they don't say
+        void add_sphere(const point3& center, const vec3& velocity, double radius, const color& radiance, uint32_t object_id = 0) {
+            light l;
+            l.kind = sphere_light;
+            l.p0 = center;
+            l.e1 = velocity;
+            l.radius = std::fabs(radius);
+            l.radiance = radiance;
+            l.power = luminance(radiance) * 4 * pi * l.radius * l.radius;
+            add(l, object_id, 0);
+        }
+
+        // emits from the front side, the one the counter-clockwise winding p0 p1 p2 faces; hits on it report
+        // object_id and primitive
+        void add_triangle(const point3& p0, const point3& p1, const point3& p2, const color& radiance,
+                          uint32_t object_id = 0, uint32_t primitive = 0) {
+            light l;
+            l.kind = triangle_light;
+            l.p0 = p0;
+            l.e1 = p1 - p0;
+            l.e2 = p2 - p0;
+            vec3 n = cross(l.e1, l.e2);
+            double double_area = n.length();
+            if (!(double_area > 0)) {
+                return;
+            }
+            l.normal = n / double_area;
+            l.area = 0.5 * double_area;
+            l.radiance = radiance;
+            l.power = luminance(radiance) * l.area;
+            add(l, object_id, primitive);
+        }
+
+        // every triangle of a mesh instance placed with to_world, if mat emits; object_id is the instance's
+        void add_emissive_mesh(const triangle_mesh& mesh, const transform& to_world, const material& mat, uint32_t object_id = 0) {
+            color radiance = front_emission(mat);
+            if (is_black(radiance)) {
+                return;
+            }
+            for (size_t k = 0; k < mesh.triangle_count(); ++k) {
+                point3 p[3];
+                for (int c = 0; c < 3; ++c) {
+                    const mesh_vertex& v = mesh.vertices[mesh.indices[3*k + c]];
+                    p[c] = to_world.apply_point(point3(v.p[0], v.p[1], v.p[2]));
+                }
+                add_triangle(p[0], p[1], p[2], radiance, object_id, static_cast<uint32_t>(k));
+            }
+        }
+
+        // Pick a light and a direction towards it from point at the given time, using the uniform numbers pick (which light)
+        // and su, sv (where on it). False if nothing could be sampled (no lights, or the point is inside the chosen sphere
+        // light, or behind a triangle)
+        bool sample(const point3& point, double time, double pick_u, double su, double sv, light_sample& out) const {
+            if (lights.empty()) {
+                return false;
+            }
+            double u = pick_u * total_power;
+            size_t k = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+            if (k >= lights.size()) {
+                k = lights.size() - 1;
+            }
+            const light& l = lights[k];
+            double pick = l.power / total_power;
+
+            if (l.kind == sphere_light) {
+                return sample_sphere(l, point, time, pick, su, sv, out);
+            }
+            return sample_triangle(l, point, pick, su, sv, out);
+        }
+
+        // Solid angle pdf with which sample() would have picked r's direction from r's origin, given that r hit
+        // the light at hit. 0 if what was hit isn't in the list (it emits but was never added, or didn't say its ID).
+        double pdf(const ray& r, const hit_record& hit) const {
+            auto found = light_index.find(light_key(hit.object_id, hit.primitive));
+            if (found == light_index.end()) {
+                return 0;
+            }
+            const light& l = lights[found->second];
+            double pick = l.power / total_power;
+            double length = r.direction().length();
+            vec3 direction = r.direction() / length;
+            if (l.kind == sphere_light) {
+                vec3 to_center = l.p0 + r.time() * l.e1 - r.origin();
+                double dist2 = to_center.length_squared();
+                double r2 = l.radius * l.radius;
+                if (dist2 <= r2) {
+                    return 0; // inside the light, sample_sphere gives up there
+                }
+                double cos_max = std::sqrt(1 - r2 / dist2);
+                return pick / (2 * pi * (1 - cos_max));
+            }
+            double cos_light = -dot(l.normal, direction);
+            if (cos_light <= 0) {
+                return 0;
+            }
+            double distance = hit.t * length;
+            return pick * distance * distance / (l.area * cos_light);
+        }
+
+        // what a material gives off from the front of a surface, black if it isn't a light
+        static color front_emission(const material& mat) {
+            hit_record front;
+            front.front_face = true;
+            return mat.emitted(front);
+        }
+
+        static bool is_black(const color& c) {
+            return c.x() <= 0 && c.y() <= 0 && c.z() <= 0;
+        }
+
+    private:
+        enum light_kind { sphere_light, triangle_light };
+
+        struct light {
+            light_kind kind;
+            point3 p0;       // sphere: center at time 0; triangle: first vertex
+            vec3 e1, e2;     // sphere: velocity in e1; triangle: edges
+            vec3 normal;     // triangle only
+            double radius = 0;
+            double area = 0;
+            double power = 0;
+            color radiance;
+        };
+
+        std::vector<light> lights;
+        std::vector<double> cdf; // running sum of power, for picking
+        double total_power = 0;
+        std::unordered_map<uint64_t, uint32_t> light_index; // light_key(object ID, primitive) -> index in lights
+
+        static uint64_t light_key(uint32_t object_id, uint32_t primitive) {
+            return (static_cast<uint64_t>(object_id) << 32) | primitive;
+        }
+
+        void add(const light& l, uint32_t object_id, uint32_t primitive) {
+            if (!(l.power > 0)) {
+                return;
+            }
+            if (object_id != 0) {
+                light_index[light_key(object_id, primitive)] = static_cast<uint32_t>(lights.size());
+            }
+            lights.push_back(l);
+            total_power += l.power;
+            cdf.push_back(total_power);
+        }
+
+        static double luminance(const color& c) {
+            return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+        }
+
+        static bool sample_sphere(const light& l, const point3& point, double time, double pick, double su, double sv, light_sample& out) {
+            point3 center = l.p0 + time * l.e1;
+            vec3 to_center = center - point;
+            double dist2 = to_center.length_squared();
+            double r2 = l.radius * l.radius;
+            if (dist2 <= r2) {
+                return false;
+            }
+
+            // uniform direction in the cone around to_center that just grazes the sphere
+            double cos_max = std::sqrt(1 - r2 / dist2);
+            double cos_theta = 1 + su * (cos_max - 1);
+            double sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta*cos_theta));
+            double phi = 2 * pi * sv;
+
+            onb frame(to_center);
+            out.direction = unit_vector(frame.local(std::cos(phi)*sin_theta, std::sin(phi)*sin_theta, cos_theta));
+
+            // distance to the near side of the sphere along that direction
+            double half_b = dot(-to_center, out.direction);
+            double c = dist2 - r2;
+            double disc = half_b*half_b - c;
+            out.distance = -half_b - std::sqrt(std::fmax(0.0, disc));
+
+            out.pdf = pick / (2 * pi * (1 - cos_max));
+            out.radiance = l.radiance;
+            return out.pdf > 0 && out.distance > 0;
+        }
+
+        static bool sample_triangle(const light& l, const point3& point, double pick, double su, double sv, light_sample& out) {
+            // uniform point on the triangle by folding the unit square onto it
+            double s = su, t = sv;
+            if (s + t > 1) {
+                s = 1 - s;
+                t = 1 - t;
+            }
+            point3 on_light = l.p0 + s * l.e1 + t * l.e2;
+            vec3 to_light = on_light - point;
+            double dist2 = to_light.length_squared();
+            if (!(dist2 > 0)) {
+                return false;
+            }
+            out.distance = std::sqrt(dist2);
+            out.direction = to_light / out.distance;
+            double cos_light = -dot(l.normal, out.direction);
+            if (cos_light <= 0) {
+                return false; // looking at the back, which doesn't emit
+            }
+            out.pdf = pick * dist2 / (l.area * cos_light);
+            out.radiance = l.radiance;
+            return true;
+        }
+};
+
+#endif
@@ -1,16 +1,31 @@
 #include "rtweekend.h"
 
+#include "bvh_cache.h"
 #include "color.h"
+#include "cpu_dispatch.h"
 #include "hittable_list.h"
+#include "instance.h"
+#include "packed_scene.h"
+#include "perf_counters.h"
+#include "ray_stats.h"
 #include "sphere.h"
 #include "material.h"
+#include "mesh_loader.h"
 #include "camera.h"
+#include "distributed.h"
+#include "scene_file.h"
+#include "sequence.h"
+#include "trace.h"
 
-int main() {
-    hittable_list world;
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <unordered_map>
 
-    auto material_ground = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3( 0.0, -1000, 0.0), 1000, material_ground));
+// build the demo scene; deterministic, so coordinator and workers all end up with the same world
+void build_scene(scene_description& scene) {
+    auto material_ground = scene.add_lambertian(color(0.5, 0.5, 0.5));
+    scene.add_sphere(point3( 0.0, -1000, 0.0), 1000, material_ground);
 
     // generate some random spheres
     for (int x = -5; x < 5; x++) {
@@ -21,43 +36,42 @@ int main() {
 
             // if we are outside of our silly big example balls aligned along x=4
             if ((center - point3(4, 1, 0)).length() > 1) {
-                shared_ptr<material> sphere_material;
+                uint32_t sphere_material;
 
                 // 75% chance for lambertian
                 if (choose_material < 0.75) {
                     auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = scene.add_lambertian(albedo);
+                    scene.add_sphere(center, 0.2, sphere_material);
                 }
                 // 20% chance for metal
                 else if (choose_material < 0.95) {
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = scene.add_metal(albedo, fuzz);
+                    scene.add_sphere(center, 0.2, sphere_material);
                 }
                 // 5% chance of dielectric surface
                 else {
-                    sphere_material = make_shared<dielectric>(1.2);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = scene.add_dielectric(1.2);
+                    scene.add_sphere(center, 0.2, sphere_material);
                 }
             }
         }
     }
 
     // make big balls
-    auto material1 = make_shared<lambertian>(color(0.7, 0.3, 0.2));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<metal>(color(0.4, 0.7, 0.1), 0.0);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material2));
+    auto material1 = scene.add_lambertian(color(0.7, 0.3, 0.2));
+    scene.add_sphere(point3(-4, 1, 0), 1.0, material1);
 
-    auto material3 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material2 = scene.add_metal(color(0.4, 0.7, 0.1), 0.0);
+    scene.add_sphere(point3(0, 1, 0), 1.0, material2);
 
-    // Render the World //
-    camera cam;
+    auto material3 = scene.add_dielectric(1.5);
+    scene.add_sphere(point3(4, 1, 0), 1.0, material3);
 
+    // Set up the camera //
+    camera& cam = scene.cam;
     cam.aspect_ratio      = 16.0 / 9.0;
     cam.image_width       = 1200;
     cam.samples_per_pixel = 100;
@@ -70,6 +84,357 @@ int main() {
 
     cam.defocus_angle = 1.0;
     cam.focus_dist    = 10.0;
+}
+
+/*
+Usage:
+    inOneWeekend > image.ppm                                   render locally
+    inOneWeekend --coordinator PORT [--spawn N] [--tile SIZE] [--sample-splits K] [--job-timeout S] > image.ppm
+    inOneWeekend --worker HOST:PORT                             render jobs for a coordinator
+
+    --scene FILE        render a text or binary scene file instead of the built-in scene
+    --save-scene FILE   write the scene out (binary if FILE ends in .rtsb, text otherwise) and exit
+    --no-bvh-cache      always rebuild the BVH of a scene file instead of reusing FILE.bvhcache
+    --sampler NAME      independent, stratified, sobol or blue_noise, overrides the scene's choice
+    --denoise           filter the noise out of the finished image, guided by first hit depth, normal and albedo
+    --aov FILE          also write the color, depth, normal, albedo, material and object IDs and sample count to FILE (OpenEXR)
+    --heatmap FILE      also write a false color PPM of how expensive each pixel was to render
+    --heatmap-metric M  time (nanoseconds, the default) or work (BVH node visits plus primitive tests)
+    --trace FILE        record a timeline of scene loading, BVH builds, rendering (one row of the image at a
+                        time, on this one thread) and output, in Chrome's trace event format (open it in
+                        chrome://tracing or ui.perfetto.dev); render_bench --trace shows every tile per thread
+    --quiet             no progress line while rendering
+    --progress-json F   write progress (fraction done, samples/s, ETA) as one JSON object per line to F, '-' for stderr
+    --perf-counters     report CPU cycles, instructions, cache and branch misses for scene building and rendering,
+                        per ray for the render (Linux perf events; skipped with a note if the system refuses them)
+    --job-timeout S     coordinator: seconds a worker may take over one job before it goes to another worker
+                        (default 600, 0 for no limit)
+*/
+int main(int argc, char* argv[]) {
+    std::string scene_path;
+    std::string save_path;
+    bool use_bvh_cache = true;
+    int coordinator_port = 0;
+    int spawn = 0;
+    int tile_size = 32;
+    int sample_splits = 1;
+    double job_timeout = 600;
+    std::string worker_address;
+    std::string sequence_path;
+    bool light_sampling = true;
+    std::string output_pattern;
+    std::string sampler_choice;
+    bool denoise = false;
+    std::string aov_path;
+    std::string heatmap_path;
+    pixel_cost_metric heatmap_metric = cost_time;
+    std::string trace_path;
+    bool use_perf_counters = false;
+    progress_options progress;
+
+    for (int a = 1; a < argc; ++a) {
+        bool has_value = a + 1 < argc;
+        if (std::strcmp(argv[a], "--coordinator") == 0 && has_value) {
+            coordinator_port = std::atoi(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--spawn") == 0 && has_value) {
+            spawn = std::atoi(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--tile") == 0 && has_value) {
+            tile_size = std::atoi(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--sample-splits") == 0 && has_value) {
+            sample_splits = std::atoi(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--job-timeout") == 0 && has_value) {
+            job_timeout = std::atof(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--worker") == 0 && has_value) {
+            worker_address = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--scene") == 0 && has_value) {
+            scene_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--save-scene") == 0 && has_value) {
+            save_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--sequence") == 0 && has_value) {
+            sequence_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--output") == 0 && has_value) {
+            output_pattern = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--no-light-sampling") == 0) {
+            light_sampling = false;
+        }
+        else if (std::strcmp(argv[a], "--sampler") == 0 && has_value) {
+            sampler_choice = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--aov") == 0 && has_value) {
+            aov_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--trace") == 0 && has_value) {
+            trace_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--heatmap") == 0 && has_value) {
+            heatmap_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--heatmap-metric") == 0 && has_value) {
+            std::string metric = argv[++a];
+            if (metric == "work" && ray_stats::enabled()) {
+                heatmap_metric = cost_work;
+            }
+            else if (metric != "time") {
+                std::cerr << "--heatmap-metric expects time" << (ray_stats::enabled() ? " or work" : " (work needs RAY_STATS)") << '\n';
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[a], "--quiet") == 0) {
+            progress.quiet = true;
+        }
+        else if (std::strcmp(argv[a], "--progress-json") == 0 && has_value) {
+            progress.json_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--perf-counters") == 0) {
+            use_perf_counters = true;
+        }
+        else if (std::strcmp(argv[a], "--denoise") == 0) {
+            denoise = true;
+        }
+        else if (std::strcmp(argv[a], "--no-bvh-cache") == 0) {
+            use_bvh_cache = false;
+        }
+        else {
+            std::cerr << "unknown or incomplete argument: " << argv[a] << '\n';
+            return 1;
+        }
+    }
+    if (!output_pattern.empty() && !valid_frame_pattern(output_pattern)) {
+        std::cerr << "--output needs exactly one %d for the frame number (like frame_%04d.ppm), and any other % as %%\n";
+        return 1;
+    }
+    // these write a second image next to the one render, which sequences and distributed renders don't have
+    if (!sequence_path.empty() && (!aov_path.empty() || !heatmap_path.empty())) {
+        std::cerr << "--aov and --heatmap don't work with --sequence\n";
+        return 1;
+    }
+    if (coordinator_port > 0 && (!aov_path.empty() || !heatmap_path.empty() || denoise)) {
+        std::cerr << "--aov, --heatmap and --denoise don't work with --coordinator\n";
+        return 1;
+    }
+
+    if (!trace_path.empty()) {
+        trace_recorder::get().start();
+    }
+
+    perf_counters perf;
+    if (use_perf_counters) {
+        std::string error;
+        if (!perf.open(error)) {
+            std::clog << "Hardware counters unavailable, " << error << '\n';
+        }
+    }
+    perf_sample scene_begin = perf.read();
+
+    // Load the World //
+    scene_description scene;
+    auto spheres = make_shared<packed_scene>();
+    bool mapped = false;
+    auto start = std::chrono::steady_clock::now();
+    if (scene_path.empty()) {
+        TRACE_SCOPE("build scene", "scene");
+        build_scene(scene);
+    }
+    else if (save_path.empty() && packed_scene::is_mappable(scene_path)) {
+        // binary scene with a prebuilt BVH, trace it straight out of the file
+        TRACE_SCOPE("map scene", "scene");
+        std::string error;
+        if (!spheres->map(scene_path, scene, error)) {
+            std::cerr << error << '\n';
+            return 1;
+        }
+        mapped = true;
+    }
+    else {
+        std::string error;
+        {
+            TRACE_SCOPE("load scene", "scene");
+            if (!load_scene(scene_path, scene, error)) {
+                std::cerr << error << '\n';
+                return 1;
+            }
+        }
+
+        if (use_bvh_cache && scene.nodes.empty()) {
+            auto bvh_start = std::chrono::steady_clock::now();
+            TRACE_SCOPE("build bvh", "bvh");
+            bool reused = build_scene_bvh_cached(scene_path, scene);
+            std::chrono::duration<double, std::milli> bvh_time = std::chrono::steady_clock::now() - bvh_start;
+            std::clog << (reused ? "Reused cached BVH in " : "Built and cached BVH in ") << bvh_time.count() << " ms\n";
+        }
+    }
+
+    if (!sampler_choice.empty() && !sampler_from_name(sampler_choice, scene.cam.sampling)) {
+        std::cerr << "unknown sampler '" << sampler_choice << "', expected independent, stratified, sobol or blue_noise\n";
+        return 1;
+    }
+
+    if (!save_path.empty()) {
+        bool binary = save_path.size() > 5 && save_path.compare(save_path.size() - 5, 5, ".rtsb") == 0;
+        if (binary && scene.nodes.empty()) {
+            build_scene_bvh(scene);
+        }
+        if (!(binary ? save_scene_binary(save_path, scene) : save_scene_text(save_path, scene))) {
+            std::cerr << "could not write " << save_path << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!mapped) {
+        TRACE_SCOPE("adopt scene", "bvh");
+        spheres->adopt(scene);
+    }
+    camera& cam = scene.cam;
+    cam.denoise = denoise;
+    cam.aov_path = aov_path;
+    cam.heatmap_path = heatmap_path;
+    cam.heatmap_metric = heatmap_metric;
+    cam.progress = progress;
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::clog << (mapped ? "Mapped " : "Loaded ") << spheres->size() << " spheres in " << elapsed.count() << " ms\n";
+
+    hittable_list world;
+    world.add(spheres);
+
+    // everything emissive goes in the light list for explicit sampling
+    light_list lights;
+    spheres->add_lights(lights);
+
+    // every mesh line is an instance, the file behind it is loaded (and its BVH built) once however often it's used
+    auto instances = make_shared<instance_bvh>();
+    std::vector<shared_ptr<instance>> mesh_instances; // in scene order, for sequences that move them
+    std::vector<bool> emissive_instances;
+    std::unordered_map<std::string, shared_ptr<triangle_mesh>> loaded_meshes;
+    const auto& mats = spheres->materials();
+    for (const auto& m : scene.meshes) {
+        shared_ptr<triangle_mesh>& mesh = loaded_meshes[m.path];
+        if (!mesh) {
+            auto mesh_start = std::chrono::steady_clock::now();
+            TRACE_SCOPE("load mesh", "bvh");
+            mesh = make_shared<triangle_mesh>();
+            std::string error;
+            if (!load_mesh(m.path, *mesh, error)) {
+                std::cerr << error << '\n';
+                return 1;
+            }
+
+            std::chrono::duration<double, std::milli> mesh_time = std::chrono::steady_clock::now() - mesh_start;
+            double millions = mesh->triangle_count() / 1e6;
+            std::clog << "Loaded " << m.path << ": " << mesh->triangle_count() << " triangles, "
+                      << (mesh->triangle_count() ? double(mesh->memory_bytes()) / mesh->triangle_count() : 0.0) << " bytes/triangle, "
+                      << mesh_time.count() << " ms (" << (millions > 0 ? mesh_time.count() / millions : 0.0) << " ms per million)\n";
+        }
+        auto mat = (m.material < mats.size()) ? mats[m.material] : make_shared<lambertian>(color(0.5, 0.5, 0.5));
+        auto inst = make_shared<instance>(mesh, m.get_transform(), mat);
+        // IDs continue after the spheres' (sphere index + 1)
+        inst->object_id = static_cast<uint32_t>(spheres->size() + instances->size() + 1);
+        inst->material_id = (m.material < mats.size()) ? m.material + 1 : 0;
+        instances->add(inst);
+        mesh_instances.push_back(inst);
+        size_t light_count = lights.size();
+        lights.add_emissive_mesh(*mesh, m.get_transform(), *mat, inst->object_id);
+        emissive_instances.push_back(lights.size() != light_count);
+    }
+    if (instances->size() > 0) {
+        {
+            TRACE_SCOPE("build instance bvh", "bvh");
+            instances->rebuild();
+        }
+        world.add(instances);
+        std::clog << instances->size() << " mesh instances of " << loaded_meshes.size() << " meshes\n";
+    }
+    if (light_sampling && !lights.empty()) {
+        cam.lights = &lights;
+        std::clog << lights.size() << " lights\n";
+    }
+
+    // Render the World //
+    perf_sample render_begin = perf.read();
+    perf.print(std::clog, "scene build", scene_begin, render_begin);
+    auto render_start = std::chrono::steady_clock::now();
+    auto write_trace = [&]() {
+        if (!trace_path.empty() && !trace_recorder::get().write(trace_path)) {
+            std::cerr << "could not write " << trace_path << '\n';
+        }
+    };
+    auto print_stats = [&]() {
+        std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - render_start;
+        ray_counters counted = ray_stats::total();
+        ray_stats::print(std::clog, counted, render_time.count());
+        std::clog << "Kernels: " << cpu_isa_name(selected_cpu_isa()) << '\n';
+        perf.print(std::clog, "render", render_begin, perf.read(), counted.rays());
+        write_trace();
+    };
+
+    if (!worker_address.empty()) {
+        auto colon = worker_address.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "--worker expects HOST:PORT\n";
+            return 1;
+        }
+        render_worker worker(cam, world);
+        int jobs = worker.run(worker_address.substr(0, colon), std::atoi(worker_address.c_str() + colon + 1));
+        print_stats();
+        return (jobs < 0) ? 1 : 0;
+    }
+
+    if (!sequence_path.empty()) {
+        camera_path path;
+        std::string error;
+        if (!path.load(sequence_path, cam, error)) {
+            std::cerr << error << '\n';
+            return 1;
+        }
+        int moved = path.last_moved_object();
+        if (moved >= static_cast<int>(mesh_instances.size())) {
+            std::cerr << sequence_path << ": moves mesh " << moved << " but the scene has " << mesh_instances.size() << " meshes\n";
+            return 1;
+        }
+        for (const auto& key : path.keys) {
+            for (const auto& move : key.moves) {
+                if (emissive_instances[move.first]) {
+                    std::cerr << sequence_path << ": mesh " << move.first << " gives off light, light sources can't move\n";
+                    return 1;
+                }
+            }
+        }
+        sequence_renderer sequence(cam, world, path);
+        sequence.movable = mesh_instances;
+        sequence.instances = instances.get();
+        if (!output_pattern.empty()) {
+            sequence.output_pattern = output_pattern;
+        }
+        int frames = sequence.render();
+        print_stats();
+        return (frames < 0) ? 1 : 0;
+    }
+
+    if (coordinator_port > 0) {
+        render_coordinator coordinator(cam, world);
+        coordinator.tile_size = (tile_size > 0) ? tile_size : 32;
+        coordinator.sample_splits = sample_splits;
+        coordinator.job_timeout_s = job_timeout;
+        if (!coordinator.listen_on(coordinator_port)) {
+            std::cerr << "could not listen on port " << coordinator_port << '\n';
+            return 1;
+        }
+        coordinator.spawn_local_workers(spawn);
+        bool rendered = coordinator.render(std::cout);
+        write_trace();
+        return rendered ? 0 : 1;
+    }
 
     cam.render(world);
+    print_stats();
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include "rtweekend.h"
 
+#include "onb.h"
+
 class hit_record; // circular reference issue
 
 /*
@@ -22,6 +24,14 @@ For this program, a material only does two things...
     1. Produce a scattered ray (or is it absorbed?)
     2. If scattered, say how much it should be attenuated
 
+and light sources additionally emit light of their own (see diffuse_light).
+
+The scattered ray is made from two uniform numbers handed in (sample), so the renderer's sampler decides them
+(see sampler.h). Materials with a real BSDF, not just a mirror-like rule, also say what they do for any given
+direction: eval gives BSDF times cosine and pdf the density sample() picks that direction with. That's what lets
+the renderer aim rays at lights itself and still know how to weigh them against the material's own choice.
+Mirrors and glass scatter into single directions that no density can describe; they return 0 from both.
+
 */
 
 // Abstract material, represent all material types as children
@@ -29,28 +39,68 @@ class material {
     public:
         virtual ~material() = default;
 
-        virtual bool scatter(const ray& r_in, const hit_record& hit, color& attenuation, ray& scattered) const = 0;
+        // Scatter r_in from the two uniform numbers u, v in [0,1). attenuation is what the light coming back along
+        // scattered gets multiplied by (for materials with a BSDF, eval / pdf of the chosen direction)
+        virtual bool sample(const ray& r_in, const hit_record& hit, double u, double v, color& attenuation, ray& scattered) const = 0;
+
+        // true if eval and pdf describe the material, so other sampling strategies (light sampling) can be used on it
+        virtual bool has_bsdf() const {
+            return false;
+        }
+
+        // BSDF times the cosine to the normal, for light leaving towards direction (unit, pointing away from the surface)
+        virtual color eval(const ray& r_in, const hit_record& hit, const vec3& direction) const {
+            return color(0, 0, 0);
+        }
+
+        // solid angle density with which sample() picks direction
+        virtual double pdf(const ray& r_in, const hit_record& hit, const vec3& direction) const {
+            return 0;
+        }
+
+        // base color of the surface without any lighting, for the albedo AOV (see aov.h)
+        virtual color albedo_at(const hit_record& hit) const {
+            return color(1, 1, 1);
+        }
+
+        // light given off at the hit point, black for anything that isn't a light source
+        virtual color emitted(const hit_record& hit) const {
+            return color(0, 0, 0);
+        }
 };
 
 
 // Lambertian (diffuse) material --> incident ray is scattered in many directions and attenuates by a ratio of R
+// BRDF albedo/pi; directions are picked with density cos/pi, which cancels everything but the albedo
 class lambertian : public material {
     public:
         lambertian(const color& a) : albedo(a) {}
 
-        bool scatter(const ray& r_in, const hit_record& hit, color& attenuation, ray& scattered) const override {
-            auto scatter_direction = hit.normal + random_unit_vector();
-
-            // catch a magnitude zero reflection vector and just reassign it as our hit_record's normal
-            if (scatter_direction.near_zero()) {
-                scatter_direction = hit.normal;
-            }
-
-            scattered = ray(hit.point, scatter_direction);
+        bool sample(const ray& r_in, const hit_record& hit, double u, double v, color& attenuation, ray& scattered) const override {
+            onb frame(hit.normal);
+            scattered = ray(hit.point, frame.local(cosine_direction(u, v)), r_in.time());
             attenuation = albedo;
             return true;
         }
 
+        bool has_bsdf() const override {
+            return true;
+        }
+
+        color eval(const ray& r_in, const hit_record& hit, const vec3& direction) const override {
+            double cosine = dot(hit.normal, direction);
+            return (cosine > 0) ? albedo * (cosine / pi) : color(0, 0, 0);
+        }
+
+        double pdf(const ray& r_in, const hit_record& hit, const vec3& direction) const override {
+            double cosine = dot(hit.normal, direction);
+            return (cosine > 0) ? cosine / pi : 0;
+        }
+
+        color albedo_at(const hit_record& hit) const override {
+            return albedo;
+        }
+
     private:
         color albedo;
 };
@@ -60,18 +110,59 @@ class metal : public material {
     public:
         metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-        bool scatter(const ray& r_in, const hit_record& hit, color& attenuation, ray& scattered) const override {
+        bool sample(const ray& r_in, const hit_record& hit, double u, double v, color& attenuation, ray& scattered) const override {
             // scatter direction == v + 2b..... how to find b? --> -(v*n)*n ... since n is a unit vector projection of -v onto n formula
             // reflect formula = v - 2*dot(v,n)*n;
             // https://immersivemath.com/ila/ch03_dotproduct/ch03.html at 3.1
             // https://raytracing.github.io/images/fig-1.15-reflection.jpg (note that v points inwards, so we reflect it out)
             vec3 reflection = reflect(unit_vector(r_in.direction()), hit.normal);
-            scattered = ray(hit.point, reflection + fuzz*random_unit_vector());
+            scattered = ray(hit.point, reflection + fuzz*sphere_direction(u, v), r_in.time());
             attenuation = albedo;
             // if the normal between our fuzzed vector and surface normal is < 0, the surface just absorbs it
             return (dot(scattered.direction(), hit.normal) > 0);
         }
 
+        // a perfect mirror (fuzz 0) reflects into one single direction, nothing a pdf can describe
+        bool has_bsdf() const override {
+            return fuzz != 0;
+        }
+
+        // sample() weights every direction it makes by the albedo, so BSDF times cosine is albedo times the pdf
+        color eval(const ray& r_in, const hit_record& hit, const vec3& direction) const override {
+            if (dot(direction, hit.normal) <= 0) {
+                return color(0, 0, 0);
+            }
+            return albedo * pdf(r_in, hit, direction);
+        }
+
+        /*
+            The fuzzed direction is the direction towards a uniform point on a sphere of radius fuzz around the tip of the
+            unit reflection vector R. A ray along direction crosses that sphere at distances t with
+                t^2 - 2bt + 1 - fuzz^2 = 0, b = dot(direction, R)
+            and each crossing contributes area density 1/(4 pi fuzz^2) times t^2 / cos, the cosine between the ray and
+            the sphere's normal there being sqrt(disc)/fuzz. Summed over both roots:
+                pdf = (2b^2 - 1 + fuzz^2) / (2 pi fuzz sqrt(disc)), disc = b^2 - 1 + fuzz^2
+            (which is b/pi for fuzz 1, where one root is 0). Directions that end up below the surface are absorbed,
+            they still count here since sample() does pick them.
+        */
+        double pdf(const ray& r_in, const hit_record& hit, const vec3& direction) const override {
+            double f = std::fabs(fuzz);
+            if (f == 0) {
+                return 0;
+            }
+            vec3 reflection = reflect(unit_vector(r_in.direction()), hit.normal);
+            double b = dot(direction, reflection);
+            double disc = b*b - 1 + f*f;
+            if (b <= 0 || disc <= 0) {
+                return 0;
+            }
+            return (2*b*b - 1 + f*f) / (2 * pi * f * std::sqrt(disc));
+        }
+
+        color albedo_at(const hit_record& hit) const override {
+            return albedo;
+        }
+
     private:
         color albedo;
         double fuzz;
@@ -99,7 +190,7 @@ class dielectric : public material {
     public:
         dielectric(double index_of_refraction) : ir(index_of_refraction) {}
         
-        bool scatter(const ray& r_in, const hit_record& hit, color& attenuation, ray& scattered) const override {
+        bool sample(const ray& r_in, const hit_record& hit, double u, double v, color& attenuation, ray& scattered) const override {
             attenuation = color(1.0, 1.0, 1.0); // always 1, since the surface absorbs nothing
             double refraction_ratio = hit.front_face ? (1.0/ir) : ir;
 
@@ -110,14 +201,14 @@ class dielectric : public material {
             bool cannot_refract = refraction_ratio * sin_theta > 1.0;
             vec3 direction;
             // inside of the dielectric object or angle of view mirror approximation holds
-            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double()) {
+            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > u) {
                 // reflect instead
                 direction = reflect(unit_direction, hit.normal);
             }
             else {
                 direction = refract(unit_direction, hit.normal, refraction_ratio);
             }
-            scattered = ray(hit.point, direction);
+            scattered = ray(hit.point, direction, r_in.time());
             return true;
         }
 
@@ -132,4 +223,23 @@ class dielectric : public material {
         }
 };
 
+
+// Light source, emits the same radiance in every direction from the front side of its surface and scatters nothing.
+// Values above 1 are fine and usual, a small light has to be bright to light up a room.
+class diffuse_light : public material {
+    public:
+        diffuse_light(const color& _emit) : emit(_emit) {}
+
+        bool sample(const ray& r_in, const hit_record& hit, double u, double v, color& attenuation, ray& scattered) const override {
+            return false;
+        }
+
+        color emitted(const hit_record& hit) const override {
+            return hit.front_face ? emit : color(0, 0, 0);
+        }
+
+    private:
+        color emit;
+};
+
 #endif
\ No newline at end of file
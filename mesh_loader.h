@@ -0,0 +1,485 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "rtweekend.h"
+
+#include "text_parsing.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+OBJ and PLY loaders for triangle_mesh
+
+OBJ is plain text with one statement per line, so the file is read into memory, cut into one chunk per hardware
+thread at line boundaries, and every chunk is parsed on its own thread into local vertex/face arrays that get
+stitched together at the end. Only "v" and "f" lines are used (positions and faces, polygons get fan triangulated),
+everything else (normals, texture coordinates, groups, materials) is skipped.
+
+PLY is parsed sequentially: its faces are variable length records, so there's no way to find a record
+boundary in the middle of a binary file. ascii, binary_little_endian and binary_big_endian are all supported,
+with a "vertex" element holding x/y/z and a "face" element holding a vertex index list.
+*/
+
+inline bool read_whole_file(const std::string& path, std::vector<char>& data) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    data.resize(size > 0 ? static_cast<size_t>(size) : 0);
+    bool ok = std::fread(data.data(), 1, data.size(), file) == data.size();
+    std::fclose(file);
+    return ok;
+}
+
+class obj_loader {
+    public:
+        int threads = 0; // 0 = one per hardware thread
+
+        bool load(const std::string& path, triangle_mesh& mesh, std::string& error) {
+            std::vector<char> data;
+            if (!read_whole_file(path, data)) {
+                error = "can't read " + path;
+                return false;
+            }
+
+            // cut the file into chunks that each start right after a newline
+            int n = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+            n = std::max(1, std::min(n, static_cast<int>(data.size() / (1 << 16)) + 1));
+            const char* begin = data.data();
+            const char* end = begin + data.size();
+            std::vector<const char*> cuts(n + 1, end);
+            cuts[0] = begin;
+            for (int k = 1; k < n; ++k) {
+                const char* p = std::max(cuts[k-1], begin + data.size() * k / n);
+                const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                cuts[k] = nl ? nl + 1 : end;
+            }
+
+            std::vector<chunk> chunks(n);
+            std::vector<std::thread> workers;
+            for (int k = 1; k < n; ++k) {
+                workers.push_back(std::thread(&obj_loader::parse_chunk, std::ref(chunks[k]), cuts[k], cuts[k+1]));
+            }
+            parse_chunk(chunks[0], cuts[0], cuts[1]);
+            for (auto& w : workers) {
+                w.join();
+            }
+
+            // stitch: vertices concatenate, face indices become global now that we know where each chunk starts
+            size_t vertex_count = 0, index_count = 0;
+            for (const auto& c : chunks) {
+                if (!c.error.empty()) {
+                    error = path + ": " + c.error;
+                    return false;
+                }
+                vertex_count += c.vertices.size();
+                index_count += c.indices.size();
+            }
+            if (vertex_count > 0xFFFFFFFFu) {
+                error = path + ": too many vertices";
+                return false;
+            }
+
+            mesh.vertices.clear();
+            mesh.vertices.reserve(vertex_count);
+            mesh.indices.clear();
+            mesh.indices.reserve(index_count);
+            int64_t chunk_start = 0;
+            for (const auto& c : chunks) {
+                mesh.vertices.insert(mesh.vertices.end(), c.vertices.begin(), c.vertices.end());
+                for (int64_t raw : c.indices) {
+                    int64_t index = (raw >= relative_base / 2) ? chunk_start + (raw - relative_base) : raw;
+                    if (index < 0 || index >= static_cast<int64_t>(vertex_count)) {
+                        error = path + ": face index out of range";
+                        return false;
+                    }
+                    mesh.indices.push_back(static_cast<uint32_t>(index));
+                }
+                chunk_start += static_cast<int64_t>(c.vertices.size());
+            }
+            return true;
+        }
+
+    private:
+        // Negative OBJ indices count back from the current vertex, which a chunk can only express relative to its own
+        // first vertex. Those are stored offset by relative_base and resolved once the chunk offsets are known.
+        static const int64_t relative_base = int64_t(1) << 62;
+
+        struct chunk {
+            std::vector<mesh_vertex> vertices;
+            std::vector<int64_t> indices;
+            std::string error;
+        };
+
+        static void parse_chunk(chunk& out, const char* p, const char* end) {
+            std::vector<int64_t> polygon;
+            while (p < end) {
+                const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                if (eol == nullptr) {
+                    eol = end;
+                }
+                const char* line = p;
+                skip_blank(p, eol);
+
+                if (eol - p > 1 && p[0] == 'v' && is_blank(p[1])) {
+                    p += 2;
+                    double xyz[3];
+                    for (int a = 0; a < 3; ++a) {
+                        if (!parse_number(p, eol, xyz[a])) {
+                            out.error = "bad vertex '" + std::string(line, eol) + "'";
+                            return;
+                        }
+                    }
+                    mesh_vertex v;
+                    v.p[0] = static_cast<float>(xyz[0]);
+                    v.p[1] = static_cast<float>(xyz[1]);
+                    v.p[2] = static_cast<float>(xyz[2]);
+                    out.vertices.push_back(v);
+                }
+                else if (eol - p > 1 && p[0] == 'f' && is_blank(p[1])) {
+                    p += 2;
+                    polygon.clear();
+                    int64_t index;
+                    while (face_index(p, eol, index)) {
+                        // 1 based, or negative counting back from the last vertex read so far
+                        polygon.push_back(index > 0 ? index - 1 : relative_base + static_cast<int64_t>(out.vertices.size()) + index);
+                    }
+                    if (polygon.size() < 3 || index != 0) {
+                        out.error = "bad face '" + std::string(line, eol) + "'";
+                        return;
+                    }
+                    for (size_t k = 1; k + 1 < polygon.size(); ++k) {
+                        out.indices.push_back(polygon[0]);
+                        out.indices.push_back(polygon[k]);
+                        out.indices.push_back(polygon[k+1]);
+                    }
+                }
+                p = eol + 1;
+            }
+        }
+
+        // One "v", "v/vt", "v//vn" or "v/vt/vn" token, returning just the position index.
+        // Returns false at the end of the line with index 0, or on a malformed token with index 1.
+        static bool face_index(const char*& p, const char* end, int64_t& index) {
+            skip_blank(p, end);
+            index = 0;
+            if (p == end || *p == '#') {
+                return false;
+            }
+            bool negative = (*p == '-');
+            if (negative) {
+                ++p;
+            }
+            int64_t value = 0;
+            const char* digits = p;
+            while (p < end && *p >= '0' && *p <= '9') {
+                value = value * 10 + (*p - '0');
+                ++p;
+            }
+            if (p == digits || value == 0) {
+                index = 1; // not a valid index, flags the error
+                return false;
+            }
+            while (p < end && !is_blank(*p)) {
+                ++p; // texture coordinate and normal indices
+            }
+            index = negative ? -value : value;
+            return true;
+        }
+};
+
+class ply_loader {
+    public:
+        bool load(const std::string& path, triangle_mesh& mesh, std::string& error) {
+            std::vector<char> data;
+            if (!read_whole_file(path, data)) {
+                error = "can't read " + path;
+                return false;
+            }
+            const char* p = data.data();
+            const char* end = p + data.size();
+            if (!parse_header(p, end, error) || !parse_body(p, end, mesh, error)) {
+                error = path + ": " + error;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        enum format_type { ascii, little_endian, big_endian };
+        enum scalar_type { t_int8, t_uint8, t_int16, t_uint16, t_int32, t_uint32, t_float32, t_float64, t_invalid };
+
+        struct property {
+            std::string name;
+            scalar_type type = t_invalid;
+            bool is_list = false;
+            scalar_type count_type = t_invalid;
+        };
+
+        struct element {
+            std::string name;
+            size_t count = 0;
+            std::vector<property> properties;
+        };
+
+        format_type format = ascii;
+        std::vector<element> elements;
+
+        static scalar_type scalar_from_name(const std::string& s) {
+            if (s == "char" || s == "int8") return t_int8;
+            if (s == "uchar" || s == "uint8") return t_uint8;
+            if (s == "short" || s == "int16") return t_int16;
+            if (s == "ushort" || s == "uint16") return t_uint16;
+            if (s == "int" || s == "int32") return t_int32;
+            if (s == "uint" || s == "uint32") return t_uint32;
+            if (s == "float" || s == "float32") return t_float32;
+            if (s == "double" || s == "float64") return t_float64;
+            return t_invalid;
+        }
+
+        static size_t scalar_size(scalar_type t) {
+            switch (t) {
+                case t_int8: case t_uint8: return 1;
+                case t_int16: case t_uint16: return 2;
+                case t_int32: case t_uint32: case t_float32: return 4;
+                case t_float64: return 8;
+                default: return 0;
+            }
+        }
+
+        static std::string next_word(const char*& p, const char* end) {
+            skip_blank(p, end);
+            const char* start = p;
+            while (p < end && !is_blank(*p) && *p != '\n') {
+                ++p;
+            }
+            return std::string(start, p);
+        }
+
+        bool parse_header(const char*& p, const char* end, std::string& error) {
+            if (end - p < 4 || std::memcmp(p, "ply", 3) != 0) {
+                error = "not a PLY file";
+                return false;
+            }
+            while (p < end) {
+                const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                if (eol == nullptr) {
+                    break;
+                }
+                std::string keyword = next_word(p, eol);
+                if (keyword == "format") {
+                    std::string f = next_word(p, eol);
+                    format = (f == "binary_little_endian") ? little_endian : (f == "binary_big_endian") ? big_endian : ascii;
+                }
+                else if (keyword == "element") {
+                    element e;
+                    e.name = next_word(p, eol);
+                    e.count = std::strtoull(next_word(p, eol).c_str(), nullptr, 10);
+                    elements.push_back(e);
+                }
+                else if (keyword == "property" && !elements.empty()) {
+                    property prop;
+                    std::string type = next_word(p, eol);
+                    if (type == "list") {
+                        prop.is_list = true;
+                        prop.count_type = scalar_from_name(next_word(p, eol));
+                        type = next_word(p, eol);
+                    }
+                    prop.type = scalar_from_name(type);
+                    prop.name = next_word(p, eol);
+                    if (prop.type == t_invalid || (prop.is_list && prop.count_type == t_invalid)) {
+                        error = "unsupported property type";
+                        return false;
+                    }
+                    elements.back().properties.push_back(prop);
+                }
+                p = eol + 1;
+                if (keyword == "end_header") {
+                    return true;
+                }
+            }
+            error = "missing end_header";
+            return false;
+        }
+
+        // read one scalar of the given type, converted to double
+        bool read_value(const char*& p, const char* end, scalar_type t, double& out) const {
+            if (format == ascii) {
+                while (p < end && (is_blank(*p) || *p == '\n')) {
+                    ++p;
+                }
+                return parse_number(p, end, out);
+            }
+
+            size_t size = scalar_size(t);
+            if (static_cast<size_t>(end - p) < size) {
+                return false;
+            }
+            unsigned char bytes[8];
+            std::memcpy(bytes, p, size);
+            p += size;
+            bool host_little = is_little_endian();
+            if ((format == little_endian) != host_little) {
+                std::reverse(bytes, bytes + size);
+            }
+            switch (t) {
+                case t_int8:    { int8_t v;   std::memcpy(&v, bytes, 1); out = v; break; }
+                case t_uint8:   { uint8_t v;  std::memcpy(&v, bytes, 1); out = v; break; }
+                case t_int16:   { int16_t v;  std::memcpy(&v, bytes, 2); out = v; break; }
+                case t_uint16:  { uint16_t v; std::memcpy(&v, bytes, 2); out = v; break; }
+                case t_int32:   { int32_t v;  std::memcpy(&v, bytes, 4); out = v; break; }
+                case t_uint32:  { uint32_t v; std::memcpy(&v, bytes, 4); out = v; break; }
+                case t_float32: { float v;    std::memcpy(&v, bytes, 4); out = v; break; }
+                case t_float64: { double v;   std::memcpy(&v, bytes, 8); out = v; break; }
+                default: return false;
+            }
+            return true;
+        }
+
+        // fewest bytes one item of e can take in the file: its scalars and list counts in binary, a digit each in ascii
+        size_t min_item_bytes(const element& e) const {
+            size_t bytes = 0;
+            for (const property& prop : e.properties) {
+                bytes += (format == ascii) ? 1 : scalar_size(prop.is_list ? prop.count_type : prop.type);
+            }
+            return std::max<size_t>(bytes, 1);
+        }
+
+        // whether a value read from the file is a whole number in [0, max], which rules out NaN
+        static bool is_whole(double value, double max) {
+            return value >= 0 && value <= max && value == std::floor(value);
+        }
+
+        static bool is_little_endian() {
+            uint16_t one = 1;
+            unsigned char first;
+            std::memcpy(&first, &one, 1);
+            return first == 1;
+        }
+
+        bool parse_body(const char*& p, const char* end, triangle_mesh& mesh, std::string& error) {
+            mesh.vertices.clear();
+            mesh.indices.clear();
+            std::vector<uint32_t> polygon;
+
+            for (const element& e : elements) {
+                bool is_vertex = (e.name == "vertex");
+                bool is_face = (e.name == "face");
+                // a count the rest of the file can't hold is a damaged header, not something to reserve memory for
+                if (e.count > static_cast<size_t>(end - p) / min_item_bytes(e)) {
+                    error = "truncated " + e.name + " element";
+                    return false;
+                }
+                if (is_vertex) {
+                    mesh.vertices.reserve(e.count);
+                }
+                if (is_face) {
+                    mesh.indices.reserve(3 * e.count);
+                }
+
+                for (size_t item = 0; item < e.count; ++item) {
+                    mesh_vertex v = {{0, 0, 0}};
+                    for (const property& prop : e.properties) {
+                        double value;
+                        if (prop.is_list) {
+                            double count;
+                            if (!read_value(p, end, prop.count_type, count)) {
+                                error = "truncated " + e.name + " list";
+                                return false;
+                            }
+                            // like the element counts, a list can't be longer than what's left of the file
+                            size_t item_bytes = (format == ascii) ? 1 : scalar_size(prop.type);
+                            if (!is_whole(count, static_cast<double>(static_cast<size_t>(end - p) / item_bytes))) {
+                                error = "truncated " + e.name + " list";
+                                return false;
+                            }
+                            bool is_indices = is_face && (prop.name == "vertex_indices" || prop.name == "vertex_index");
+                            polygon.clear();
+                            for (size_t k = 0; k < static_cast<size_t>(count); ++k) {
+                                if (!read_value(p, end, prop.type, value)) {
+                                    error = "truncated " + e.name + " list";
+                                    return false;
+                                }
+                                if (!is_indices) {
+                                    continue; // other lists are read past, not kept
+                                }
+                                if (!is_whole(value, UINT32_MAX)) {
+                                    error = "bad index in " + e.name + " list";
+                                    return false;
+                                }
+                                polygon.push_back(static_cast<uint32_t>(value));
+                            }
+                            if (is_indices) {
+                                for (size_t k = 1; k + 1 < polygon.size(); ++k) {
+                                    mesh.indices.push_back(polygon[0]);
+                                    mesh.indices.push_back(polygon[k]);
+                                    mesh.indices.push_back(polygon[k+1]);
+                                }
+                            }
+                            continue;
+                        }
+
+                        if (!read_value(p, end, prop.type, value)) {
+                            error = "truncated " + e.name + " element";
+                            return false;
+                        }
+                        if (is_vertex) {
+                            if (prop.name == "x") v.p[0] = static_cast<float>(value);
+                            else if (prop.name == "y") v.p[1] = static_cast<float>(value);
+                            else if (prop.name == "z") v.p[2] = static_cast<float>(value);
+                        }
+                    }
+                    if (is_vertex) {
+                        mesh.vertices.push_back(v);
+                    }
+                }
+            }
+
+            for (uint32_t index : mesh.indices) {
+                if (index >= mesh.vertices.size()) {
+                    error = "face index out of range";
+                    return false;
+                }
+            }
+            return true;
+        }
+};
+
+// Load an .obj or .ply file (by extension) into mesh and build its BVH
+inline bool load_mesh(const std::string& path, triangle_mesh& mesh, std::string& error) {
+    std::string ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    bool ok;
+    if (ext == ".ply") {
+        ply_loader loader;
+        ok = loader.load(path, mesh, error);
+    }
+    else if (ext == ".obj") {
+        obj_loader loader;
+        ok = loader.load(path, mesh, error);
+    }
+    else {
+        error = path + ": unknown mesh format (expected .obj or .ply)";
+        return false;
+    }
+
+    if (ok) {
+        mesh.build_bvh();
+    }
+    return ok;
+}
+
+#endif
@@ -0,0 +1,284 @@
+#include "rtweekend.h"
+
+#include "color.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "packed_scene.h"
+#include "sampler.h"
+#include "sphere.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+Microbenchmarks for the hot path kernels
+
+Each kernel runs over fixed inputs (made from a fixed seed, so every run and every build traces the same rays),
+first calibrated to run for at least min_time, then measured `repetitions` times. The median is reported, as
+nanoseconds per operation and operations per second. Every result feeds a checksum that gets printed, so the
+compiler can't throw the work away, and a changed checksum means a kernel's output changed, not just its speed.
+
+Usage:
+    microbench [--filter TEXT] [--min-time SECONDS] [--repetitions N]
+
+The whole suite takes a few seconds with the defaults.
+*/
+
+class microbench {
+    public:
+        double min_time = 0.2;   // seconds per measurement
+        int repetitions = 5;
+        std::string filter;      // only benchmarks whose name contains this
+
+        // Benchmark body(iterations), which does `iterations` operations and returns a checksum of their results
+        template <typename F>
+        void run(const char* name, F body) {
+            if (!filter.empty() && std::strstr(name, filter.c_str()) == nullptr) {
+                return;
+            }
+
+            // grow the iteration count until one measurement takes long enough to time reliably
+            size_t iterations = 1;
+            double checksum = 0;
+            while (true) {
+                double seconds = time(body, iterations, checksum);
+                if (seconds >= min_time) {
+                    break;
+                }
+                double grow = (seconds > 0) ? 1.4 * min_time / seconds : 10.0;
+                iterations = static_cast<size_t>(iterations * std::min(10.0, std::max(1.5, grow)));
+            }
+
+            std::vector<double> ns_per_op;
+            for (int k = 0; k < repetitions; ++k) {
+                ns_per_op.push_back(1e9 * time(body, iterations, checksum) / iterations);
+            }
+            std::sort(ns_per_op.begin(), ns_per_op.end());
+            double median = ns_per_op[ns_per_op.size() / 2];
+            std::printf("%-28s %12.2f ns/op %14.0f ops/s   (%zu ops, min %.2f max %.2f, checksum %.6g)\n",
+                        name, median, 1e9 / median, iterations, ns_per_op.front(), ns_per_op.back(), checksum);
+            std::fflush(stdout);
+        }
+
+    private:
+        template <typename F>
+        static double time(F& body, size_t iterations, double& checksum) {
+            auto start = std::chrono::steady_clock::now();
+            double result = body(iterations);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            checksum = result;
+            return elapsed.count();
+        }
+};
+
+// fixed inputs shared by the benchmarks
+struct bench_inputs {
+    static const size_t count = 4096; // power of two, indexed with & (count - 1)
+
+    std::vector<vec3> vectors;
+    std::vector<ray> rays;            // from around the demo camera into the sphere field
+    std::vector<hit_record> hits;     // on an upward facing surface
+    std::vector<ray> incoming;        // the ray that made each of the hits
+    std::vector<double> sample_u;     // the first two dimensions of a sobol sequence, for material sampling
+    std::vector<double> sample_v;
+
+    bench_inputs() {
+        seed_random(1);
+        for (size_t k = 0; k < count; ++k) {
+            vectors.push_back(vec3::random(-1, 1));
+            point3 origin(13 + random_double(-1, 1), 2 + random_double(0, 1), 3 + random_double(-1, 1));
+            point3 target(random_double(-6, 6), random_double(0, 1.5), random_double(-6, 6));
+            rays.push_back(ray(origin, target - origin));
+
+            hit_record h;
+            h.point = point3(random_double(-1, 1), 0, random_double(-1, 1));
+            h.t = 1;
+            h.front_face = true;
+            h.normal = vec3(0, 1, 0);
+            hits.push_back(h);
+
+            const vec3& v = vectors[k];
+            vec3 down(v.x(), -std::fabs(v.y()) - 0.1, v.z());
+            incoming.push_back(ray(h.point - down, down));
+        }
+
+        // made here rather than in the timed loops, where drawing them cost more than some of the materials
+        sobol_sampler samples;
+        for (size_t k = 0; k < count; ++k) {
+            double u, v;
+            samples.start(0, 0, static_cast<int>(k));
+            samples.get_2d(u, v);
+            sample_u.push_back(u);
+            sample_v.push_back(v);
+        }
+    }
+};
+
+// the demo's sphere field: a ground sphere, a grid of small spheres and three big ones
+static void sphere_field(scene_description& scene) {
+    seed_random(2);
+    auto ground = scene.add_lambertian(color(0.5, 0.5, 0.5));
+    scene.add_sphere(point3(0, -1000, 0), 1000, ground);
+    for (int x = -11; x < 11; ++x) {
+        for (int y = -11; y < 11; ++y) {
+            point3 center(x + 0.9*random_double(), 0.2, y + 0.9*random_double());
+            scene.add_sphere(center, 0.2, scene.add_lambertian(color::random() * color::random()));
+        }
+    }
+    scene.add_sphere(point3(-4, 1, 0), 1.0, scene.add_lambertian(color(0.7, 0.3, 0.2)));
+    scene.add_sphere(point3(0, 1, 0), 1.0, scene.add_metal(color(0.4, 0.7, 0.1), 0.0));
+    scene.add_sphere(point3(4, 1, 0), 1.0, scene.add_dielectric(1.5));
+}
+
+// n x n grid of triangles over [-6, 6]^2, with a bumpy height, facing up
+static void grid_mesh(triangle_mesh& mesh, int n) {
+    for (int j = 0; j <= n; ++j) {
+        for (int i = 0; i <= n; ++i) {
+            float x = -6 + 12.0f * i / n, z = -6 + 12.0f * j / n;
+            mesh.vertices.push_back(mesh_vertex{{x, 0.3f * std::sin(x) * std::cos(z), z}});
+        }
+    }
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            uint32_t a = j * (n + 1) + i, b = a + 1, c = a + (n + 1), d = c + 1;
+            uint32_t tris[6] = { a, c, b, b, c, d };
+            mesh.indices.insert(mesh.indices.end(), tris, tris + 6);
+        }
+    }
+    mesh.build_bvh();
+}
+
+int main(int argc, char* argv[]) {
+    microbench bench;
+    for (int a = 1; a < argc; ++a) {
+        bool has_value = a + 1 < argc;
+        if (std::strcmp(argv[a], "--filter") == 0 && has_value) {
+            bench.filter = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--min-time") == 0 && has_value) {
+            bench.min_time = std::atof(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--repetitions") == 0 && has_value) {
+            bench.repetitions = std::max(1, std::atoi(argv[++a]));
+        }
+        else {
+            std::fprintf(stderr, "usage: microbench [--filter TEXT] [--min-time SECONDS] [--repetitions N]\n");
+            return 1;
+        }
+    }
+
+    const bench_inputs in;
+    const size_t mask = bench_inputs::count - 1;
+
+    bench.run("random_double", [](size_t n) {
+        double sum = 0;
+        for (size_t k = 0; k < n; ++k) {
+            sum += random_double();
+        }
+        return sum / n;
+    });
+
+    bench.run("vec3_dot_cross_unit", [&](size_t n) {
+        double sum = 0;
+        for (size_t k = 0; k < n; ++k) {
+            const vec3& a = in.vectors[k & mask];
+            const vec3& b = in.vectors[(k + 1) & mask];
+            vec3 c = unit_vector(cross(a, b) + 0.5 * a - b * 0.25);
+            sum += dot(c, a);
+        }
+        return sum;
+    });
+
+    auto lambert = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    sphere ball(point3(0, 0.5, 0), 3.0, lambert);
+    bench.run("sphere_hit", [&](size_t n) {
+        double sum = 0;
+        hit_record rec;
+        for (size_t k = 0; k < n; ++k) {
+            if (ball.hit(in.rays[k & mask], interval(0.001, infinity), rec)) {
+                sum += rec.t;
+            }
+        }
+        return sum;
+    });
+
+    scene_description field;
+    sphere_field(field);
+    hittable_list list;
+    {
+        auto mats = make_materials(field.materials.data(), field.materials.size());
+        for (const auto& s : field.spheres) {
+            list.add(make_shared<sphere>(point3(s.center[0], s.center[1], s.center[2]), s.radius, mats[s.material]));
+        }
+    }
+    char name[64];
+    std::snprintf(name, sizeof(name), "hittable_list_hit_%zu", list.objects.size());
+    bench.run(name, [&](size_t n) {
+        double sum = 0;
+        hit_record rec;
+        for (size_t k = 0; k < n; ++k) {
+            if (list.hit(in.rays[k & mask], interval(0.001, infinity), rec)) {
+                sum += rec.t;
+            }
+        }
+        return sum;
+    });
+
+    packed_scene packed;
+    packed.adopt(field);
+    std::snprintf(name, sizeof(name), "packed_scene_hit_%zu", packed.size());
+    bench.run(name, [&](size_t n) {
+        double sum = 0;
+        hit_record rec;
+        for (size_t k = 0; k < n; ++k) {
+            if (packed.hit(in.rays[k & mask], interval(0.001, infinity), rec)) {
+                sum += rec.t;
+            }
+        }
+        return sum;
+    });
+
+    triangle_mesh mesh(lambert);
+    grid_mesh(mesh, 256);
+    std::snprintf(name, sizeof(name), "triangle_mesh_hit_%zu", mesh.triangle_count());
+    bench.run(name, [&](size_t n) {
+        double sum = 0;
+        hit_record rec;
+        for (size_t k = 0; k < n; ++k) {
+            if (mesh.hit(in.rays[k & mask], interval(0.001, infinity), rec)) {
+                sum += rec.t;
+            }
+        }
+        return sum;
+    });
+
+    // material sampling, all three with the same precomputed sobol points
+    auto scatter_bench = [&](const char* bench_name, shared_ptr<material> mat) {
+        std::vector<hit_record> hits = in.hits;
+        for (auto& h : hits) {
+            h.mat = mat;
+        }
+        bench.run(bench_name, [&](size_t n) {
+            double sum = 0;
+            color attenuation;
+            ray scattered;
+            for (size_t k = 0; k < n; ++k) {
+                size_t i = k & mask;
+                if (mat->sample(in.incoming[i], hits[i], in.sample_u[i], in.sample_v[i], attenuation, scattered)) {
+                    sum += scattered.direction().y() * attenuation.x();
+                }
+            }
+            return sum;
+        });
+    };
+    scatter_bench("lambertian_sample", lambert);
+    scatter_bench("metal_sample", make_shared<metal>(color(0.8, 0.8, 0.8), 0.3));
+    scatter_bench("dielectric_sample", make_shared<dielectric>(1.5));
+
+    return 0;
+}
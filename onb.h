@@ -0,0 +1,58 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "rtweekend.h"
+
+#include <cmath>
+
+/*
+Orthonormal basis
+
+Three perpendicular unit vectors u, v, w built around a given direction w (usually a surface normal, or the direction
+towards a light). Directions are easy to generate around the z axis, "local" turns them into world directions around w.
+*/
+
+class onb {
+    public:
+        onb(const vec3& n) {
+            axis[2] = unit_vector(n);
+            // any vector not parallel to w will do to start the cross products
+            vec3 a = (std::fabs(axis[2].x()) > 0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+            axis[1] = unit_vector(cross(axis[2], a));
+            axis[0] = cross(axis[2], axis[1]);
+        }
+
+        const vec3& u() const { return axis[0]; }
+        const vec3& v() const { return axis[1]; }
+        const vec3& w() const { return axis[2]; }
+
+        // world direction of the local coordinates (a, b, c), c along w
+        vec3 local(double a, double b, double c) const {
+            return a*axis[0] + b*axis[1] + c*axis[2];
+        }
+
+        vec3 local(const vec3& p) const {
+            return local(p.x(), p.y(), p.z());
+        }
+
+    private:
+        vec3 axis[3];
+};
+
+// Direction around +z with density cos(theta)/pi, made directly from two uniform numbers in [0,1):
+// a uniform point on the unit disk lifted up onto the hemisphere (Malley's method)
+inline vec3 cosine_direction(double u1, double u2) {
+    double r = std::sqrt(u1);
+    double phi = 2 * pi * u2;
+    return vec3(r * std::cos(phi), r * std::sin(phi), std::sqrt(1 - u1));
+}
+
+// Direction uniformly over the whole unit sphere from two uniform numbers in [0,1)
+inline vec3 sphere_direction(double u1, double u2) {
+    double z = 1 - 2 * u1;
+    double r = std::sqrt(std::fmax(0.0, 1 - z*z));
+    double phi = 2 * pi * u2;
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+#endif
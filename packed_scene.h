@@ -0,0 +1,409 @@
+#ifndef PACKED_SCENE_H
+#define PACKED_SCENE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "color.h"
+#include "cpu_dispatch.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "scene_file.h"
+#include "simd_kernels.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Conservative float bounds of a sphere record over the whole frame (the sphere at time 0 and at time 1, which covers
+// everything in between for linear motion), rounded outwards so float error never clips the sphere
+inline bvh_box sphere_record_bounds(const sphere_record& s) {
+    bvh_box b;
+    float r = std::fabs(s.radius);
+    for (int a = 0; a < 3; ++a) {
+        float end = s.center[a] + s.velocity[a];
+        b.min[a] = std::nextafter(std::min(s.center[a], end) - r, -std::numeric_limits<float>::infinity());
+        b.max[a] = std::nextafter(std::max(s.center[a], end) + r, std::numeric_limits<float>::infinity());
+    }
+    return b;
+}
+
+// Put the scene's spheres in the given order (order[k] is the old index of the sphere that goes to position k)
+inline void reorder_spheres(scene_description& scene, const std::vector<uint32_t>& order) {
+    std::vector<sphere_record> sorted(order.size());
+    for (size_t k = 0; k < order.size(); ++k) {
+        sorted[k] = scene.spheres[order[k]];
+    }
+    scene.spheres.swap(sorted);
+}
+
+// Build a BVH over the scene's spheres and put the spheres in its leaf order, ready for save_scene_binary.
+// The permutation that was applied is left in order for anyone who wants to cache it.
+inline void build_scene_bvh(scene_description& scene, std::vector<uint32_t>& order) {
+    std::vector<bvh_box> bounds(scene.spheres.size());
+    for (size_t k = 0; k < bounds.size(); ++k) {
+        bounds[k] = sphere_record_bounds(scene.spheres[k]);
+    }
+
+    bvh_builder builder;
+    builder.build(bounds, scene.nodes, order);
+    reorder_spheres(scene, order);
+}
+
+inline void build_scene_bvh(scene_description& scene) {
+    std::vector<uint32_t> order;
+    build_scene_bvh(scene, order);
+}
+
+/*
+Sphere scene traced straight out of flat arrays: sphere records, BVH nodes and a material table.
+
+The arrays either come from a scene_description (adopt) or from a memory mapped binary scene file (map),
+in which case nothing is copied or constructed per sphere, the OS just pages in whatever the rays touch.
+The only per-object work at startup is creating the material objects, one per material record.
+
+Traversal comes in a baseline, an AVX2 and an AVX-512 build (simd_kernels.h); the one for selected_cpu_isa()
+is picked when the scene is created and every variant finds exactly the same hits.
+*/
+class packed_scene : public hittable {
+    public:
+        packed_scene() : traverse(select_traverse()) {}
+        packed_scene(const packed_scene&) = delete;
+        packed_scene& operator=(const packed_scene&) = delete;
+
+        ~packed_scene() {
+            unmap();
+        }
+
+        // take over the scene's arrays, building the BVH first if it doesn't have one
+        void adopt(scene_description& scene) {
+            unmap();
+            if (scene.nodes.empty() && !scene.spheres.empty()) {
+                build_scene_bvh(scene);
+            }
+            own_spheres.swap(scene.spheres);
+            own_nodes.swap(scene.nodes);
+            spheres = own_spheres.data();
+            sphere_count = own_spheres.size();
+            nodes = own_nodes.data();
+            node_count = own_nodes.size();
+            mats = make_materials(scene.materials.data(), scene.materials.size());
+        }
+
+        // true if path is a binary scene with a prebuilt BVH, which map() can trace without loading
+        static bool is_mappable(const std::string& path) {
+            std::FILE* file = std::fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                return false;
+            }
+            scene_binary_header header;
+            scene_binary_sections sections;
+            bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+                   && std::memcmp(header.magic, scene_binary_magic, sizeof(header.magic)) == 0
+                   && header.version == scene_binary_version
+                   && std::fread(&sections, sizeof(sections), 1, file) == 1
+                   && (sections.node_count > 0 || header.sphere_count == 0);
+            std::fclose(file);
+            return ok;
+        }
+
+        // Memory map a binary scene file and trace it in place. The file's camera settings and mesh list
+        // go into scene, its sphere arrays stay untouched.
+        bool map(const std::string& path, scene_description& scene, std::string& error) {
+            unmap();
+            own_spheres.clear();
+            own_nodes.clear();
+
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                error = "can't open " + path;
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(scene_binary_header) + sizeof(scene_binary_sections)) {
+                close(fd);
+                error = path + ": not a binary scene";
+                return false;
+            }
+            mapped_size = static_cast<size_t>(st.st_size);
+            void* base = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd); // the mapping keeps the file alive
+            if (base == MAP_FAILED) {
+                error = path + ": mmap failed";
+                return false;
+            }
+            mapped = static_cast<const char*>(base);
+
+            scene_binary_header header;
+            scene_binary_sections sections;
+            std::memcpy(&header, mapped, sizeof(header));
+            if (std::memcmp(header.magic, scene_binary_magic, sizeof(header.magic)) != 0
+                || header.version != scene_binary_version) {
+                unmap();
+                error = path + ": not a binary scene of version " + std::to_string(scene_binary_version);
+                return false;
+            }
+            std::memcpy(&sections, mapped + sizeof(header), sizeof(sections));
+
+            // Only the section bounds are checked here. Walking every sphere and node to validate indices would touch
+            // every page of the file and throw away the point of mapping it: node and sphere indices are checked as
+            // traversal reaches them (bvh_traverse, the sphere leaves), material indices when hit.
+            if (!section_fits(sections.materials_offset, header.material_count, sizeof(material_record))
+                || !section_fits(sections.spheres_offset, header.sphere_count, sizeof(sphere_record))
+                || !section_fits(sections.nodes_offset, sections.node_count, sizeof(bvh_node))
+                || !section_fits(sections.meshes_offset, sections.meshes_bytes, 1)
+                || (sections.node_count == 0 && header.sphere_count > 0)
+                || !read_mesh_table(mapped + sections.meshes_offset, sections.meshes_bytes, sections.mesh_count, scene.meshes)) {
+                unmap();
+                error = path + ": corrupt section table";
+                return false;
+            }
+
+            header_to_camera(header, scene.cam);
+            if (!sections_to_camera(sections, scene.cam)) {
+                unmap();
+                error = path + ": shutter outside the frame";
+                return false;
+            }
+            spheres = reinterpret_cast<const sphere_record*>(mapped + sections.spheres_offset);
+            sphere_count = header.sphere_count;
+            nodes = reinterpret_cast<const bvh_node*>(mapped + sections.nodes_offset);
+            node_count = sections.node_count;
+            mats = make_materials(reinterpret_cast<const material_record*>(mapped + sections.materials_offset), header.material_count);
+            return true;
+        }
+
+        size_t size() const { return sphere_count; }
+
+        // put every sphere whose material emits into the light list
+        void add_lights(light_list& lights) const {
+            std::vector<color> emission(mats.size());
+            bool any = false;
+            for (size_t k = 0; k < mats.size(); ++k) {
+                emission[k] = light_list::front_emission(*mats[k]);
+                any = any || !light_list::is_black(emission[k]);
+            }
+            if (!any) {
+                return; // don't page through a mapped scene for nothing
+            }
+            for (size_t k = 0; k < sphere_count; ++k) {
+                const sphere_record& s = spheres[k];
+                if (s.material < emission.size() && !light_list::is_black(emission[s.material])) {
+                    lights.add_sphere(point3(s.center[0], s.center[1], s.center[2]),
+                                      vec3(s.velocity[0], s.velocity[1], s.velocity[2]), s.radius, emission[s.material],
+                                      static_cast<uint32_t>(k + 1));
+                }
+            }
+        }
+
+        // the material objects, indexed like the scene's material records
+        const std::vector<shared_ptr<material>>& materials() const { return mats; }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            uint32_t closest;
+            if (!traverse(spheres, sphere_count, nodes, node_count, r, ray_t, closest)) {
+                return false;
+            }
+
+            // only the closest sphere gets its normal and material worked out
+            const sphere_record& s = spheres[closest];
+            point3 center = center_at(s, r.time());
+            rec.t = ray_t.max;
+            rec.point = r.at(rec.t);
+            vec3 outward_normal = (rec.point - center) / s.radius;
+            rec.set_face_normal(r, outward_normal);
+            rec.mat = (s.material < mats.size()) ? mats[s.material] : fallback_material();
+            rec.object_id = closest + 1;
+            rec.material_id = s.material + 1;
+            rec.primitive = 0;
+            return true;
+        }
+
+        bvh_box bounding_box() const override {
+            return (node_count > 0) ? nodes[0].bounds : bvh_box::empty();
+        }
+
+    private:
+        typedef bool (*traverse_fn)(const sphere_record*, size_t, const bvh_node*, size_t, const ray&, interval&, uint32_t&);
+        traverse_fn traverse;
+
+        const sphere_record* spheres = nullptr;
+        size_t sphere_count = 0;
+        const bvh_node* nodes = nullptr;
+        size_t node_count = 0;
+        std::vector<shared_ptr<material>> mats;
+
+        // storage when the arrays were adopted rather than mapped
+        std::vector<sphere_record> own_spheres;
+        std::vector<bvh_node> own_nodes;
+
+        const char* mapped = nullptr;
+        size_t mapped_size = 0;
+
+        class sphere_leaf {
+            public:
+                const sphere_record* spheres;
+                size_t sphere_count;
+                const ray& r;
+                uint32_t closest = 0;
+
+                sphere_leaf(const sphere_record* _spheres, size_t _sphere_count, const ray& _r)
+                  : spheres(_spheres), sphere_count(_sphere_count), r(_r) {}
+
+                bool operator()(uint32_t first, uint32_t count, interval& ray_t) {
+                    if (static_cast<uint64_t>(first) + count > sphere_count) {
+                        return false; // damaged leaf in a mapped file
+                    }
+                    bool found = false;
+                    RAY_STAT_ADD(primitive_tests, count);
+                    for (uint32_t k = first; k < first + count; ++k) {
+                        double t;
+                        if (hit_sphere(spheres[k], r, ray_t, t)) {
+                            RAY_STAT(primitive_hits);
+                            ray_t.max = t;
+                            closest = k;
+                            found = true;
+                        }
+                    }
+                    return found;
+                }
+        };
+
+#if RENDER_X86_DISPATCH
+        // sphere_leaf with the shared part of up to four sphere tests in one AVX2 vector
+        class sphere_leaf_avx2 {
+            public:
+                const sphere_record* spheres;
+                size_t sphere_count;
+                const ray& r;
+                double a;
+                uint32_t closest = 0;
+
+                sphere_leaf_avx2(const sphere_record* _spheres, size_t _sphere_count, const ray& _r)
+                  : spheres(_spheres), sphere_count(_sphere_count), r(_r), a(_r.direction().length_squared()) {}
+
+                bool operator()(uint32_t first, uint32_t count, interval& ray_t) {
+                    if (static_cast<uint64_t>(first) + count > sphere_count) {
+                        return false; // damaged leaf in a mapped file
+                    }
+                    bool found = false;
+                    RAY_STAT_ADD(primitive_tests, count);
+                    for (uint32_t base = first; base < first + count; base += 4) {
+                        uint32_t n = std::min(4u, first + count - base);
+                        double half_b[4], discriminant[4];
+                        int candidates = sphere_discriminants_avx2(spheres + base, n, r, a, half_b, discriminant);
+                        for (uint32_t k = 0; k < n; ++k) {
+                            double t;
+                            if ((candidates & (1 << k)) && sphere_root(a, half_b[k], discriminant[k], ray_t, t)) {
+                                RAY_STAT(primitive_hits);
+                                ray_t.max = t;
+                                closest = base + k;
+                                found = true;
+                            }
+                        }
+                    }
+                    return found;
+                }
+        };
+#endif
+
+        template <typename Leaf, typename BoxRay>
+        static bool traverse_with(const sphere_record* spheres, size_t sphere_count, const bvh_node* nodes, size_t node_count, const ray& r,
+                                  interval& ray_t, uint32_t& closest) {
+            Leaf leaf(spheres, sphere_count, r);
+            bool hit = bvh_traverse<Leaf, BoxRay>(nodes, node_count, r, ray_t, leaf);
+            closest = leaf.closest;
+            return hit;
+        }
+
+        static bool traverse_generic(const sphere_record* spheres, size_t sphere_count, const bvh_node* nodes, size_t node_count, const ray& r,
+                                     interval& ray_t, uint32_t& closest) {
+            return traverse_with<sphere_leaf, bvh_ray>(spheres, sphere_count, nodes, node_count, r, ray_t, closest);
+        }
+
+#if RENDER_X86_DISPATCH
+        RENDER_TARGET_AVX2 RENDER_FLATTEN
+        static bool traverse_avx2(const sphere_record* spheres, size_t sphere_count, const bvh_node* nodes, size_t node_count, const ray& r,
+                                  interval& ray_t, uint32_t& closest) {
+            return traverse_with<sphere_leaf_avx2, bvh_ray_avx2>(spheres, sphere_count, nodes, node_count, r, ray_t, closest);
+        }
+
+        RENDER_TARGET_AVX512 RENDER_FLATTEN
+        static bool traverse_avx512(const sphere_record* spheres, size_t sphere_count, const bvh_node* nodes, size_t node_count, const ray& r,
+                                    interval& ray_t, uint32_t& closest) {
+            return traverse_with<sphere_leaf_avx2, bvh_ray_avx512>(spheres, sphere_count, nodes, node_count, r, ray_t, closest);
+        }
+#endif
+
+        static traverse_fn select_traverse() {
+#if RENDER_X86_DISPATCH
+            switch (selected_cpu_isa()) {
+                case cpu_isa_avx512: return traverse_avx512;
+                case cpu_isa_avx2:   return traverse_avx2;
+                default:             break;
+            }
+#endif
+            return traverse_generic;
+        }
+
+        static point3 center_at(const sphere_record& s, double time) {
+            return point3(s.center[0] + time*s.velocity[0], s.center[1] + time*s.velocity[1], s.center[2] + time*s.velocity[2]);
+        }
+
+        // same math as sphere::hit, minus filling in the hit record
+        static bool hit_sphere(const sphere_record& s, const ray& r, const interval& ray_t, double& t) {
+            vec3 oc = r.origin() - center_at(s, r.time());
+            vec3 dir = r.direction();
+            auto a = dir.length_squared();
+            auto half_b = dot(oc, dir);
+            auto c = oc.length_squared() - static_cast<double>(s.radius) * s.radius;
+
+            return sphere_root(a, half_b, half_b*half_b - a*c, ray_t, t);
+        }
+
+        // the nearer root of the quadratic inside ray_t, if there is one
+        static bool sphere_root(double a, double half_b, double discriminant, const interval& ray_t, double& t) {
+            if (discriminant < 0) {
+                return false;
+            }
+            auto sqrtd = sqrt(discriminant);
+            auto root = (-half_b - sqrtd) / a;
+            if (!ray_t.surrounds(root)) {
+                root = (-half_b + sqrtd) / a;
+                if (!ray_t.surrounds(root)) {
+                    return false;
+                }
+            }
+            t = root;
+            return true;
+        }
+
+        static const shared_ptr<material>& fallback_material() {
+            static shared_ptr<material> m = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+            return m;
+        }
+
+        bool section_fits(uint64_t offset, uint64_t count, size_t record_size) const {
+            return offset % 4 == 0 && offset <= mapped_size && count <= (mapped_size - offset) / record_size;
+        }
+
+        void unmap() {
+            if (mapped != nullptr) {
+                munmap(const_cast<char*>(mapped), mapped_size);
+                mapped = nullptr;
+                mapped_size = 0;
+            }
+            spheres = nullptr;
+            nodes = nullptr;
+            sphere_count = node_count = 0;
+        }
+};
+
+#endif
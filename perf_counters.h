@@ -0,0 +1,219 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+Hardware performance counters
+
+Reads the CPU's own counters (cycles, instructions, L1 data cache read misses, last level cache misses and branch
+misses) through Linux's perf_event_open, the same source `perf stat` uses, so a render can report them per phase
+without being run under perf by hand.
+
+Each counter is opened for this process with inherit set, so threads started later are counted too; a thread's
+counts are added to the process's when it exits, which is why a phase has to join its threads before it ends.
+Counters are read at phase boundaries only: traversal and shading interleave on every bounce, and splitting them
+would mean a syscall per hit, which would drown out what it measures. The render phase is normalized per ray
+instead, using ray_stats.
+
+Containers and locked down kernels (perf_event_paranoid, seccomp) often refuse some or all counters, and virtual
+machines may not expose the cache events. Counters that can't be opened are left out of the report; if none can,
+open() says why and the render goes on without them. Outside Linux open() always fails.
+*/
+
+enum perf_event_kind {
+    perf_cycles,
+    perf_instructions,
+    perf_l1d_misses,
+    perf_llc_misses,
+    perf_branch_misses,
+    perf_event_count
+};
+
+// raw counter readings at one point in time; two of them bracket a phase
+struct perf_sample {
+    uint64_t value[perf_event_count];
+    uint64_t enabled[perf_event_count];  // ns the counter was enabled, and running, for multiplexing
+    uint64_t running[perf_event_count];
+};
+
+class perf_counters {
+    public:
+        perf_counters() {
+            for (int e = 0; e < perf_event_count; ++e) {
+                fds[e] = -1;
+            }
+        }
+
+        ~perf_counters() { close(); }
+
+        perf_counters(const perf_counters&) = delete;
+        perf_counters& operator=(const perf_counters&) = delete;
+
+        // Open and start every counter the kernel will give us. False, with the reason, if it gives none.
+        bool open(std::string& error) {
+#ifdef __linux__
+            int first_errno = 0;
+            for (int e = 0; e < perf_event_count; ++e) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.inherit = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                event_config(static_cast<perf_event_kind>(e), attr);
+                fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                if (fds[e] < 0 && first_errno == 0) {
+                    first_errno = errno;
+                }
+            }
+            if (available()) {
+                return true;
+            }
+            error = std::string("perf_event_open: ") + std::strerror(first_errno);
+            if (first_errno == EACCES || first_errno == EPERM) {
+                error += " (check /proc/sys/kernel/perf_event_paranoid, or the container's seccomp profile)";
+            }
+            return false;
+#else
+            error = "hardware counters need Linux perf events";
+            return false;
+#endif
+        }
+
+        bool available() const {
+            for (int e = 0; e < perf_event_count; ++e) {
+                if (fds[e] >= 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool has(perf_event_kind e) const { return fds[e] >= 0; }
+
+        // current readings; zero for counters that aren't open
+        perf_sample read() const {
+            perf_sample s;
+            std::memset(&s, 0, sizeof(s));
+#ifdef __linux__
+            for (int e = 0; e < perf_event_count; ++e) {
+                uint64_t data[3];
+                if (fds[e] >= 0 && ::read(fds[e], data, sizeof(data)) == static_cast<ssize_t>(sizeof(data))) {
+                    s.value[e] = data[0];
+                    s.enabled[e] = data[1];
+                    s.running[e] = data[2];
+                }
+            }
+#endif
+            return s;
+        }
+
+        // Counts between two samples, scaled up for the time a counter was multiplexed out
+        static double delta(const perf_sample& begin, const perf_sample& end, perf_event_kind e) {
+            double value = static_cast<double>(end.value[e] - begin.value[e]);
+            uint64_t enabled = end.enabled[e] - begin.enabled[e];
+            uint64_t running = end.running[e] - begin.running[e];
+            if (running == 0) {
+                return 0;
+            }
+            return (running < enabled) ? value * static_cast<double>(enabled) / running : value;
+        }
+
+        // one line of totals for a phase, and if rays is non zero a second line of the same per ray
+        void print(std::ostream& out, const char* phase, const perf_sample& begin, const perf_sample& end, uint64_t rays = 0) const {
+            if (!available()) {
+                return;
+            }
+            out << "Counters (" << phase << "):";
+            print_values(out, begin, end, 1.0, "%.3g");
+            if (has(perf_cycles) && has(perf_instructions)) {
+                double cycles = delta(begin, end, perf_cycles);
+                char ipc[32];
+                std::snprintf(ipc, sizeof(ipc), ", %.2f IPC", cycles > 0 ? delta(begin, end, perf_instructions) / cycles : 0.0);
+                out << ipc;
+            }
+            out << '\n';
+            if (rays > 0) {
+                out << "Per ray (" << phase << "):";
+                print_values(out, begin, end, 1.0 / rays, "%.1f");
+                out << '\n';
+            }
+        }
+
+    private:
+        int fds[perf_event_count];
+
+        static const char* event_name(int e) {
+            static const char* names[perf_event_count] = {
+                "cycles", "instructions", "L1D misses", "LLC misses", "branch misses"
+            };
+            return names[e];
+        }
+
+        void print_values(std::ostream& out, const perf_sample& begin, const perf_sample& end, double scale, const char* format) const {
+            const char* separator = " ";
+            for (int e = 0; e < perf_event_count; ++e) {
+                if (!has(static_cast<perf_event_kind>(e))) {
+                    continue;
+                }
+                char number[32];
+                std::snprintf(number, sizeof(number), format, delta(begin, end, static_cast<perf_event_kind>(e)) * scale);
+                out << separator << number << ' ' << event_name(e);
+                separator = ", ";
+            }
+        }
+
+#ifdef __linux__
+        static void event_config(perf_event_kind e, perf_event_attr& attr) {
+            switch (e) {
+                case perf_cycles:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                    break;
+                case perf_instructions:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                    break;
+                case perf_l1d_misses:
+                    attr.type = PERF_TYPE_HW_CACHE;
+                    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                    break;
+                case perf_llc_misses:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                    break;
+                default:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                    break;
+            }
+        }
+#endif
+
+        void close() {
+#ifdef __linux__
+            for (int e = 0; e < perf_event_count; ++e) {
+                if (fds[e] >= 0) {
+                    ::close(fds[e]);
+                    fds[e] = -1;
+                }
+            }
+#endif
+        }
+};
+
+#endif
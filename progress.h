@@ -0,0 +1,153 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+Progress reporting
+
+Render threads only bump one atomic counter of finished samples (pixels times samples per pixel) when they finish a
+tile or a row, a relaxed fetch_add with no lock and no I/O. A reporter thread of its own wakes up twice a second,
+reads the counter and prints percent done, samples per second and the time left, so a slow terminal never holds
+up a render thread and nothing is written per scanline.
+
+progress_options.quiet drops the terminal line. progress_options.json_path, if set, gets one JSON object per line
+at the same rate, for job schedulers:
+
+    {"done": 0.4213, "samples": 1234567, "total": 2930400, "elapsed_s": 3.1, "samples_per_s": 398247, "eta_s": 4.3}
+
+and a last line with "done": 1.0000 and "finished": true once the render is complete. A render that gave up
+(a distributed one that ran out of workers) ends on "finished": false, "failed": true instead, with the fraction it
+really got done. "-" writes them to stderr.
+*/
+
+struct progress_options {
+    bool quiet = false;         // no progress line on the terminal
+    std::string json_path;      // JSON lines progress stream, "-" for stderr, empty for none
+    double interval_s = 0.5;    // time between reports
+};
+
+class progress_reporter {
+    public:
+        // Start reporting on a job of total samples; the reporter thread only runs if there's anywhere to report to
+        progress_reporter(uint64_t total, const progress_options& options)
+            : total(total), options(options), start(std::chrono::steady_clock::now()) {
+            if (!options.json_path.empty()) {
+                json = (options.json_path == "-") ? stderr : std::fopen(options.json_path.c_str(), "w");
+                if (json == nullptr) {
+                    std::cerr << "could not write " << options.json_path << '\n';
+                }
+            }
+            if (!options.quiet || json != nullptr) {
+                reporter = std::thread(&progress_reporter::run, this);
+            }
+        }
+
+        ~progress_reporter() { finish(); }
+
+        progress_reporter(const progress_reporter&) = delete;
+        progress_reporter& operator=(const progress_reporter&) = delete;
+
+        // count samples as finished; called by render threads, once per tile or row
+        void add(uint64_t samples) { done.fetch_add(samples, std::memory_order_relaxed); }
+
+        // Stop the reporter thread and write the last report, saying the job failed unless completed.
+        // Called by the destructor if not before.
+        void finish(bool completed = true) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (stopping) {
+                    return;
+                }
+                stopping = true;
+            }
+            wake.notify_all();
+            if (reporter.joinable()) {
+                reporter.join();
+            }
+            if (!options.quiet) {
+                std::clog << '\r' << std::string(line_width, ' ') << '\r' << std::flush;
+            }
+            if (json != nullptr) {
+                report_json(true, completed);
+                if (json != stderr) {
+                    std::fclose(json);
+                }
+                json = nullptr;
+            }
+        }
+
+    private:
+        uint64_t total;
+        progress_options options;
+        std::chrono::steady_clock::time_point start;
+        std::atomic<uint64_t> done{0};
+
+        std::thread reporter;
+        std::mutex lock;
+        std::condition_variable wake;
+        bool stopping = false;
+        FILE* json = nullptr;
+        size_t line_width = 0;
+
+        double elapsed() const {
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            return seconds.count();
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> guard(lock);
+            auto interval = std::chrono::duration<double>(options.interval_s);
+            while (!wake.wait_for(guard, interval, [this]() { return stopping; })) {
+                if (!options.quiet) {
+                    report_line();
+                }
+                if (json != nullptr) {
+                    report_json(false, false);
+                }
+            }
+        }
+
+        void report_line() {
+            uint64_t samples = done.load(std::memory_order_relaxed);
+            double seconds = elapsed();
+            double rate = (seconds > 0) ? samples / seconds : 0.0;
+            char line[128];
+            int n = std::snprintf(line, sizeof(line), "\rRendering %5.1f%%  %.3f M samples/s  ETA ",
+                                  total ? 100.0 * samples / total : 0.0, rate / 1e6);
+            if (samples > 0 && samples < total) {
+                long eta = static_cast<long>((total - samples) / rate + 0.5);
+                n += std::snprintf(line + n, sizeof(line) - n, "%ld:%02ld  ", eta / 60, eta % 60);
+            }
+            else {
+                n += std::snprintf(line + n, sizeof(line) - n, "-  ");
+            }
+            line_width = std::max(line_width, static_cast<size_t>(n));
+            std::clog << line << std::flush;
+        }
+
+        // last: the final line, which says whether the job completed
+        void report_json(bool last, bool completed) {
+            uint64_t samples = (last && completed) ? total : done.load(std::memory_order_relaxed);
+            double seconds = elapsed();
+            double rate = (seconds > 0) ? samples / seconds : 0.0;
+            double eta = (samples > 0 && samples < total) ? (total - samples) / rate : 0.0;
+            std::fprintf(json, "{\"done\": %.4f, \"samples\": %llu, \"total\": %llu, \"elapsed_s\": %.3f, \"samples_per_s\": %.0f, \"eta_s\": %.1f%s}\n",
+                         total ? static_cast<double>(samples) / total : 1.0,
+                         static_cast<unsigned long long>(samples), static_cast<unsigned long long>(total),
+                         seconds, rate, eta,
+                         !last ? "" : completed ? ", \"finished\": true" : ", \"finished\": false, \"failed\": true");
+            std::fflush(json);
+        }
+};
+
+#endif
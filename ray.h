@@ -7,10 +7,14 @@ class ray {
     public:
         ray() {}
 
-        ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction) {}
+        ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction), tm(0) {}
+
+        // time is when during the frame the ray is cast, between 0 and 1, for motion blur
+        ray(const point3& origin, const vec3& direction, double time) : orig(origin), dir(direction), tm(time) {}
 
         point3 origin() const { return orig; }
         vec3 direction() const { return dir; }
+        double time() const { return tm; }
 
         point3 at(double t) const {
             return orig + t*dir;
@@ -19,6 +23,7 @@ class ray {
     private:
         point3 orig;
         vec3 dir;
+        double tm;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#ifndef RAY_STATS_H
+#define RAY_STATS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+
+/*
+Ray statistics
+
+Counts what a render does: camera, scattered and shadow rays, BVH nodes visited, primitives tested and hit, and how
+paths end (absorbed by a material, cut off at max_depth, or escaping to the sky).
+
+Every thread counts into its own thread_local block, so counting is a plain increment with no atomics and no
+shared cache lines. When a thread is done it flushes its block into the process wide total (one mutex lock per
+thread, not per count); ray_stats::total() flushes the calling thread and returns the sum.
+
+Build with RAY_STATS defined to 0 (cmake -DRAY_STATS=OFF) and every RAY_STAT() expands to nothing, leaving the
+hot paths exactly as they'd be without any of this.
+*/
+
+#ifndef RAY_STATS
+#define RAY_STATS 1
+#endif
+
+struct ray_counters {
+    uint64_t primary_rays;     // camera rays
+    uint64_t secondary_rays;   // rays scattered off surfaces
+    uint64_t shadow_rays;      // visibility rays towards sampled lights
+    uint64_t node_visits;      // BVH nodes visited
+    uint64_t primitive_tests;  // ray against sphere or triangle
+    uint64_t primitive_hits;   // ... that found a closer intersection
+    uint64_t surface_hits;     // camera and secondary rays that hit something
+    uint64_t scatter_absorbs;  // paths ended by a material not scattering
+    uint64_t depth_limits;     // paths cut off at max_depth
+    uint64_t sky_escapes;      // paths that left the scene
+
+    uint64_t rays() const { return primary_rays + secondary_rays + shadow_rays; }
+
+    void add(const ray_counters& other) {
+        primary_rays += other.primary_rays;
+        secondary_rays += other.secondary_rays;
+        shadow_rays += other.shadow_rays;
+        node_visits += other.node_visits;
+        primitive_tests += other.primitive_tests;
+        primitive_hits += other.primitive_hits;
+        surface_hits += other.surface_hits;
+        scatter_absorbs += other.scatter_absorbs;
+        depth_limits += other.depth_limits;
+        sky_escapes += other.sky_escapes;
+    }
+};
+
+#if RAY_STATS
+
+// this thread's counters; plain data, so it's zeroed when the thread starts without any constructor to run
+inline ray_counters& thread_ray_counters() {
+    static thread_local ray_counters counters = {};
+    return counters;
+}
+
+#define RAY_STAT(counter) (++thread_ray_counters().counter)
+#define RAY_STAT_ADD(counter, n) (thread_ray_counters().counter += (n))
+
+#else
+
+#define RAY_STAT(counter) ((void)0)
+#define RAY_STAT_ADD(counter, n) ((void)0)
+
+#endif
+
+class ray_stats {
+    public:
+        static bool enabled() { return RAY_STATS != 0; }
+
+        // BVH node visits plus primitive tests the calling thread has counted so far, 0 without ray statistics
+        static uint64_t thread_work() {
+#if RAY_STATS
+            const ray_counters& mine = thread_ray_counters();
+            return mine.node_visits + mine.primitive_tests;
+#else
+            return 0;
+#endif
+        }
+
+        // Move the calling thread's counts into the total. Threads that trace rays call this before they finish.
+        static void flush() {
+#if RAY_STATS
+            ray_counters& mine = thread_ray_counters();
+            std::lock_guard<std::mutex> guard(lock());
+            sum().add(mine);
+            mine = ray_counters();
+#endif
+        }
+
+        // everything counted so far, by threads that have flushed and the calling one
+        static ray_counters total() {
+            flush();
+            std::lock_guard<std::mutex> guard(lock());
+            return sum();
+        }
+
+        // start counting from zero (the calling thread's and the flushed counts)
+        static void reset() {
+#if RAY_STATS
+            thread_ray_counters() = ray_counters();
+#endif
+            std::lock_guard<std::mutex> guard(lock());
+            sum() = ray_counters();
+        }
+
+        // human readable summary; seconds, if positive, adds rays per second
+        static void print(std::ostream& out, const ray_counters& c, double seconds = 0) {
+            if (!enabled()) {
+                return;
+            }
+            char line[160];
+            std::snprintf(line, sizeof(line), "Rays: %llu (%llu camera, %llu scattered, %llu shadow)",
+                          ull(c.rays()), ull(c.primary_rays), ull(c.secondary_rays), ull(c.shadow_rays));
+            out << line;
+            if (seconds > 0) {
+                std::snprintf(line, sizeof(line), ", %.3f M rays/s", c.rays() / seconds / 1e6);
+                out << line;
+            }
+            double per_ray = c.rays() ? 1.0 / c.rays() : 0.0;
+            std::snprintf(line, sizeof(line), "\nTraversal: %llu node visits, %llu primitive tests, %llu primitive hits (%.1f, %.1f, %.2f per ray)\n",
+                          ull(c.node_visits), ull(c.primitive_tests), ull(c.primitive_hits),
+                          c.node_visits * per_ray, c.primitive_tests * per_ray, c.primitive_hits * per_ray);
+            out << line;
+            std::snprintf(line, sizeof(line), "Paths: %llu surface hits; ended by %llu absorbs, %llu at max depth, %llu sky escapes\n",
+                          ull(c.surface_hits), ull(c.scatter_absorbs), ull(c.depth_limits), ull(c.sky_escapes));
+            out << line;
+        }
+
+    private:
+        static unsigned long long ull(uint64_t v) { return static_cast<unsigned long long>(v); }
+
+        static std::mutex& lock() {
+            static std::mutex m;
+            return m;
+        }
+
+        static ray_counters& sum() {
+            static ray_counters total = {};
+            return total;
+        }
+};
+
+#endif
@@ -0,0 +1,472 @@
+#include "rtweekend.h"
+
+#include "bench_scenes.h"
+#include "camera.h"
+#include "color.h"
+#include "cpu_dispatch.h"
+#include "hittable_list.h"
+#include "json.h"
+#include "lights.h"
+#include "packed_scene.h"
+#include "progress.h"
+#include "ray_stats.h"
+#include "sampler.h"
+#include "scene_file.h"
+#include "tile_renderer.h"
+#include "trace.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+End to end render benchmark
+
+Renders the reference scenes of bench_scenes.h and reports, per scene, how long building the scene and its BVH took,
+the wall time of each render, camera rays per second (from the median render) and the peak resident memory
+while building and rendering it. With ray statistics compiled in (ray_stats.h) it also has the counters of one
+render and the rate of all rays traced, scattered and shadow rays included. Results go out as JSON, to stdout or --json FILE; a readable table goes to stderr.
+
+The scenes are fixed, and the default sobol sampler makes the images independent of the thread count, so two result
+files made with the same settings measure exactly the same work, and --compare can tell whether a change made
+it slower.
+
+Usage:
+    render_bench [--scenes NAME,NAME,...] [--width W] [--spp N] [--threads T] [--tile SIZE] [--repeat R]
+                 [--sampler NAME] [--json FILE] [--images DIR] [--trace FILE] [--quiet]
+    render_bench --list
+    render_bench --compare BASE.json NEW.json [--tolerance PERCENT]
+
+    --scenes      which scenes to render, all of them by default (see --list)
+    --width       image width, the height follows from the scene's aspect ratio (default 320)
+    --spp         samples per pixel (default 16)
+    --threads     render threads, 0 for one per hardware thread (default 0)
+    --tile        tile side in pixels (default 32)
+    --repeat      renders per scene, the median counts (default 3)
+    --sampler     independent, stratified, sobol or blue_noise (default sobol)
+    --images      also write each scene's image as DIR/NAME.ppm
+    --quiet       no progress line while a scene renders
+    --trace       record a timeline of every scene build and render, with a lane per render thread showing each
+                  tile it took, in Chrome's trace event format (chrome://tracing or ui.perfetto.dev)
+    --compare     compare two result files scene by scene; a scene whose rays per second dropped, or whose build time
+                  or peak memory grew, by more than the tolerance (default 5%) is a regression, and the exit status is 1.
+                  Scenes rendered with different settings are reported as not comparable.
+*/
+
+struct bench_settings {
+    std::vector<std::string> scenes;
+    int width = 320;
+    int spp = 16;
+    int threads = 0;
+    int tile = 32;
+    int repeat = 3;
+    sampler_type sampling = sampler_sobol;
+    std::string images;
+    progress_options progress;
+};
+
+struct bench_result {
+    std::string name;
+    size_t spheres = 0;
+    int width = 0, height = 0, spp = 0, threads = 0;
+    double build_ms = 0;
+    std::vector<double> wall_ms;
+    double median_ms = 0;
+    double camera_rays = 0;
+    double rays_per_second = 0;
+    ray_counters counters = {};    // of one render, if ray statistics are compiled in
+    double all_rays_per_second = 0; // camera, scattered and shadow rays
+    long peak_rss_kb = 0;
+};
+
+// Start measuring peak memory from here: Linux resets the process's high water mark (VmHWM) on writing 5 to
+// clear_refs, so each scene gets its own peak rather than the largest of all scenes run so far
+static void reset_peak_rss() {
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+}
+
+// largest resident set size of this process since reset_peak_rss(), or ever where that isn't supported, in kilobytes
+static long peak_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::atol(line.c_str() + 6);
+        }
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static bool run_scene(const std::string& name, const bench_settings& settings, bench_result& result) {
+    reset_peak_rss();
+
+    // build: the scene description, then the BVH and materials
+    auto build_start = std::chrono::steady_clock::now();
+    scene_description scene;
+    auto spheres = make_shared<packed_scene>();
+    {
+        TRACE_SCOPE("build scene", "scene");
+        if (!build_bench_scene(name, scene)) {
+            return false;
+        }
+        spheres->adopt(scene);
+    }
+    result.build_ms = milliseconds_since(build_start);
+
+    hittable_list world;
+    world.add(spheres);
+    light_list lights;
+    spheres->add_lights(lights);
+
+    camera cam = scene.cam;
+    cam.image_width = settings.width;
+    cam.samples_per_pixel = settings.spp;
+    cam.sampling = settings.sampling;
+    if (!lights.empty()) {
+        cam.lights = &lights;
+    }
+
+    tile_renderer renderer;
+    renderer.threads = settings.threads;
+    renderer.tile_size = settings.tile;
+
+    result.name = name;
+    result.spheres = spheres->size();
+    result.width = cam.image_width;
+    result.height = cam.get_image_height();
+    result.spp = cam.samples_per_pixel;
+    result.threads = renderer.thread_count();
+
+    // one progress line for all of the scene's renders
+    progress_reporter reporter(cam.total_samples() * settings.repeat, settings.progress);
+    std::vector<float> framebuffer;
+    for (int k = 0; k < settings.repeat; ++k) {
+        ray_stats::reset();
+        auto render_start = std::chrono::steady_clock::now();
+        {
+            TRACE_SCOPE("render", "render");
+            renderer.render(cam, world, framebuffer, &reporter);
+        }
+        result.wall_ms.push_back(milliseconds_since(render_start));
+        // every repeat traces the same rays (unless the sampler is independent), the first one's counts will do
+        if (k == 0) {
+            result.counters = ray_stats::total();
+        }
+    }
+    reporter.finish();
+
+    std::vector<double> sorted = result.wall_ms;
+    std::sort(sorted.begin(), sorted.end());
+    result.median_ms = sorted[sorted.size() / 2];
+    result.camera_rays = static_cast<double>(result.width) * result.height * result.spp;
+    result.rays_per_second = (result.median_ms > 0) ? result.camera_rays / (result.median_ms / 1000) : 0;
+    result.peak_rss_kb = peak_rss_kb();
+    result.all_rays_per_second = (result.median_ms > 0) ? result.counters.rays() / (result.median_ms / 1000) : 0;
+
+    if (!settings.images.empty()) {
+        std::string path = settings.images + "/" + name + ".ppm";
+        std::ofstream out(path.c_str());
+        write_ppm(out, framebuffer.data(), result.width, result.height, result.spp);
+        if (!out) {
+            std::cerr << "could not write " << path << '\n';
+        }
+    }
+    return true;
+}
+
+static std::string results_json(const bench_settings& settings, const std::vector<bench_result>& results) {
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"format\": \"render_bench\",\n";
+    out << "  \"version\": 1,\n";
+#if defined(__VERSION__)
+    out << "  \"compiler\": " << json_quote(__VERSION__) << ",\n";
+#endif
+#if defined(__OPTIMIZE__)
+    out << "  \"optimized\": true,\n";
+#else
+    out << "  \"optimized\": false,\n";
+#endif
+    out << "  \"isa\": " << json_quote(cpu_isa_name(selected_cpu_isa())) << ",\n";
+#if defined(RENDER_BUILD)
+    out << "  \"build\": " << json_quote(RENDER_BUILD) << ",\n";
+#endif
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"sampler\": " << json_quote(sampler_name(settings.sampling)) << ",\n";
+    out << "  \"tile\": " << settings.tile << ",\n";
+    out << "  \"scenes\": [";
+    for (size_t k = 0; k < results.size(); ++k) {
+        const bench_result& r = results[k];
+        out << (k ? ",\n" : "\n") << "    {\n";
+        out << "      \"name\": " << json_quote(r.name) << ",\n";
+        out << "      \"spheres\": " << r.spheres << ",\n";
+        out << "      \"width\": " << r.width << ",\n";
+        out << "      \"height\": " << r.height << ",\n";
+        out << "      \"spp\": " << r.spp << ",\n";
+        out << "      \"threads\": " << r.threads << ",\n";
+        out << "      \"build_ms\": " << json_number(r.build_ms) << ",\n";
+        out << "      \"wall_ms\": [";
+        for (size_t i = 0; i < r.wall_ms.size(); ++i) {
+            out << (i ? ", " : "") << json_number(r.wall_ms[i]);
+        }
+        out << "],\n";
+        out << "      \"median_ms\": " << json_number(r.median_ms) << ",\n";
+        out << "      \"camera_rays\": " << json_number(r.camera_rays) << ",\n";
+        out << "      \"rays_per_second\": " << json_number(r.rays_per_second) << ",\n";
+        if (ray_stats::enabled()) {
+            const ray_counters& c = r.counters;
+            out << "      \"all_rays_per_second\": " << json_number(r.all_rays_per_second) << ",\n";
+            out << "      \"counters\": { \"primary_rays\": " << c.primary_rays << ", \"secondary_rays\": " << c.secondary_rays
+                << ", \"shadow_rays\": " << c.shadow_rays << ", \"node_visits\": " << c.node_visits
+                << ", \"primitive_tests\": " << c.primitive_tests << ", \"primitive_hits\": " << c.primitive_hits
+                << ", \"surface_hits\": " << c.surface_hits << ", \"scatter_absorbs\": " << c.scatter_absorbs
+                << ", \"depth_limits\": " << c.depth_limits << ", \"sky_escapes\": " << c.sky_escapes << " },\n";
+        }
+        out << "      \"peak_rss_kb\": " << r.peak_rss_kb << "\n";
+        out << "    }";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+static bool load_results(const std::string& path, json_value& results) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        std::cerr << "could not read " << path << '\n';
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    std::string error;
+    json_parser parser;
+    if (!parser.parse(text.str(), results, error)) {
+        std::cerr << path << ": " << error << '\n';
+        return false;
+    }
+    if (results["format"].string_or("") != "render_bench" || !results["scenes"].is_array()) {
+        std::cerr << path << ": not a render_bench result file\n";
+        return false;
+    }
+    return true;
+}
+
+// change from base to now in percent, positive means more
+static double percent_change(double base, double now) {
+    return (base > 0) ? 100.0 * (now - base) / base : 0.0;
+}
+
+// Compare two result files, 0 if nothing got worse, 1 if something did, 2 if they couldn't be read
+static int compare_results(const std::string& base_path, const std::string& new_path, double tolerance) {
+    json_value base, now;
+    if (!load_results(base_path, base) || !load_results(new_path, now)) {
+        return 2;
+    }
+    if (base["sampler"].string_or("") != now["sampler"].string_or("")) {
+        std::cerr << "warning: different samplers, " << base["sampler"].string_or("?") << " and " << now["sampler"].string_or("?") << '\n';
+    }
+
+    std::printf("%-16s %14s %14s %8s %9s %9s   %s\n", "scene", "base rays/s", "new rays/s", "change", "build", "peak rss", "verdict");
+    int regressions = 0;
+    for (const json_value& n : now["scenes"].array) {
+        std::string name = n["name"].string_or("");
+        const json_value* b = nullptr;
+        for (const json_value& candidate : base["scenes"].array) {
+            if (candidate["name"].string_or("") == name) {
+                b = &candidate;
+            }
+        }
+        if (b == nullptr) {
+            std::printf("%-16s %14s %14.0f %8s %9s %9s   new scene\n", name.c_str(), "-", n["rays_per_second"].number_or(0), "", "", "");
+            continue;
+        }
+
+        const char* same[] = { "width", "height", "spp", "threads" };
+        bool comparable = true;
+        for (const char* key : same) {
+            comparable = comparable && (*b)[key].number_or(-1) == n[key].number_or(-1);
+        }
+
+        double rays = percent_change((*b)["rays_per_second"].number_or(0), n["rays_per_second"].number_or(0));
+        double build = percent_change((*b)["build_ms"].number_or(0), n["build_ms"].number_or(0));
+        double memory = percent_change((*b)["peak_rss_kb"].number_or(0), n["peak_rss_kb"].number_or(0));
+        // tiny build times and memory changes are noise, whatever the percentage
+        double build_change_ms = n["build_ms"].number_or(0) - (*b)["build_ms"].number_or(0);
+        double memory_change_kb = n["peak_rss_kb"].number_or(0) - (*b)["peak_rss_kb"].number_or(0);
+
+        std::string verdict;
+        if (!comparable) {
+            verdict = "not comparable (different width, height, spp or threads)";
+        }
+        else {
+            if (rays < -tolerance) {
+                verdict += "SLOWER ";
+            }
+            if (build > tolerance && build_change_ms > 1.0) {
+                verdict += "BUILD SLOWER ";
+            }
+            if (memory > tolerance && memory_change_kb > 1024) {
+                verdict += "MORE MEMORY ";
+            }
+            if (!verdict.empty()) {
+                verdict.pop_back(); // the trailing space
+                ++regressions;
+            }
+            else {
+                verdict = (rays > tolerance) ? "faster" : "ok";
+            }
+        }
+
+        std::printf("%-16s %14.0f %14.0f %+7.1f%% %+8.1f%% %+8.1f%%   %s\n", name.c_str(),
+                    (*b)["rays_per_second"].number_or(0), n["rays_per_second"].number_or(0), rays, build, memory, verdict.c_str());
+    }
+
+    if (regressions > 0) {
+        std::printf("%d regression%s beyond %.1f%%\n", regressions, regressions == 1 ? "" : "s", tolerance);
+        return 1;
+    }
+    std::printf("no regressions beyond %.1f%%\n", tolerance);
+    return 0;
+}
+
+static std::vector<std::string> split_names(const std::string& list) {
+    std::vector<std::string> names;
+    std::string::size_type begin = 0;
+    while (begin <= list.size()) {
+        std::string::size_type end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > begin) {
+            names.push_back(list.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return names;
+}
+
+int main(int argc, char* argv[]) {
+    bench_settings settings;
+    std::string json_path;
+    std::string trace_path;
+    std::string compare_base, compare_new;
+    double tolerance = 5.0;
+
+    for (int a = 1; a < argc; ++a) {
+        bool has_value = a + 1 < argc;
+        if (std::strcmp(argv[a], "--scenes") == 0 && has_value) {
+            settings.scenes = split_names(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--width") == 0 && has_value) {
+            settings.width = std::max(1, std::atoi(argv[++a]));
+        }
+        else if (std::strcmp(argv[a], "--spp") == 0 && has_value) {
+            settings.spp = std::max(1, std::atoi(argv[++a]));
+        }
+        else if (std::strcmp(argv[a], "--threads") == 0 && has_value) {
+            settings.threads = std::max(0, std::atoi(argv[++a]));
+        }
+        else if (std::strcmp(argv[a], "--tile") == 0 && has_value) {
+            settings.tile = std::max(1, std::atoi(argv[++a]));
+        }
+        else if (std::strcmp(argv[a], "--repeat") == 0 && has_value) {
+            settings.repeat = std::max(1, std::atoi(argv[++a]));
+        }
+        else if (std::strcmp(argv[a], "--sampler") == 0 && has_value) {
+            if (!sampler_from_name(argv[++a], settings.sampling)) {
+                std::cerr << "unknown sampler '" << argv[a] << "', expected independent, stratified, sobol or blue_noise\n";
+                return 2;
+            }
+        }
+        else if (std::strcmp(argv[a], "--json") == 0 && has_value) {
+            json_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--images") == 0 && has_value) {
+            settings.images = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--quiet") == 0) {
+            settings.progress.quiet = true;
+        }
+        else if (std::strcmp(argv[a], "--trace") == 0 && has_value) {
+            trace_path = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--compare") == 0 && a + 2 < argc) {
+            compare_base = argv[++a];
+            compare_new = argv[++a];
+        }
+        else if (std::strcmp(argv[a], "--tolerance") == 0 && has_value) {
+            tolerance = std::atof(argv[++a]);
+        }
+        else if (std::strcmp(argv[a], "--list") == 0) {
+            for (const auto& name : bench_scene_names()) {
+                std::cout << name << '\n';
+            }
+            return 0;
+        }
+        else {
+            std::cerr << "unknown or incomplete argument: " << argv[a] << '\n';
+            return 2;
+        }
+    }
+
+    if (!compare_base.empty()) {
+        return compare_results(compare_base, compare_new, tolerance);
+    }
+
+    if (settings.scenes.empty()) {
+        settings.scenes = bench_scene_names();
+    }
+    for (const auto& name : settings.scenes) {
+        if (std::find(bench_scene_names().begin(), bench_scene_names().end(), name) == bench_scene_names().end()) {
+            std::cerr << "unknown scene '" << name << "', see --list\n";
+            return 2;
+        }
+    }
+
+    if (!trace_path.empty()) {
+        trace_recorder::get().start();
+    }
+    std::vector<bench_result> results;
+    std::fprintf(stderr, "%-16s %9s %10s %11s %14s %14s %10s\n", "scene", "spheres", "build ms", "median ms", "rays/s", "all rays/s", "peak rss");
+    for (const auto& name : settings.scenes) {
+        bench_result result;
+        run_scene(name, settings, result);
+        std::fprintf(stderr, "%-16s %9zu %10.2f %11.1f %14.0f %14.0f %7ld MB\n", name.c_str(), result.spheres,
+                     result.build_ms, result.median_ms, result.rays_per_second, result.all_rays_per_second, result.peak_rss_kb / 1024);
+        results.push_back(result);
+    }
+    if (!trace_path.empty() && !trace_recorder::get().write(trace_path)) {
+        std::cerr << "could not write " << trace_path << '\n';
+        return 2;
+    }
+
+    std::string json = results_json(settings, results);
+    if (json_path.empty()) {
+        std::cout << json;
+        return 0;
+    }
+    std::ofstream out(json_path.c_str());
+    out << json;
+    if (!out) {
+        std::cerr << "could not write " << json_path << '\n';
+        return 2;
+    }
+    return 0;
+}
@@ -2,9 +2,11 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include <random>
 
 // Usings
 using std::shared_ptr;
@@ -20,9 +22,20 @@ inline double degrees_to_radians(double degrees) {
     return degrees * (pi / 180.0);
 }
 
+// each thread draws from a generator of its own, so threads neither contend for it nor change each other's numbers
+inline std::mt19937& random_generator() {
+    static thread_local std::mt19937 generator;
+    return generator;
+}
+
+// restart this thread's random_double() sequence
+inline void seed_random(uint32_t seed) {
+    random_generator().seed(seed);
+}
+
 inline double random_double() {
     // return a random real in [0,1)
-    return rand() / (RAND_MAX + 1.0);
+    return random_generator()() * (1.0 / 4294967296.0);
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,413 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rtweekend.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+Samplers
+
+Every random decision made for one sample of a pixel (where in the pixel, where on the lens, when during the shutter,
+which light and where on it, ...) is a "dimension", and a sampler hands out the numbers for them in a fixed order.
+Independent uniform numbers are the simplest choice but converge the slowest, since nothing stops two samples
+of a pixel from landing right next to each other. The other samplers spread each pixel's samples evenly over
+every dimension:
+
+    independent   uniform numbers hashed from the pixel, the sample index and the dimension
+    stratified    correlated multi-jittered sampling (Kensler 2013): 2D stratified and 1D stratified per axis,
+                  over an m x n grid with m * n exactly the sample count
+    sobol         Sobol points with Owen scrambling, hashed per pixel (Burley 2020, "Practical Hash-based Owen Scrambling")
+    blue_noise    the same Sobol points for every pixel, each pixel offset by a blue noise mask, so the remaining
+                  error looks like fine high-frequency grain instead of blotches, which is far less visible at low spp
+
+Each pair of dimensions gets its own shuffled, scrambled 2D point set (padding), so dimensions don't correlate.
+The sample index is the pixel's global sample number, so sample ranges rendered apart (distributed mode)
+still add up to the same well distributed set. No sampler keeps state between samples or shares any between
+threads: the numbers depend on nothing but the pixel, the sample and the dimension, so an image comes out the
+same for any thread count or tile order.
+
+Dimension order for a camera sample: pixel (2D), lens (2D), time (1D, only with an open shutter), then per bounce
+the scattered direction (2D), the light choice (1D) and the point on the light (2D).
+*/
+
+enum sampler_type : uint32_t {
+    sampler_independent = 0,
+    sampler_stratified  = 1,
+    sampler_sobol       = 2,
+    sampler_blue_noise  = 3
+};
+
+inline bool sampler_from_name(const std::string& name, sampler_type& type) {
+    if (name == "independent") type = sampler_independent;
+    else if (name == "stratified") type = sampler_stratified;
+    else if (name == "sobol") type = sampler_sobol;
+    else if (name == "blue_noise") type = sampler_blue_noise;
+    else return false;
+    return true;
+}
+
+inline const char* sampler_name(sampler_type type) {
+    switch (type) {
+        case sampler_stratified: return "stratified";
+        case sampler_sobol:      return "sobol";
+        case sampler_blue_noise: return "blue_noise";
+        default:                 return "independent";
+    }
+}
+
+// integer hashes that the samplers build their per pixel, per dimension randomness from
+inline uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+    return seed ^ (hash_u32(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+class sampler {
+    public:
+        virtual ~sampler() = default;
+
+        // begin sample `index` of pixel (x, y); dimensions are handed out in order from here
+        void start(int x, int y, int index) {
+            px = static_cast<uint32_t>(x);
+            py = static_cast<uint32_t>(y);
+            sample_index = static_cast<uint32_t>(index);
+            dimension = 0;
+        }
+
+        virtual double get_1d() = 0;
+        virtual void get_2d(double& u, double& v) = 0;
+
+    protected:
+        uint32_t px = 0, py = 0;
+        uint32_t sample_index = 0;
+        uint32_t dimension = 0; // next dimension to hand out
+
+        // seed unique to this pixel and the dimension about to be used
+        uint32_t pixel_seed() const {
+            return hash_combine(hash_combine(hash_u32(px), py), dimension);
+        }
+};
+
+class independent_sampler : public sampler {
+    public:
+        // renders with different seeds share no sample points
+        independent_sampler(uint32_t seed = 0) : seed(seed) {}
+
+        double get_1d() override {
+            return next();
+        }
+
+        void get_2d(double& u, double& v) override {
+            u = next();
+            v = next();
+        }
+
+    private:
+        uint32_t seed;
+
+        double next() {
+            uint32_t h = hash_u32(hash_combine(hash_combine(pixel_seed(), sample_index), seed));
+            ++dimension;
+            return h * (1.0 / 4294967296.0);
+        }
+};
+
+/*
+Correlated multi-jittered sampling, Kensler 2013, "Correlated Multi-Jittered Sampling"
+
+The m x n grid has exactly count cells, m the largest divisor of count up to its square root, so every cell
+gets one sample and the points stay uniform over the square. A grid with cells left over isn't: the empty
+cells are always at the same end, which biased v at 10 spp (mean 0.42). Counts with no such divisor (primes)
+get a 1 x count grid, where this is plain jittering in count strata along each axis (Latin hypercube).
+*/
+class stratified_sampler : public sampler {
+    public:
+        stratified_sampler(int samples_per_pixel) : count(samples_per_pixel < 1 ? 1 : samples_per_pixel) {
+            m = static_cast<uint32_t>(std::sqrt(static_cast<double>(count)));
+            while (m > 1 && count % m != 0) {
+                --m;
+            }
+            if (m < 1) m = 1;
+            n = count / m;
+        }
+
+        double get_1d() override {
+            uint32_t seed = pixel_seed();
+            ++dimension;
+            uint32_t s = permute(sample_index % count, count, seed * 0x68bc21ebu);
+            return (s + rand_float(sample_index, seed * 0x967a889bu)) / count;
+        }
+
+        void get_2d(double& u, double& v) override {
+            uint32_t seed = pixel_seed();
+            dimension += 2;
+            uint32_t s = permute(sample_index % count, count, seed * 0x51633e2du);
+            uint32_t sx = permute(s % m, m, seed * 0xa511e9b3u);
+            uint32_t sy = permute(s / m, n, seed * 0x63d83595u);
+            double jx = rand_float(s, seed * 0xa399d265u);
+            double jy = rand_float(s, seed * 0x711ad6a5u);
+            u = (s % m + (sy + jx) / n) / m;
+            v = (s / m + (sx + jy) / m) / n;
+        }
+
+    private:
+        uint32_t count, m, n;
+
+        // random permutation of [0, l) picked by p, without storing it
+        static uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+            if (l <= 1) {
+                return 0;
+            }
+            uint32_t w = l - 1;
+            w |= w >> 1;
+            w |= w >> 2;
+            w |= w >> 4;
+            w |= w >> 8;
+            w |= w >> 16;
+            do {
+                i ^= p; i *= 0xe170893du;
+                i ^= p >> 16; i ^= (i & w) >> 4;
+                i ^= p >> 8; i *= 0x0929eb3fu;
+                i ^= p >> 23; i ^= (i & w) >> 1;
+                i *= 1 | p >> 27; i *= 0x6935fa69u;
+                i ^= (i & w) >> 11; i *= 0x74dcb303u;
+                i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+                i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+                i &= w;
+                i ^= i >> 5;
+            } while (i >= l);
+            return (i + p) % l;
+        }
+
+        static double rand_float(uint32_t i, uint32_t p) {
+            i ^= p;
+            i ^= i >> 17;
+            i ^= i >> 10;
+            i *= 0xb36534e5u;
+            i ^= i >> 12;
+            i ^= i >> 21;
+            i *= 0x93fc4795u;
+            i ^= 0xdf6e307fu;
+            i ^= i >> 17;
+            i *= 1 | p >> 18;
+            return i * (1.0 / 4294967296.0);
+        }
+};
+
+// The first two Sobol dimensions, as 32 bit fixed point, and Owen scrambling by hashing (Burley 2020)
+class sobol_points {
+    public:
+        static uint32_t reverse_bits(uint32_t x) {
+            x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+            x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+            x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+            x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+            return (x >> 16) | (x << 16);
+        }
+
+        // Owen scrambling: a random flip of every bit that depends on all the bits above it
+        static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+            x = reverse_bits(x);
+            x += seed;
+            x ^= x * 0x6c50b47cu;
+            x ^= x * 0xb82f1e52u;
+            x ^= x * 0xc7afe638u;
+            x ^= x * 0x8d22f6e6u;
+            return reverse_bits(x);
+        }
+
+        // point `index` of a 2D Owen scrambled Sobol set, with the index order shuffled too, picked by seed
+        static void scrambled_2d(uint32_t index, uint32_t seed, double& u, double& v) {
+            index = nested_uniform_scramble(index, seed);
+            uint32_t x = nested_uniform_scramble(dimension0(index), hash_combine(seed, 0));
+            uint32_t y = nested_uniform_scramble(dimension1(index), hash_combine(seed, 1));
+            u = to_unit(x);
+            v = to_unit(y);
+        }
+
+        static double to_unit(uint32_t x) {
+            return x * (1.0 / 4294967296.0);
+        }
+
+    private:
+        // van der Corput
+        static uint32_t dimension0(uint32_t index) {
+            return reverse_bits(index);
+        }
+
+        // second Sobol dimension, direction numbers v_k = v_{k-1} ^ (v_{k-1} >> 1)
+        static uint32_t dimension1(uint32_t index) {
+            uint32_t result = 0;
+            uint32_t direction = 0x80000000u;
+            for (; index != 0; index >>= 1) {
+                if (index & 1) {
+                    result ^= direction;
+                }
+                direction ^= direction >> 1;
+            }
+            return result;
+        }
+};
+
+class sobol_sampler : public sampler {
+    public:
+        double get_1d() override {
+            uint32_t seed = pixel_seed();
+            ++dimension;
+            uint32_t index = sobol_points::nested_uniform_scramble(sample_index, seed);
+            return sobol_points::to_unit(sobol_points::nested_uniform_scramble(sobol_points::reverse_bits(index), hash_combine(seed, 2)));
+        }
+
+        void get_2d(double& u, double& v) override {
+            uint32_t seed = pixel_seed();
+            dimension += 2;
+            sobol_points::scrambled_2d(sample_index, seed, u, v);
+        }
+};
+
+/*
+Blue noise dithered Sobol. Every pixel uses the same scrambled Sobol points for a given dimension, shifted
+(modulo 1) by a value from a 64x64 blue noise mask, so neighbouring pixels get very different shifts.
+The mask is made once with the void and cluster method (Ulichney 1993).
+*/
+class blue_noise_sampler : public sampler {
+    public:
+        double get_1d() override {
+            uint32_t seed = hash_u32(dimension);
+            ++dimension;
+            uint32_t index = sobol_points::nested_uniform_scramble(sample_index, seed);
+            double x = sobol_points::to_unit(sobol_points::nested_uniform_scramble(sobol_points::reverse_bits(index), hash_combine(seed, 2)));
+            return wrap(x + mask_value(seed));
+        }
+
+        void get_2d(double& u, double& v) override {
+            uint32_t seed = hash_u32(dimension);
+            dimension += 2;
+            sobol_points::scrambled_2d(sample_index, seed, u, v);
+            u = wrap(u + mask_value(seed));
+            v = wrap(v + mask_value(hash_u32(seed)));
+        }
+
+    private:
+        static const int mask_size = 64;
+
+        static double wrap(double x) {
+            return (x >= 1) ? x - 1 : x;
+        }
+
+        // this pixel's mask value, with the mask shifted by an offset that depends on seed so dimensions differ
+        double mask_value(uint32_t seed) const {
+            static const std::vector<float> mask = make_mask();
+            uint32_t x = (px + (seed & 63)) % mask_size;
+            uint32_t y = (py + ((seed >> 6) & 63)) % mask_size;
+            return mask[y * mask_size + x];
+        }
+
+        static std::vector<float> make_mask() {
+            const int n = mask_size * mask_size;
+            const double sigma = 1.5;
+
+            // toroidal gaussian splat every set pixel adds to the energy of the others
+            std::vector<double> kernel(n);
+            for (int dy = 0; dy < mask_size; ++dy) {
+                for (int dx = 0; dx < mask_size; ++dx) {
+                    int ex = std::min(dx, mask_size - dx), ey = std::min(dy, mask_size - dy);
+                    kernel[dy * mask_size + dx] = std::exp(-(ex*ex + ey*ey) / (2 * sigma * sigma));
+                }
+            }
+
+            std::vector<bool> on(n, false);
+            std::vector<double> energy(n, 0.0);
+            auto toggle = [&](int p) {
+                on[p] = !on[p];
+                double sign = on[p] ? 1.0 : -1.0;
+                int px0 = p % mask_size, py0 = p / mask_size;
+                for (int y = 0; y < mask_size; ++y) {
+                    int dy = (y - py0 + mask_size) % mask_size;
+                    for (int x = 0; x < mask_size; ++x) {
+                        int dx = (x - px0 + mask_size) % mask_size;
+                        energy[y * mask_size + x] += sign * kernel[dy * mask_size + dx];
+                    }
+                }
+            };
+            // tightest cluster: the set pixel with the most energy; largest void: the empty one with the least
+            auto extreme = [&](bool want_on) {
+                int best = -1;
+                for (int p = 0; p < n; ++p) {
+                    if (on[p] == want_on && (best < 0 || (want_on ? energy[p] > energy[best] : energy[p] < energy[best]))) {
+                        best = p;
+                    }
+                }
+                return best;
+            };
+
+            // initial pattern: a tenth of the pixels, relaxed until moving the tightest cluster doesn't change anything
+            uint32_t state = 12345;
+            int initial = n / 10;
+            for (int k = 0; k < initial;) {
+                state = hash_u32(state + k);
+                int p = static_cast<int>(state % n);
+                if (!on[p]) {
+                    toggle(p);
+                    ++k;
+                }
+            }
+            for (int iteration = 0; iteration < 4 * n; ++iteration) {
+                int cluster = extreme(true);
+                toggle(cluster);
+                int hole = extreme(false);
+                if (hole == cluster) {
+                    toggle(cluster);
+                    break;
+                }
+                toggle(hole);
+            }
+            std::vector<bool> initial_on = on;
+            std::vector<double> initial_energy = energy;
+
+            std::vector<int> rank(n, 0);
+            // phase 1: take the tightest clusters away, they get the ranks below the initial count
+            for (int r = initial - 1; r >= 0; --r) {
+                int cluster = extreme(true);
+                toggle(cluster);
+                rank[cluster] = r;
+            }
+            // phases 2 and 3: back from the initial pattern, fill the largest voids with the ranks above
+            on = initial_on;
+            energy = initial_energy;
+            for (int r = initial; r < n; ++r) {
+                int hole = extreme(false);
+                toggle(hole);
+                rank[hole] = r;
+            }
+
+            std::vector<float> mask(n);
+            for (int p = 0; p < n; ++p) {
+                mask[p] = (rank[p] + 0.5f) / n;
+            }
+            return mask;
+        }
+};
+
+// seed only changes the independent sampler, the others are meant to give the same points every time
+inline std::unique_ptr<sampler> make_sampler(sampler_type type, int samples_per_pixel, uint32_t seed = 0) {
+    switch (type) {
+        case sampler_stratified: return std::unique_ptr<sampler>(new stratified_sampler(samples_per_pixel));
+        case sampler_sobol:      return std::unique_ptr<sampler>(new sobol_sampler());
+        case sampler_blue_noise: return std::unique_ptr<sampler>(new blue_noise_sampler());
+        default:                 return std::unique_ptr<sampler>(new independent_sampler(seed));
+    }
+}
+
+#endif
@@ -0,0 +1,877 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "sphere.h"
+#include "text_parsing.h"
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Scene files
+
+Text format, one statement per line, '#' starts a comment:
+
+    camera image_width 1200 aspect_ratio 1.777778 samples_per_pixel 100 max_depth 25
+    camera vfov 20 lookfrom 13 2 3 lookat 0 0 0 vup 0 1 0 defocus_angle 1 focus_dist 10
+    camera shutter_open 0 shutter_close 1
+    camera sky_gradient 0 background 0 0 0          # black instead of the default sky, for lit indoor scenes
+    camera sampler sobol                            # independent, stratified, sobol or blue_noise (see sampler.h)
+
+    material ground lambertian 0.5 0.5 0.5          # name, type, albedo
+    material steel  metal      0.4 0.7 0.1 0.05     # name, type, albedo, fuzz
+    material glass  dielectric 1.5                  # name, type, index of refraction
+    material lamp   light      8 8 7                # name, type, emitted radiance (can be well above 1)
+
+    sphere 0 -1000 0 1000 ground                    # center, radius, material name
+    sphere 4 1 0 1 steel velocity 0 0.5 0           # moving sphere, center at time 0 and distance moved per frame
+    mesh bunny.obj steel                            # .obj or .ply triangle mesh, material name
+    mesh bunny.obj glass translate 3 0 0 rotate_y 45 scale 2   # another instance of the same mesh
+
+Camera keys are the same names as the camera class members, and any of them can be left out to keep the default.
+Materials have to be declared before the spheres and meshes that use them.
+Relative mesh paths are relative to the scene file.
+A mesh can be followed by transforms (translate x y z, rotate_x/rotate_y/rotate_z degrees, scale s or scale x y z,
+or a raw 3x4 row major "matrix" of 12 numbers), applied to the mesh in the order written. Every mesh line is an
+instance: a file named more than once is loaded once and shared.
+
+Binary format (same data, for big production scenes), all in host byte order:
+
+    scene_binary_header
+    scene_binary_sections
+    material_records, sphere_records, bvh_nodes, each at a 64 byte aligned offset given in the sections
+    mesh table                     { uint32_t material, uint32_t path_length, float transform[12], path bytes } per mesh
+
+Every array is addressed by offset from the start of the file and nodes refer to each other and to spheres by index,
+so the file can be memory mapped and traced as is (see packed_scene.h). When a file has a BVH (node_count > 0)
+the spheres are stored in BVH leaf order, and node bounds cover each sphere over the whole frame (time 0 to 1).
+load_scene() tells text and binary apart by the magic at the start of the file, not by the extension.
+
+A damaged file must not crash the renderer. Loading one checks every section against the file's size, and every node
+and sphere index before anything is traced, and rejects the file if anything points outside it. Mapping one only
+checks the section table, as going over every node would touch every page of the file: the node, sphere and material
+indices are checked as traversal and shading reach them instead, and a bad one ends that ray's traversal (the picture
+is wrong, but nothing outside the file is read).
+
+Spheres and materials are kept as flat arrays of plain records instead of shared_ptr objects,
+so loading a few million spheres is just appending to a vector.
+Positions are stored as floats, which halves the memory of a big scene and is plenty of precision for scene data.
+*/
+
+enum material_type : uint32_t {
+    material_lambertian = 0,
+    material_metal      = 1,
+    material_dielectric = 2,
+    material_light      = 3
+};
+
+struct material_record {
+    uint32_t type;    // material_type
+    float albedo[3];  // lambertian and metal color, light radiance
+    float param;      // metal fuzz, or dielectric index of refraction
+};
+
+struct sphere_record {
+    float center[3];   // at time 0
+    float radius;
+    uint32_t material; // index into the scene's materials
+    float velocity[3]; // distance the center moves over the frame, zero for a still sphere
+};
+
+const char     scene_binary_magic[4] = {'R', 'T', 'S', 'B'};
+const uint32_t scene_binary_version  = 1;
+
+struct scene_binary_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t material_count;
+    uint32_t reserved;
+    uint64_t sphere_count;
+
+    // camera
+    int32_t image_width;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t padding;
+    double aspect_ratio;
+    double vfov;
+    double lookfrom[3];
+    double lookat[3];
+    double vup[3];
+    double defocus_angle;
+    double focus_dist;
+};
+
+struct scene_binary_sections {
+    uint64_t node_count;
+    uint64_t materials_offset;
+    uint64_t spheres_offset;
+    uint64_t nodes_offset;
+    uint64_t mesh_count;
+    uint64_t meshes_offset;
+    uint64_t meshes_bytes;
+
+    // camera settings that came after the header's
+    double shutter_open;
+    double shutter_close;
+    double background[3];
+    uint32_t sky_gradient;
+    uint32_t sampling;     // sampler_type
+};
+
+// An instance of a triangle mesh the scene pulls in from an .obj or .ply file,
+// placed by a 3x4 row major object to world transform
+struct mesh_record {
+    std::string path;
+    uint32_t material;
+    float transform[12];
+
+    mesh_record() : material(0) {
+        set_transform(::transform());
+    }
+
+    void set_transform(const ::transform& t) {
+        for (int k = 0; k < 12; ++k) {
+            transform[k] = static_cast<float>(t.m[k / 4][k % 4]);
+        }
+    }
+
+    ::transform get_transform() const {
+        ::transform t;
+        for (int k = 0; k < 12; ++k) {
+            t.m[k / 4][k % 4] = transform[k];
+        }
+        return t;
+    }
+};
+
+inline void camera_to_header(const camera& cam, scene_binary_header& header) {
+    header.image_width = cam.image_width;
+    header.samples_per_pixel = cam.samples_per_pixel;
+    header.max_depth = cam.max_depth;
+    header.aspect_ratio = cam.aspect_ratio;
+    header.vfov = cam.vfov;
+    for (int k = 0; k < 3; ++k) {
+        header.lookfrom[k] = cam.lookfrom[k];
+        header.lookat[k] = cam.lookat[k];
+        header.vup[k] = cam.vup[k];
+    }
+    header.defocus_angle = cam.defocus_angle;
+    header.focus_dist = cam.focus_dist;
+}
+
+inline void header_to_camera(const scene_binary_header& header, camera& cam) {
+    cam.image_width = header.image_width;
+    cam.samples_per_pixel = header.samples_per_pixel;
+    cam.max_depth = header.max_depth;
+    cam.aspect_ratio = header.aspect_ratio;
+    cam.vfov = header.vfov;
+    cam.lookfrom = point3(header.lookfrom[0], header.lookfrom[1], header.lookfrom[2]);
+    cam.lookat = point3(header.lookat[0], header.lookat[1], header.lookat[2]);
+    cam.vup = vec3(header.vup[0], header.vup[1], header.vup[2]);
+    cam.defocus_angle = header.defocus_angle;
+    cam.focus_dist = header.focus_dist;
+}
+
+// shutter times outside the frame [0,1], which sphere bounds don't cover (NaN included)
+inline bool shutter_outside_frame(double time) {
+    return !(time >= 0 && time <= 1);
+}
+
+// The camera settings that live in the sections rather than the header, false if they can't be right
+inline bool sections_to_camera(const scene_binary_sections& sections, camera& cam) {
+    if (shutter_outside_frame(sections.shutter_open) || shutter_outside_frame(sections.shutter_close)) {
+        return false;
+    }
+    cam.shutter_open = sections.shutter_open;
+    cam.shutter_close = sections.shutter_close;
+    cam.background = color(sections.background[0], sections.background[1], sections.background[2]);
+    cam.sky_gradient = sections.sky_gradient != 0;
+    cam.sampling = (sections.sampling <= sampler_blue_noise) ? static_cast<sampler_type>(sections.sampling) : sampler_independent;
+    return true;
+}
+
+// create one material object per record, shared by all the spheres that reference it
+inline std::vector<shared_ptr<material>> make_materials(const material_record* records, size_t count) {
+    std::vector<shared_ptr<material>> mats;
+    mats.reserve(count);
+    for (size_t k = 0; k < count; ++k) {
+        const material_record& m = records[k];
+        color albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+        if (m.type == material_metal) {
+            mats.push_back(make_shared<metal>(albedo, m.param));
+        }
+        else if (m.type == material_dielectric) {
+            mats.push_back(make_shared<dielectric>(m.param));
+        }
+        else if (m.type == material_light) {
+            mats.push_back(make_shared<diffuse_light>(albedo));
+        }
+        else {
+            mats.push_back(make_shared<lambertian>(albedo));
+        }
+    }
+    return mats;
+}
+
+class scene_description {
+    public:
+        camera cam;
+        std::vector<material_record> materials;
+        std::vector<sphere_record> spheres;
+        std::vector<bvh_node> nodes; // prebuilt BVH over spheres, empty if the scene doesn't have one yet
+        std::vector<mesh_record> meshes;
+
+        uint32_t add_lambertian(const color& albedo) {
+            return add_material(material_lambertian, albedo, 0);
+        }
+
+        uint32_t add_metal(const color& albedo, double fuzz) {
+            return add_material(material_metal, albedo, fuzz);
+        }
+
+        uint32_t add_dielectric(double index_of_refraction) {
+            return add_material(material_dielectric, color(1, 1, 1), index_of_refraction);
+        }
+
+        uint32_t add_light(const color& radiance) {
+            return add_material(material_light, radiance, 0);
+        }
+
+        void add_sphere(const point3& center, double radius, uint32_t material, const vec3& velocity = vec3(0, 0, 0)) {
+            sphere_record s;
+            s.center[0] = static_cast<float>(center.x());
+            s.center[1] = static_cast<float>(center.y());
+            s.center[2] = static_cast<float>(center.z());
+            s.radius = static_cast<float>(radius);
+            s.material = material;
+            s.velocity[0] = static_cast<float>(velocity.x());
+            s.velocity[1] = static_cast<float>(velocity.y());
+            s.velocity[2] = static_cast<float>(velocity.z());
+            spheres.push_back(s);
+        }
+
+        // turn the records into hittable objects the renderer can trace
+        void build(hittable_list& world) const {
+            auto mats = make_materials(materials.data(), materials.size());
+            world.objects.reserve(world.objects.size() + spheres.size());
+            for (const auto& s : spheres) {
+                point3 center(s.center[0], s.center[1], s.center[2]);
+                vec3 velocity(s.velocity[0], s.velocity[1], s.velocity[2]);
+                world.add(make_shared<sphere>(center, center + velocity, s.radius, mats[s.material]));
+            }
+        }
+
+    private:
+        uint32_t add_material(uint32_t type, const color& albedo, double param) {
+            material_record m;
+            m.type = type;
+            m.albedo[0] = static_cast<float>(albedo.x());
+            m.albedo[1] = static_cast<float>(albedo.y());
+            m.albedo[2] = static_cast<float>(albedo.z());
+            m.param = static_cast<float>(param);
+            materials.push_back(m);
+            return static_cast<uint32_t>(materials.size() - 1);
+        }
+};
+
+
+// Streaming text parser. The file is read in big chunks and each complete line is parsed in place,
+// numbers with a hand rolled decimal parser since strtod is far too slow for tens of millions of values.
+class scene_text_parser {
+    public:
+        std::string base_dir; // relative mesh paths are resolved against this, including the trailing '/'
+
+        scene_text_parser(scene_description& _scene) : scene(_scene) {}
+
+        bool parse(std::FILE* file, std::string& error) {
+            const size_t chunk = 1 << 22;
+            std::vector<char> buf(chunk);
+            size_t filled = 0;
+            line_number = 0;
+
+            while (true) {
+                if (filled == buf.size()) {
+                    buf.resize(buf.size() * 2); // a single line longer than the buffer
+                }
+                size_t n = std::fread(buf.data() + filled, 1, buf.size() - filled, file);
+                filled += n;
+                bool at_eof = (n == 0);
+
+                // parse every complete line, keep the partial one at the end for the next read
+                const char* begin = buf.data();
+                const char* end = buf.data() + filled;
+                const char* line = begin;
+                while (true) {
+                    const char* eol = static_cast<const char*>(std::memchr(line, '\n', end - line));
+                    if (eol == nullptr) {
+                        if (at_eof && line < end) {
+                            eol = end; // last line without a trailing newline
+                        }
+                        else {
+                            break;
+                        }
+                    }
+                    ++line_number;
+                    if (!parse_line(line, eol, error)) {
+                        return false;
+                    }
+                    line = (eol < end) ? eol + 1 : end;
+                }
+
+                size_t consumed = line - begin;
+                std::memmove(buf.data(), line, filled - consumed);
+                filled -= consumed;
+                if (at_eof) {
+                    return true;
+                }
+            }
+        }
+
+    private:
+        scene_description& scene;
+        std::unordered_map<std::string, uint32_t> material_ids;
+        std::string last_material_name; // consecutive spheres very often share a material, skip the hash lookup
+        uint32_t last_material_id = 0;
+        size_t line_number = 0;
+
+        // next whitespace separated word, empty at the end of the line or at a comment
+        static std::string word(const char*& p, const char* end) {
+            skip_blank(p, end);
+            const char* start = p;
+            while (p < end && !is_blank(*p) && *p != '#') {
+                ++p;
+            }
+            return std::string(start, p);
+        }
+
+        static bool word_is(const char* start, const char* stop, const char* w) {
+            size_t len = std::strlen(w);
+            return static_cast<size_t>(stop - start) == len && std::memcmp(start, w, len) == 0;
+        }
+
+        bool fail(std::string& error, const std::string& what) const {
+            error = "line " + std::to_string(line_number) + ": " + what;
+            return false;
+        }
+
+        bool numbers(const char*& p, const char* end, double* out, int count, std::string& error) const {
+            for (int k = 0; k < count; ++k) {
+                if (!parse_number(p, end, out[k])) {
+                    return fail(error, "expected a number");
+                }
+            }
+            return true;
+        }
+
+        bool parse_line(const char* p, const char* end, std::string& error) {
+            skip_blank(p, end);
+            if (p == end || *p == '#') {
+                return true;
+            }
+            const char* kw = p;
+            while (p < end && !is_blank(*p)) {
+                ++p;
+            }
+
+            // spheres first, they're nearly every line of a big scene
+            if (word_is(kw, p, "sphere")) {
+                double v[4];
+                if (!numbers(p, end, v, 4, error)) {
+                    return false;
+                }
+                skip_blank(p, end);
+                const char* name = p;
+                while (p < end && !is_blank(*p) && *p != '#') {
+                    ++p;
+                }
+                uint32_t id;
+                if (name == p) {
+                    return fail(error, "sphere needs a material");
+                }
+                if (!lookup_material(name, p, id)) {
+                    return fail(error, "unknown material '" + std::string(name, p) + "'");
+                }
+                sphere_record s;
+                s.center[0] = static_cast<float>(v[0]);
+                s.center[1] = static_cast<float>(v[1]);
+                s.center[2] = static_cast<float>(v[2]);
+                s.radius = static_cast<float>(v[3]);
+                s.material = id;
+                s.velocity[0] = s.velocity[1] = s.velocity[2] = 0;
+                skip_blank(p, end);
+                if (p < end && *p != '#') {
+                    std::string extra = word(p, end);
+                    if (extra != "velocity") {
+                        return fail(error, "unexpected '" + extra + "' after sphere");
+                    }
+                    if (!numbers(p, end, v, 3, error)) {
+                        return false;
+                    }
+                    s.velocity[0] = static_cast<float>(v[0]);
+                    s.velocity[1] = static_cast<float>(v[1]);
+                    s.velocity[2] = static_cast<float>(v[2]);
+                }
+                scene.spheres.push_back(s);
+                return true;
+            }
+            if (word_is(kw, p, "mesh")) {
+                return parse_mesh(p, end, error);
+            }
+            if (word_is(kw, p, "material")) {
+                return parse_material(p, end, error);
+            }
+            if (word_is(kw, p, "camera")) {
+                return parse_camera(p, end, error);
+            }
+            return fail(error, "unknown statement '" + std::string(kw, p) + "'");
+        }
+
+        bool lookup_material(const char* name, const char* name_end, uint32_t& id) {
+            size_t len = name_end - name;
+            if (len == 0) {
+                return false; // or it would match last_material_name before any lookup has set it
+            }
+            if (len == last_material_name.size() && std::memcmp(name, last_material_name.data(), len) == 0) {
+                id = last_material_id;
+                return true;
+            }
+            auto it = material_ids.find(std::string(name, name_end));
+            if (it == material_ids.end()) {
+                return false;
+            }
+            last_material_name.assign(name, name_end);
+            last_material_id = it->second;
+            id = it->second;
+            return true;
+        }
+
+        bool parse_mesh(const char* p, const char* end, std::string& error) {
+            mesh_record m;
+            m.path = word(p, end);
+            std::string name = word(p, end);
+            if (m.path.empty() || name.empty()) {
+                return fail(error, "mesh needs a file and a material");
+            }
+            if (!lookup_material(name.data(), name.data() + name.size(), m.material)) {
+                return fail(error, "unknown material '" + name + "'");
+            }
+            if (m.path[0] != '/') {
+                m.path = base_dir + m.path;
+            }
+
+            // each transform applies on top of the ones before it
+            transform to_world;
+            while (true) {
+                std::string op = word(p, end);
+                if (op.empty()) {
+                    break;
+                }
+                double v[12] = {};
+                if (op == "translate") {
+                    if (!numbers(p, end, v, 3, error)) return false;
+                    to_world = transform::translate(vec3(v[0], v[1], v[2])) * to_world;
+                }
+                else if (op == "rotate_x" || op == "rotate_y" || op == "rotate_z") {
+                    if (!numbers(p, end, v, 1, error)) return false;
+                    to_world = transform::rotate(op[7] - 'x', v[0]) * to_world;
+                }
+                else if (op == "scale") {
+                    if (!numbers(p, end, v, 1, error)) return false;
+                    v[1] = v[2] = v[0];
+                    skip_blank(p, end);
+                    if (p < end && *p != '#' && !std::isalpha(static_cast<unsigned char>(*p))
+                        && !numbers(p, end, v + 1, 2, error)) {
+                        return false;
+                    }
+                    to_world = transform::scale(vec3(v[0], v[1], v[2])) * to_world;
+                }
+                else if (op == "matrix") {
+                    if (!numbers(p, end, v, 12, error)) return false;
+                    transform t;
+                    for (int k = 0; k < 12; ++k) {
+                        t.m[k / 4][k % 4] = v[k];
+                    }
+                    to_world = t * to_world;
+                }
+                else {
+                    return fail(error, "unknown mesh transform '" + op + "'");
+                }
+            }
+            m.set_transform(to_world);
+            scene.meshes.push_back(m);
+            return true;
+        }
+
+        bool parse_material(const char* p, const char* end, std::string& error) {
+            std::string name = word(p, end);
+            std::string type = word(p, end);
+            if (name.empty()) {
+                return fail(error, "material needs a name");
+            }
+
+            uint32_t id;
+            if (type == "lambertian") {
+                double a[3];
+                if (!numbers(p, end, a, 3, error)) {
+                    return false;
+                }
+                id = scene.add_lambertian(color(a[0], a[1], a[2]));
+            }
+            else if (type == "metal") {
+                double a[4];
+                if (!numbers(p, end, a, 4, error)) {
+                    return false;
+                }
+                id = scene.add_metal(color(a[0], a[1], a[2]), a[3]);
+            }
+            else if (type == "dielectric") {
+                double ir;
+                if (!numbers(p, end, &ir, 1, error)) {
+                    return false;
+                }
+                id = scene.add_dielectric(ir);
+            }
+            else if (type == "light") {
+                double a[3];
+                if (!numbers(p, end, a, 3, error)) {
+                    return false;
+                }
+                id = scene.add_light(color(a[0], a[1], a[2]));
+            }
+            else {
+                return fail(error, "unknown material type '" + type + "'");
+            }
+
+            material_ids[name] = id;
+            if (name == last_material_name) {
+                last_material_id = id; // redefinition
+            }
+            return true;
+        }
+
+        bool parse_camera(const char* p, const char* end, std::string& error) {
+            camera& cam = scene.cam;
+            while (true) {
+                std::string key = word(p, end);
+                if (key.empty()) {
+                    return true;
+                }
+
+                if (key == "sampler") {
+                    std::string name = word(p, end);
+                    if (!sampler_from_name(name, cam.sampling)) {
+                        return fail(error, "unknown sampler '" + name + "'");
+                    }
+                    continue;
+                }
+
+                double v[3];
+                if (key == "lookfrom" || key == "lookat" || key == "vup" || key == "background") {
+                    if (!numbers(p, end, v, 3, error)) {
+                        return false;
+                    }
+                    vec3 vec(v[0], v[1], v[2]);
+                    if (key == "lookfrom") cam.lookfrom = vec;
+                    else if (key == "lookat") cam.lookat = vec;
+                    else if (key == "background") cam.background = vec;
+                    else cam.vup = vec;
+                    continue;
+                }
+
+                if (!numbers(p, end, v, 1, error)) {
+                    return false;
+                }
+                if (key == "image_width") cam.image_width = static_cast<int>(v[0]);
+                else if (key == "aspect_ratio") cam.aspect_ratio = v[0];
+                else if (key == "samples_per_pixel") cam.samples_per_pixel = static_cast<int>(v[0]);
+                else if (key == "max_depth") cam.max_depth = static_cast<int>(v[0]);
+                else if (key == "vfov") cam.vfov = v[0];
+                else if (key == "defocus_angle") cam.defocus_angle = v[0];
+                else if (key == "focus_dist") cam.focus_dist = v[0];
+                else if (key == "shutter_open" || key == "shutter_close") {
+                    if (shutter_outside_frame(v[0])) {
+                        return fail(error, key + " has to be within the frame, 0 to 1");
+                    }
+                    (key == "shutter_open" ? cam.shutter_open : cam.shutter_close) = v[0];
+                }
+                else if (key == "sky_gradient") cam.sky_gradient = (v[0] != 0);
+                else return fail(error, "unknown camera setting '" + key + "'");
+            }
+        }
+};
+
+
+// Decode the mesh table
+inline bool read_mesh_table(const char* data, uint64_t bytes, uint64_t count, std::vector<mesh_record>& meshes) {
+    const char* p = data;
+    const char* end = data + bytes;
+    meshes.clear();
+    for (uint64_t k = 0; k < count; ++k) {
+        uint32_t fields[2];
+        if (static_cast<size_t>(end - p) < sizeof(fields)) {
+            return false;
+        }
+        std::memcpy(fields, p, sizeof(fields));
+        p += sizeof(fields);
+        mesh_record m;
+        if (static_cast<size_t>(end - p) < sizeof(m.transform)) {
+            return false;
+        }
+        std::memcpy(m.transform, p, sizeof(m.transform));
+        p += sizeof(m.transform);
+        if (static_cast<size_t>(end - p) < fields[1]) {
+            return false;
+        }
+        m.material = fields[0];
+        m.path.assign(p, fields[1]);
+        p += fields[1];
+        meshes.push_back(m);
+    }
+    return true;
+}
+
+// whether count records of record_size bytes from offset lie within a file of file_size bytes
+inline bool section_in_file(uint64_t offset, uint64_t count, size_t record_size, uint64_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / record_size;
+}
+
+inline bool load_scene_binary(std::FILE* file, scene_description& scene, std::string& error) {
+    // the counts in the header are checked against the file's size before anything gets allocated for them
+    if (std::fseek(file, 0, SEEK_END) != 0) {
+        error = "can't seek";
+        return false;
+    }
+    long end = std::ftell(file);
+    std::rewind(file);
+    uint64_t file_size = (end > 0) ? static_cast<uint64_t>(end) : 0;
+
+    scene_binary_header header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1) {
+        error = "truncated header";
+        return false;
+    }
+    if (header.version != scene_binary_version) {
+        error = "unsupported binary scene version " + std::to_string(header.version);
+        return false;
+    }
+    header_to_camera(header, scene.cam);
+
+    scene_binary_sections sections;
+    if (std::fread(&sections, sizeof(sections), 1, file) != 1) {
+        error = "truncated header";
+        return false;
+    }
+    if (!sections_to_camera(sections, scene.cam)) {
+        error = "shutter outside the frame";
+        return false;
+    }
+    if (!section_in_file(sections.materials_offset, header.material_count, sizeof(material_record), file_size)
+        || !section_in_file(sections.spheres_offset, header.sphere_count, sizeof(sphere_record), file_size)
+        || !section_in_file(sections.nodes_offset, sections.node_count, sizeof(bvh_node), file_size)
+        || !section_in_file(sections.meshes_offset, sections.meshes_bytes, 1, file_size)) {
+        error = "truncated file";
+        return false;
+    }
+
+    scene.materials.resize(header.material_count);
+    scene.spheres.resize(header.sphere_count);
+    scene.nodes.resize(sections.node_count);
+    bool ok = std::fseek(file, static_cast<long>(sections.materials_offset), SEEK_SET) == 0
+           && std::fread(scene.materials.data(), sizeof(material_record), scene.materials.size(), file) == scene.materials.size()
+           && std::fseek(file, static_cast<long>(sections.spheres_offset), SEEK_SET) == 0
+           && std::fread(scene.spheres.data(), sizeof(sphere_record), scene.spheres.size(), file) == scene.spheres.size();
+    if (ok && !scene.nodes.empty()) {
+        ok = std::fseek(file, static_cast<long>(sections.nodes_offset), SEEK_SET) == 0
+          && std::fread(scene.nodes.data(), sizeof(bvh_node), scene.nodes.size(), file) == scene.nodes.size();
+    }
+    if (ok && sections.mesh_count > 0) {
+        std::vector<char> table(sections.meshes_bytes);
+        ok = std::fseek(file, static_cast<long>(sections.meshes_offset), SEEK_SET) == 0
+          && std::fread(table.data(), 1, table.size(), file) == table.size()
+          && read_mesh_table(table.data(), table.size(), sections.mesh_count, scene.meshes);
+    }
+    if (!ok) {
+        error = "truncated file";
+        return false;
+    }
+    if (!bvh_nodes_consistent(scene.nodes.data(), scene.nodes.size(), scene.spheres.size())) {
+        error = "corrupt BVH";
+        return false;
+    }
+    for (const auto& s : scene.spheres) {
+        if (s.material >= header.material_count) {
+            error = "sphere references a missing material";
+            return false;
+        }
+    }
+    for (const auto& m : scene.meshes) {
+        if (m.material >= header.material_count) {
+            error = "mesh references a missing material";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Load a text or binary scene file into scene, false with a message in error if it can't be read
+inline bool load_scene(const std::string& path, scene_description& scene, std::string& error) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        error = "can't open " + path;
+        return false;
+    }
+
+    char magic[4] = {0, 0, 0, 0};
+    size_t n = std::fread(magic, 1, sizeof(magic), file);
+    std::rewind(file);
+
+    bool ok;
+    if (n == sizeof(magic) && std::memcmp(magic, scene_binary_magic, sizeof(magic)) == 0) {
+        ok = load_scene_binary(file, scene, error);
+    }
+    else {
+        scene_text_parser parser(scene);
+        auto slash = path.rfind('/');
+        parser.base_dir = (slash == std::string::npos) ? "" : path.substr(0, slash + 1);
+        ok = parser.parse(file, error);
+    }
+    std::fclose(file);
+
+    if (!ok) {
+        error = path + ": " + error;
+    }
+    return ok;
+}
+
+inline bool save_scene_text(const std::string& path, const scene_description& scene) {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+
+    const camera& cam = scene.cam;
+    std::fprintf(file, "camera image_width %d aspect_ratio %.9g samples_per_pixel %d max_depth %d\n",
+                 cam.image_width, cam.aspect_ratio, cam.samples_per_pixel, cam.max_depth);
+    std::fprintf(file, "camera vfov %.9g lookfrom %.9g %.9g %.9g lookat %.9g %.9g %.9g vup %.9g %.9g %.9g\n",
+                 cam.vfov, cam.lookfrom.x(), cam.lookfrom.y(), cam.lookfrom.z(),
+                 cam.lookat.x(), cam.lookat.y(), cam.lookat.z(), cam.vup.x(), cam.vup.y(), cam.vup.z());
+    std::fprintf(file, "camera defocus_angle %.9g focus_dist %.9g shutter_open %.9g shutter_close %.9g\n",
+                 cam.defocus_angle, cam.focus_dist, cam.shutter_open, cam.shutter_close);
+    std::fprintf(file, "camera sky_gradient %d background %.9g %.9g %.9g sampler %s\n\n", cam.sky_gradient ? 1 : 0,
+                 cam.background.x(), cam.background.y(), cam.background.z(), sampler_name(cam.sampling));
+
+    for (size_t k = 0; k < scene.materials.size(); ++k) {
+        const material_record& m = scene.materials[k];
+        if (m.type == material_metal) {
+            std::fprintf(file, "material m%zu metal %.9g %.9g %.9g %.9g\n", k, m.albedo[0], m.albedo[1], m.albedo[2], m.param);
+        }
+        else if (m.type == material_dielectric) {
+            std::fprintf(file, "material m%zu dielectric %.9g\n", k, m.param);
+        }
+        else if (m.type == material_light) {
+            std::fprintf(file, "material m%zu light %.9g %.9g %.9g\n", k, m.albedo[0], m.albedo[1], m.albedo[2]);
+        }
+        else {
+            std::fprintf(file, "material m%zu lambertian %.9g %.9g %.9g\n", k, m.albedo[0], m.albedo[1], m.albedo[2]);
+        }
+    }
+    std::fprintf(file, "\n");
+
+    for (const auto& s : scene.spheres) {
+        std::fprintf(file, "sphere %.9g %.9g %.9g %.9g m%u", s.center[0], s.center[1], s.center[2], s.radius, s.material);
+        if (s.velocity[0] != 0 || s.velocity[1] != 0 || s.velocity[2] != 0) {
+            std::fprintf(file, " velocity %.9g %.9g %.9g", s.velocity[0], s.velocity[1], s.velocity[2]);
+        }
+        std::fprintf(file, "\n");
+    }
+    for (const auto& m : scene.meshes) {
+        std::fprintf(file, "mesh %s m%u", m.path.c_str(), m.material);
+        if (m.get_transform() != transform()) {
+            std::fprintf(file, " matrix");
+            for (float x : m.transform) {
+                std::fprintf(file, " %.9g", x);
+            }
+        }
+        std::fprintf(file, "\n");
+    }
+
+    return std::fclose(file) == 0;
+}
+
+// Write the current binary format. If the scene has a BVH (see build_scene_bvh) it's stored too,
+// in which case the spheres are expected to already be in its leaf order.
+inline bool save_scene_binary(const std::string& path, const scene_description& scene) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    scene_binary_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, scene_binary_magic, sizeof(header.magic));
+    header.version = scene_binary_version;
+    header.material_count = static_cast<uint32_t>(scene.materials.size());
+    header.sphere_count = scene.spheres.size();
+    camera_to_header(scene.cam, header);
+
+    // every array starts on a 64 byte boundary so it's cache line aligned once mapped
+    auto align = [](uint64_t offset) { return (offset + 63) & ~static_cast<uint64_t>(63); };
+    scene_binary_sections sections;
+    sections.node_count = scene.nodes.size();
+    sections.materials_offset = align(sizeof(header) + sizeof(sections));
+    sections.spheres_offset = align(sections.materials_offset + scene.materials.size() * sizeof(material_record));
+    sections.nodes_offset = align(sections.spheres_offset + scene.spheres.size() * sizeof(sphere_record));
+    sections.shutter_open = scene.cam.shutter_open;
+    sections.shutter_close = scene.cam.shutter_close;
+    for (int k = 0; k < 3; ++k) {
+        sections.background[k] = scene.cam.background[k];
+    }
+    sections.sky_gradient = scene.cam.sky_gradient ? 1 : 0;
+    sections.sampling = scene.cam.sampling;
+
+    std::vector<char> table;
+    for (const auto& m : scene.meshes) {
+        uint32_t fields[2] = { m.material, static_cast<uint32_t>(m.path.size()) };
+        table.insert(table.end(), reinterpret_cast<const char*>(fields), reinterpret_cast<const char*>(fields) + sizeof(fields));
+        table.insert(table.end(), reinterpret_cast<const char*>(m.transform), reinterpret_cast<const char*>(m.transform) + sizeof(m.transform));
+        table.insert(table.end(), m.path.begin(), m.path.end());
+    }
+    sections.mesh_count = scene.meshes.size();
+    sections.meshes_offset = align(sections.nodes_offset + scene.nodes.size() * sizeof(bvh_node));
+    sections.meshes_bytes = table.size();
+
+    uint64_t written = 0;
+    auto write_at = [&](uint64_t offset, const void* data, size_t size) {
+        static const char zeros[64] = {0};
+        if (offset - written > 0 && std::fwrite(zeros, 1, offset - written, file) != offset - written) {
+            return false;
+        }
+        written = offset + size;
+        return size == 0 || std::fwrite(data, 1, size, file) == size;
+    };
+
+    bool ok = write_at(0, &header, sizeof(header))
+           && write_at(sizeof(header), &sections, sizeof(sections))
+           && write_at(sections.materials_offset, scene.materials.data(), scene.materials.size() * sizeof(material_record))
+           && write_at(sections.spheres_offset, scene.spheres.data(), scene.spheres.size() * sizeof(sphere_record))
+           && write_at(sections.nodes_offset, scene.nodes.data(), scene.nodes.size() * sizeof(bvh_node))
+           && write_at(sections.meshes_offset, table.data(), table.size());
+    return (std::fclose(file) == 0) && ok;
+}
+
+#endif
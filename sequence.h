@@ -0,0 +1,382 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "denoise.h"
+#include "hittable.h"
+#include "instance.h"
+#include "text_parsing.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Animation sequences
+
+Rendering a camera flythrough used to mean launching the renderer once per frame, which loads the scene and builds
+the BVH again every single time. A sequence renders all the frames from one process instead: the world is built
+once, and only the camera moves.
+
+The camera path is a text file of keyframes, one per line, '#' starts a comment:
+
+    key 0   lookfrom 13 2 3   lookat 0 0 0
+    key 60  lookfrom 0 3 13   lookat 0 1 0  vfov 25
+    key 120 lookfrom -13 2 3  lookat 0 0 0
+
+Each key gives the frame number it applies to, and frames in between are interpolated linearly.
+Fields a key leaves out (say vfov) carry over from the key before it, or from the scene's camera for the first key.
+
+Keys can also move mesh instances, "move N x y z" puts the scene's Nth mesh line (from 0) that far from where the
+scene has it, so objects can fly around too. Moving an instance only changes the small top level tree over the
+instances, which is refitted every frame in one linear pass (instance_bvh::update) and only rebuilt once the
+motion has made it too slow to trace. Instances of emissive meshes can't move, their light samples would stay behind.
+Only whole instances move: spheres and the triangles inside a mesh stay where the scene put them, so their own
+trees (packed_scene's and each triangle_mesh's) are built once and never refitted.
+
+Writing a frame out (float sums to 8 bit text PPM) is done on a second thread while the next frame renders,
+so the encoding time disappears from the total as long as it's shorter than a render.
+*/
+
+struct camera_keyframe {
+    double frame;
+    point3 lookfrom;
+    point3 lookat;
+    double vfov;
+    std::map<int, vec3> moves; // mesh instance -> offset from where the scene puts it
+};
+
+class camera_path {
+    public:
+        std::vector<camera_keyframe> keys; // sorted by frame
+
+        // Read a keyframe file; cam supplies the values for fields the first key leaves out
+        bool load(const std::string& path, const camera& cam, std::string& error) {
+            std::ifstream in(path);
+            if (!in) {
+                error = "can't open " + path;
+                return false;
+            }
+
+            camera_keyframe current;
+            current.frame = 0;
+            current.lookfrom = cam.lookfrom;
+            current.lookat = cam.lookat;
+            current.vfov = cam.vfov;
+
+            keys.clear();
+            std::string line;
+            int line_number = 0;
+            while (std::getline(in, line)) {
+                ++line_number;
+                const char* p = line.data();
+                const char* end = p + line.size();
+                skip_blank(p, end);
+                if (p == end || *p == '#') {
+                    continue;
+                }
+                if (!parse_key(p, end, current)) {
+                    error = path + ": line " + std::to_string(line_number)
+                          + ": expected 'key FRAME [lookfrom x y z] [lookat x y z] [vfov v] [move N x y z]...'";
+                    return false;
+                }
+                if (!keys.empty() && current.frame <= keys.back().frame) {
+                    error = path + ": line " + std::to_string(line_number) + ": keys have to be in increasing frame order";
+                    return false;
+                }
+                keys.push_back(current);
+            }
+            if (keys.empty()) {
+                error = path + ": no keyframes";
+                return false;
+            }
+            return true;
+        }
+
+        int first_frame() const { return static_cast<int>(std::ceil(keys.front().frame)); }
+        int last_frame() const { return static_cast<int>(std::floor(keys.back().frame)); }
+
+        // put the camera where the path is at the given frame
+        void apply(double frame, camera& cam) const {
+            const camera_keyframe* a;
+            const camera_keyframe* b;
+            double t = locate(frame, a, b);
+            cam.lookfrom = (1 - t)*a->lookfrom + t*b->lookfrom;
+            cam.lookat = (1 - t)*a->lookat + t*b->lookat;
+            cam.vfov = (1 - t)*a->vfov + t*b->vfov;
+        }
+
+        // the largest mesh instance any key moves, -1 if the path only moves the camera
+        int last_moved_object() const {
+            int last = -1;
+            for (const auto& key : keys) {
+                if (!key.moves.empty()) {
+                    last = std::max(last, key.moves.rbegin()->first);
+                }
+            }
+            return last;
+        }
+
+        // offsets of the moved mesh instances at the given frame; one a key doesn't mention yet is where the scene put it
+        void object_offsets(double frame, std::map<int, vec3>& offsets) const {
+            const camera_keyframe* a;
+            const camera_keyframe* b;
+            double t = locate(frame, a, b);
+            offsets.clear();
+            for (const auto& move : a->moves) {
+                offsets[move.first] = (1 - t)*move.second;
+            }
+            for (const auto& move : b->moves) {
+                offsets[move.first] += t*move.second;
+            }
+        }
+
+    private:
+        // the keys the frame lies between, and how far it is from a to b
+        double locate(double frame, const camera_keyframe*& a, const camera_keyframe*& b) const {
+            size_t k = 1;
+            while (k < keys.size() && keys[k].frame < frame) {
+                ++k;
+            }
+            if (k >= keys.size()) {
+                a = b = &keys.back();
+                return 0;
+            }
+            a = &keys[k - 1];
+            b = &keys[k];
+            double t = (frame - a->frame) / (b->frame - a->frame);
+            return (t < 0) ? 0 : (t > 1) ? 1 : t;
+        }
+
+        static bool parse_key(const char* p, const char* end, camera_keyframe& key) {
+            if (!next_word_is(p, end, "key") || !parse_number(p, end, key.frame)) {
+                return false;
+            }
+            while (true) {
+                skip_blank(p, end);
+                if (p == end || *p == '#') {
+                    return true;
+                }
+                if (next_word_is(p, end, "lookfrom")) {
+                    if (!parse_point(p, end, key.lookfrom)) {
+                        return false;
+                    }
+                }
+                else if (next_word_is(p, end, "lookat")) {
+                    if (!parse_point(p, end, key.lookat)) {
+                        return false;
+                    }
+                }
+                else if (next_word_is(p, end, "vfov")) {
+                    if (!parse_number(p, end, key.vfov)) {
+                        return false;
+                    }
+                }
+                else if (next_word_is(p, end, "move")) {
+                    double index;
+                    point3 offset;
+                    if (!parse_number(p, end, index) || index < 0 || index > 1e9 || index != std::floor(index)
+                        || !parse_point(p, end, offset)) {
+                        return false;
+                    }
+                    key.moves[static_cast<int>(index)] = offset;
+                }
+                else {
+                    return false;
+                }
+            }
+        }
+
+        static bool parse_point(const char*& p, const char* end, point3& out) {
+            double v[3];
+            for (int a = 0; a < 3; ++a) {
+                if (!parse_number(p, end, v[a])) {
+                    return false;
+                }
+            }
+            out = point3(v[0], v[1], v[2]);
+            return true;
+        }
+
+        // consume w if it's the next word
+        static bool next_word_is(const char*& p, const char* end, const char* w) {
+            skip_blank(p, end);
+            size_t len = std::strlen(w);
+            if (static_cast<size_t>(end - p) < len || std::memcmp(p, w, len) != 0
+                || (static_cast<size_t>(end - p) > len && !is_blank(p[len]))) {
+                return false;
+            }
+            p += len;
+            return true;
+        }
+};
+
+// Whether pattern is safe to give snprintf with a frame number: exactly one %d or %i, with optional flags (-+ #0)
+// and a width of at most two digits, and nothing else but %% escapes
+inline bool valid_frame_pattern(const std::string& pattern) {
+    int conversions = 0;
+    for (size_t k = 0; k < pattern.size(); ++k) {
+        if (pattern[k] != '%') {
+            continue;
+        }
+        ++k;
+        if (k < pattern.size() && pattern[k] == '%') {
+            continue;
+        }
+        while (k < pattern.size() && std::strchr("-+ #0", pattern[k]) != nullptr) {
+            ++k;
+        }
+        for (int digits = 0; k < pattern.size() && pattern[k] >= '0' && pattern[k] <= '9'; ++digits, ++k) {
+            if (digits == 2) {
+                return false;
+            }
+        }
+        if (k >= pattern.size() || (pattern[k] != 'd' && pattern[k] != 'i')) {
+            return false;
+        }
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+// Renders every frame of a camera path against one world, writing numbered images
+class sequence_renderer {
+    public:
+        std::string output_pattern = "frame_%04d.ppm"; // printf pattern, gets the frame number (see valid_frame_pattern)
+
+        // The mesh instances in scene order, what the path's 'move N' refers to, and the top level tree they're in.
+        // Without them the path can only move the camera.
+        std::vector<shared_ptr<instance>> movable;
+        instance_bvh* instances = nullptr;
+
+        sequence_renderer(camera& _cam, const hittable& _world, const camera_path& _path)
+          : cam(_cam), world(_world), path(_path) {}
+
+        // returns the number of frames written, or -1 if an image couldn't be written
+        int render() {
+            int width = cam.image_width;
+            int height = cam.get_image_height();
+            size_t floats = 3 * static_cast<size_t>(width) * height;
+
+            // two framebuffers: one being rendered into while the other is written out
+            std::vector<float> buffers[2];
+            buffers[0].resize(floats);
+            buffers[1].resize(floats);
+            aov_buffers aov;
+            denoiser filter;
+            std::thread encoder;
+            bool encode_ok = true;
+            int written = 0;
+
+            // where the scene put the instances, the path's offsets are from there
+            bool moving = instances != nullptr && path.last_moved_object() >= 0;
+            std::vector<transform> placed;
+            for (const auto& inst : movable) {
+                placed.push_back(inst->get_transform());
+            }
+            std::map<int, vec3> offsets;
+            int refits = 0, rebuilds = 0;
+            double update_ms = 0;
+
+            auto start = std::chrono::steady_clock::now();
+            int first = path.first_frame(), last = path.last_frame();
+            for (int frame = first; frame <= last; ++frame) {
+                auto frame_start = std::chrono::steady_clock::now();
+                TRACE_SCOPE("frame", "render");
+                std::vector<float>& fb = buffers[(frame - first) % 2];
+                std::fill(fb.begin(), fb.end(), 0.0f);
+                path.apply(frame, cam);
+                if (moving) {
+                    TRACE_SCOPE("update instance bvh", "bvh");
+                    auto update_start = std::chrono::steady_clock::now();
+                    path.object_offsets(frame, offsets);
+                    for (const auto& offset : offsets) {
+                        movable[offset.first]->set_transform(transform::translate(offset.second) * placed[offset.first]);
+                    }
+                    if (instances->update()) {
+                        ++rebuilds;
+                    }
+                    else {
+                        ++refits;
+                    }
+                    update_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - update_start).count();
+                }
+                if (cam.denoise) {
+                    aov.resize(width, height);
+                    cam.render_tile(world, 0, 0, width, height, 0, cam.samples_per_pixel, fb.data(), &aov);
+                    TRACE_SCOPE("denoise", "output");
+                    filter.run(fb.data(), aov, cam.samples_per_pixel);
+                }
+                else {
+                    cam.render_tile(world, 0, 0, width, height, 0, cam.samples_per_pixel, fb.data());
+                }
+
+                // the previous frame's encoder has to be done before its buffer gets reused next iteration
+                if (encoder.joinable()) {
+                    encoder.join();
+                }
+                if (!encode_ok) {
+                    return -1;
+                }
+                std::string name = frame_name(frame);
+                // everything the encoder reads is its own copy or this frame's buffer, the camera moves on to the next frame
+                int spp = cam.samples_per_pixel;
+                encoder = std::thread([&fb, &encode_ok, name, width, height, spp]() {
+                    TRACE_SCOPE("write image", "output");
+                    std::ofstream out(name);
+                    write_ppm(out, fb.data(), width, height, spp);
+                    out.close();
+                    if (!out) {
+                        std::cerr << "could not write " << name << '\n';
+                        encode_ok = false;
+                    }
+                });
+                ++written;
+
+                std::chrono::duration<double> frame_time = std::chrono::steady_clock::now() - frame_start;
+                std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+                std::clog << "Frame " << frame << " (" << (frame - first + 1) << '/' << (last - first + 1) << ") in "
+                          << frame_time.count() << " s, " << 3600.0 * written / total.count() << " frames/hour\n";
+            }
+            if (encoder.joinable()) {
+                encoder.join();
+            }
+            if (!encode_ok) {
+                return -1;
+            }
+
+            std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+            std::clog << "Rendered " << written << " frames in " << total.count() << " s, "
+                      << (total.count() > 0 ? 3600.0 * written / total.count() : 0.0) << " frames/hour\n";
+            if (moving) {
+                std::clog << "Instance BVH: " << refits << " refits, " << rebuilds << " rebuilds, "
+                          << update_ms << " ms in total\n";
+            }
+            return written;
+        }
+
+    private:
+        camera& cam;
+        const hittable& world;
+        const camera_path& path;
+
+        std::string frame_name(int frame) const {
+            // a width of up to 99 plus an int's digits, at most, over the pattern's own length
+            std::vector<char> name(output_pattern.size() + 128);
+            std::snprintf(name.data(), name.size(), output_pattern.c_str(), frame);
+            return std::string(name.data());
+        }
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "cpu_dispatch.h"
+#include "scene_file.h"
+
+/*
+AVX2 and AVX-512 versions of the traversal kernels
+
+bvh_ray_avx2 and bvh_ray_avx512 stand in for bvh_ray in bvh_traverse: the box test runs the three axes of a box
+as one vector, and with AVX-512 both children of a node in one go. sphere_discriminants_avx2 does the shared part
+of up to four sphere tests of a leaf at once; picking the root stays scalar, in order, because each hit pulls in
+ray_t for the next sphere.
+
+The math is exactly what the scalar code does (same operations, same order, doubles throughout, NaNs from rays
+parallel to a slab dropped the same way), so every variant finds the same hits. Only compiled on x86 with
+GCC or clang; everything here is only ever called after selected_cpu_isa() said the CPU has it (cpu_dispatch.h).
+*/
+
+#if RENDER_X86_DISPATCH
+
+#include <immintrin.h>
+
+class bvh_ray_avx2 {
+    public:
+        RENDER_TARGET_AVX2 bvh_ray_avx2(const ray& r) {
+            const vec3& o = r.origin();
+            const vec3& d = r.direction();
+            // the fourth lane is padding, masked out of every result
+            origin = _mm256_set_pd(0.0, o[2], o[1], o[0]);
+            inv_dir = _mm256_div_pd(_mm256_set1_pd(1.0), _mm256_set_pd(1.0, d[2], d[1], d[0]));
+            negative = _mm256_cmp_pd(inv_dir, _mm256_setzero_pd(), _CMP_LT_OQ);
+        }
+
+        // entry distance into the box if the ray overlaps it within [t_min, t_max], otherwise infinity
+        RENDER_TARGET_AVX2 double enter(const bvh_box& b, double t_min, double t_max) const {
+            __m256d t_near, t_far;
+            slabs(load_min(b), load_max(b), inv_dir, origin, negative, t_near, t_far);
+            __m256d lo = _mm256_set1_pd(t_min), hi = _mm256_set1_pd(t_max);
+            // max/min return their second operand for NaN, so a NaN slab leaves t_min/t_max as they were
+            t_near = _mm256_blend_pd(_mm256_max_pd(t_near, lo), lo, 0x8);
+            t_far = _mm256_blend_pd(_mm256_min_pd(t_far, hi), hi, 0x8);
+            double entry = horizontal_max(t_near);
+            return (horizontal_min(t_far) < entry) ? infinity : entry;
+        }
+
+        RENDER_TARGET_AVX2 void enter2(const bvh_box& a, const bvh_box& b, double t_min, double t_max, double& t_a, double& t_b) const {
+            t_a = enter(a, t_min, t_max);
+            t_b = enter(b, t_min, t_max);
+        }
+
+    protected:
+        __m256d origin;
+        __m256d inv_dir;
+        __m256d negative;  // lanes whose direction is negative, where the slab's near and far planes swap
+
+        // min[0..2] and max[0..2] of the box as doubles, without reading past it
+        RENDER_TARGET_AVX2 static __m128 load_min(const bvh_box& b) { return _mm_loadu_ps(b.min); }
+
+        RENDER_TARGET_AVX2 static __m128 load_max(const bvh_box& b) {
+            __m128 v = _mm_loadu_ps(b.min + 2);
+            return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 2, 1));
+        }
+
+        RENDER_TARGET_AVX2 static void slabs(__m128 box_min, __m128 box_max, __m256d inv, __m256d o, __m256d neg,
+                                             __m256d& t_near, __m256d& t_far) {
+            __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_cvtps_pd(box_min), o), inv);
+            __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_cvtps_pd(box_max), o), inv);
+            t_near = _mm256_blendv_pd(t0, t1, neg);
+            t_far = _mm256_blendv_pd(t1, t0, neg);
+        }
+
+        RENDER_TARGET_AVX2 static double horizontal_max(__m256d v) {
+            __m128d m = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+            return _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+        }
+
+        RENDER_TARGET_AVX2 static double horizontal_min(__m256d v) {
+            __m128d m = _mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+            return _mm_cvtsd_f64(_mm_min_sd(m, _mm_unpackhi_pd(m, m)));
+        }
+};
+
+// AVX-512: both children of a node tested in one 8 lane vector, box a in the low half and box b in the high half.
+// The zero masked forms with every lane selected do the same as the plain intrinsics, which GCC 12 builds on a
+// self-initialized placeholder that it then warns about at link time (GCC bug 105593).
+class bvh_ray_avx512 : public bvh_ray_avx2 {
+    public:
+        RENDER_TARGET_AVX512 bvh_ray_avx512(const ray& r) : bvh_ray_avx2(r) {
+            origin2 = _mm512_maskz_broadcast_f64x4(all_lanes, origin);
+            inv_dir2 = _mm512_maskz_broadcast_f64x4(all_lanes, inv_dir);
+            negative2 = _mm512_cmp_pd_mask(inv_dir2, _mm512_setzero_pd(), _CMP_LT_OQ);
+        }
+
+        RENDER_TARGET_AVX512 void enter2(const bvh_box& a, const bvh_box& b, double t_min, double t_max, double& t_a, double& t_b) const {
+            __m512d lo_box = _mm512_maskz_cvtps_pd(all_lanes, _mm256_set_m128(load_min(b), load_min(a)));
+            __m512d hi_box = _mm512_maskz_cvtps_pd(all_lanes, _mm256_set_m128(load_max(b), load_max(a)));
+            __m512d t0 = _mm512_mul_pd(_mm512_sub_pd(lo_box, origin2), inv_dir2);
+            __m512d t1 = _mm512_mul_pd(_mm512_sub_pd(hi_box, origin2), inv_dir2);
+            __m512d lo = _mm512_set1_pd(t_min), hi = _mm512_set1_pd(t_max);
+            __m512d t_near = _mm512_maskz_max_pd(all_lanes, _mm512_mask_blend_pd(negative2, t0, t1), lo);
+            __m512d t_far = _mm512_maskz_min_pd(all_lanes, _mm512_mask_blend_pd(negative2, t1, t0), hi);
+            t_near = _mm512_mask_blend_pd(0x88, t_near, lo);
+            t_far = _mm512_mask_blend_pd(0x88, t_far, hi);
+            t_a = finish(_mm512_maskz_extractf64x4_pd(0xf, t_near, 0), _mm512_maskz_extractf64x4_pd(0xf, t_far, 0));
+            t_b = finish(_mm512_maskz_extractf64x4_pd(0xf, t_near, 1), _mm512_maskz_extractf64x4_pd(0xf, t_far, 1));
+        }
+
+    private:
+        static const __mmask8 all_lanes = 0xff;
+
+        // the ray twice over, for two boxes at a time
+        __m512d origin2;
+        __m512d inv_dir2;
+        __mmask8 negative2;
+
+        RENDER_TARGET_AVX512 static double finish(__m256d t_near, __m256d t_far) {
+            double entry = horizontal_max(t_near);
+            return (horizontal_min(t_far) < entry) ? infinity : entry;
+        }
+};
+
+// For spheres s[0..count), count 1 to 4, work out half_b and the discriminant of the ray/sphere quadratic
+// exactly like packed_scene::hit_sphere does (a is the ray direction's squared length). Returns a bit per sphere
+// whose discriminant isn't negative, the only ones that can be hit.
+RENDER_TARGET_AVX2 inline int sphere_discriminants_avx2(const sphere_record* s, uint32_t count, const ray& r, double a,
+                                                        double half_b[4], double discriminant[4]) {
+    // four records as rows (center xyz, radius) and (material, velocity xyz), short leaves repeat the last one
+    const float* rows[4];
+    for (uint32_t k = 0; k < 4; ++k) {
+        rows[k] = s[k < count ? k : count - 1].center;
+    }
+    __m128 cx = _mm_loadu_ps(rows[0]), cy = _mm_loadu_ps(rows[1]), cz = _mm_loadu_ps(rows[2]), radius = _mm_loadu_ps(rows[3]);
+    _MM_TRANSPOSE4_PS(cx, cy, cz, radius);
+    __m128 unused = _mm_loadu_ps(rows[0] + 4), vx = _mm_loadu_ps(rows[1] + 4), vy = _mm_loadu_ps(rows[2] + 4), vz = _mm_loadu_ps(rows[3] + 4);
+    _MM_TRANSPOSE4_PS(unused, vx, vy, vz);
+
+    const vec3& o = r.origin();
+    const vec3& d = r.direction();
+    __m256d time = _mm256_set1_pd(r.time());
+    __m256d ocx = _mm256_sub_pd(_mm256_set1_pd(o[0]), _mm256_add_pd(_mm256_cvtps_pd(cx), _mm256_mul_pd(time, _mm256_cvtps_pd(vx))));
+    __m256d ocy = _mm256_sub_pd(_mm256_set1_pd(o[1]), _mm256_add_pd(_mm256_cvtps_pd(cy), _mm256_mul_pd(time, _mm256_cvtps_pd(vy))));
+    __m256d ocz = _mm256_sub_pd(_mm256_set1_pd(o[2]), _mm256_add_pd(_mm256_cvtps_pd(cz), _mm256_mul_pd(time, _mm256_cvtps_pd(vz))));
+
+    __m256d hb = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, _mm256_set1_pd(d[0])), _mm256_mul_pd(ocy, _mm256_set1_pd(d[1]))),
+                               _mm256_mul_pd(ocz, _mm256_set1_pd(d[2])));
+    __m256d oc_squared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+    __m256d rd = _mm256_cvtps_pd(radius);
+    __m256d c = _mm256_sub_pd(oc_squared, _mm256_mul_pd(rd, rd));
+    __m256d disc = _mm256_sub_pd(_mm256_mul_pd(hb, hb), _mm256_mul_pd(_mm256_set1_pd(a), c));
+
+    _mm256_storeu_pd(half_b, hb);
+    _mm256_storeu_pd(discriminant, disc);
+    // not less than zero, NaNs included, just like the scalar test only rejects discriminant < 0
+    int mask = _mm256_movemask_pd(_mm256_cmp_pd(disc, _mm256_setzero_pd(), _CMP_NLT_UQ));
+    return mask & ((1 << count) - 1);
+}
+
+#endif
+
+#endif
@@ -2,13 +2,21 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "ray_stats.h"
 #include "vec3.h"
 
 class sphere : public hittable {
     public:
-        sphere(point3 _center, double _radius, shared_ptr<material> _mat) : center(_center), radius(_radius), mat(_mat) {}
+        sphere(point3 _center, double _radius, shared_ptr<material> _mat)
+          : center(_center), radius(_radius), mat(_mat), velocity(0, 0, 0) {}
+
+        // moving sphere, at center0 at time 0 and center1 at time 1 along a straight line
+        sphere(point3 center0, point3 center1, double _radius, shared_ptr<material> _mat)
+          : center(center0), radius(_radius), mat(_mat), velocity(center1 - center0) {}
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RAY_STAT(primitive_tests);
+            point3 center = center_at(r.time());
             vec3 oc = r.origin() - center;
             auto a = r.direction().length_squared();
             auto half_b = dot(oc, r.direction());
@@ -37,13 +45,27 @@ class sphere : public hittable {
             rec.set_face_normal(r, outward_normal);
             rec.mat = mat;
 
+            RAY_STAT(primitive_hits);
             return true;
         }
 
+        // the box has to hold the sphere over the whole frame, which for linear motion is the box around both ends
+        bvh_box bounding_box() const override {
+            vec3 rvec(radius, radius, radius);
+            bvh_box box = bvh_box::around(center - rvec, center + rvec);
+            box.grow(bvh_box::around(center + velocity - rvec, center + velocity + rvec));
+            return box;
+        }
+
     private:
-        point3 center;
+        point3 center; // at time 0
         double radius;
         shared_ptr<material> mat;
+        vec3 velocity; // per frame
+
+        point3 center_at(double time) const {
+            return center + time*velocity;
+        }
 };
 
 #endif
\ No newline at end of file
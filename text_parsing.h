@@ -0,0 +1,96 @@
+#ifndef TEXT_PARSING_H
+#define TEXT_PARSING_H
+
+#include <cmath>
+#include <cstdint>
+
+/*
+Helpers for the hand written text parsers (scene files, OBJ, PLY).
+They work on a [p, end) range of an in-memory buffer and advance p as they go.
+*/
+
+// spaces and tabs separate tokens; '\r' is treated the same so files with Windows line endings parse too
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline void skip_blank(const char*& p, const char* end) {
+    while (p < end && is_blank(*p)) {
+        ++p;
+    }
+}
+
+// decimal number with optional sign, fraction and exponent
+inline bool parse_number(const char*& p, const char* end, double& out) {
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    skip_blank(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (mantissa < 1000000000000000000ull) {
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+        else {
+            ++exponent; // past 18 digits the rest can't change a double anyway
+        }
+        ++p;
+        ++digits;
+    }
+    if (p < end && *p == '.') {
+        ++p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (mantissa < 1000000000000000000ull) {
+                mantissa = mantissa * 10 + (*p - '0');
+                --exponent;
+            }
+            ++p;
+            ++digits;
+        }
+    }
+    if (digits == 0) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negative_exp = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative_exp = (*p == '-');
+            ++p;
+        }
+        int e = 0;
+        if (p >= end || *p < '0' || *p > '9') {
+            return false;
+        }
+        while (p < end && *p >= '0' && *p <= '9') {
+            e = (e < 10000) ? e * 10 + (*p - '0') : e;
+            ++p;
+        }
+        exponent += negative_exp ? -e : e;
+    }
+    if (p < end && !is_blank(*p) && *p != '#' && *p != '\n') {
+        return false; // something like "1.5x"
+    }
+
+    double value = static_cast<double>(mantissa);
+    if (exponent < 0) {
+        value = (exponent >= -22) ? value / pow10[-exponent] : value * std::pow(10.0, exponent);
+    }
+    else if (exponent > 0) {
+        value = (exponent <= 22) ? value * pow10[exponent] : value * std::pow(10.0, exponent);
+    }
+    out = negative ? -value : value;
+    return true;
+}
+
+#endif
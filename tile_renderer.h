@@ -0,0 +1,95 @@
+#ifndef TILE_RENDERER_H
+#define TILE_RENDERER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable.h"
+#include "progress.h"
+#include "ray_stats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+Multithreaded rendering of one image in this process
+
+The image is cut into square tiles, and every thread takes the next tile off a shared counter until none are left,
+so threads that got cheap tiles (sky, nearby diffuse walls) just take more of them. Each thread renders with its
+own copy of the camera (the camera keeps its sampler state in itself), and writes only its own tiles' pixels,
+so the threads share nothing but the counter (and the progress counter, if one is given, bumped once per tile).
+Each thread flushes its ray statistics (ray_stats.h) when it runs out
+of tiles.
+
+The result is the same float framebuffer of per pixel sums render_tile makes, for write_ppm or the denoiser.
+The samplers' numbers depend only on the pixel and the sample (sampler.h), so the image is the same whatever the
+thread count.
+*/
+
+class tile_renderer {
+    public:
+        int threads = 0;       // 0 picks the hardware thread count
+        int tile_size = 32;    // pixels along a tile's side
+
+        // thread count render() is going to use
+        int thread_count() const {
+            int n = (threads > 0) ? threads : static_cast<int>(std::thread::hardware_concurrency());
+            return std::max(1, n);
+        }
+
+        // Render all of cam's image (every sample of every pixel) into framebuffer, 3 floats per pixel.
+        // Finished tiles are counted into progress, if it isn't null.
+        void render(const camera& cam, const hittable& world, std::vector<float>& framebuffer, progress_reporter* progress = nullptr) const {
+            int width = cam.image_width;
+            int height = cam.get_image_height();
+            int size = std::max(1, tile_size);
+            int tiles_x = (width + size - 1) / size;
+            int tiles_y = (height + size - 1) / size;
+            int tile_count = tiles_x * tiles_y;
+            framebuffer.assign(3 * static_cast<size_t>(width) * height, 0.0f);
+
+            std::atomic<int> next_tile(0);
+            auto work = [&]() {
+                camera local = cam;
+                std::vector<float> tile;
+                for (int t = next_tile++; t < tile_count; t = next_tile++) {
+                    int x0 = (t % tiles_x) * size, y0 = (t / tiles_x) * size;
+                    int x1 = std::min(x0 + size, width), y1 = std::min(y0 + size, height);
+                    TRACE_TILE(x0, y0, x1, y1);
+                    int tile_width = x1 - x0;
+                    tile.assign(3 * static_cast<size_t>(tile_width) * (y1 - y0), 0.0f);
+                    local.render_tile(world, x0, y0, x1, y1, 0, local.samples_per_pixel, tile.data());
+                    for (int y = y0; y < y1; ++y) {
+                        auto row = tile.begin() + 3 * static_cast<size_t>(y - y0) * tile_width;
+                        std::copy(row, row + 3 * tile_width, framebuffer.begin() + 3 * (static_cast<size_t>(y) * width + x0));
+                    }
+                    if (progress != nullptr) {
+                        progress->add(static_cast<uint64_t>(tile_width) * (y1 - y0) * local.samples_per_pixel);
+                    }
+                }
+                ray_stats::flush();
+            };
+
+            int n = std::min(thread_count(), tile_count);
+            if (n <= 1) {
+                work();
+                return;
+            }
+            std::vector<std::thread> pool;
+            for (int k = 0; k < n; ++k) {
+                // render thread k is trace lane k + 1 in every render, the calling thread is lane 0
+                pool.emplace_back([&work, k]() {
+                    TRACE_LANE(k + 1);
+                    work();
+                });
+            }
+            for (auto& thread : pool) {
+                thread.join();
+            }
+        }
+};
+
+#endif
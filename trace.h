@@ -0,0 +1,183 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+Timeline tracing
+
+Records what each thread was doing when: scene and BVH builds, render tiles, denoising and writing the output.
+trace_recorder::write saves it in Chrome's trace event format, which chrome://tracing and Perfetto
+(ui.perfetto.dev) show as one lane per thread. Renders through tile_renderer (render_bench --trace) have a lane
+per render thread with every tile it took, so load imbalance, idle threads and the last slow tiles are easy to
+see; inOneWeekend renders on its main thread, a row of the image at a time, so its trace is one lane of rows.
+
+TRACE_SCOPE(name, category) records the time from where it stands to the end of the enclosing block;
+TRACE_TILE(x0, y0, x1, y1) does the same for a tile, with its pixel rectangle attached. TRACE_LANE(n) puts the
+calling thread in lane n, for thread pools that are started again for every render and would otherwise add new
+lanes each time. Names and categories must be string literals (or otherwise outlive the recorder). Events are per
+tile, not per ray, so a mutex around the event list is plenty.
+
+Tracing only records anything once trace_recorder::get().start() was called. Build with RENDER_TRACE defined
+to 0 (cmake -DRENDER_TRACE=OFF) and the macros expand to nothing at all.
+*/
+
+#ifndef RENDER_TRACE
+#define RENDER_TRACE 1
+#endif
+
+struct trace_event {
+    const char* name;
+    const char* category;
+    double start_us;     // since the recorder started
+    double duration_us;
+    int thread;
+    int rect[4];         // tile x0 y0 x1 y1, or x0 < 0 for none
+};
+
+class trace_recorder {
+    public:
+        static trace_recorder& get() {
+            static trace_recorder recorder;
+            return recorder;
+        }
+
+        // Start recording; call before the threads to be traced start. The calling thread becomes thread 0, "main".
+        void start() {
+            thread_id();
+            std::lock_guard<std::mutex> guard(lock);
+            events.clear();
+            origin = std::chrono::steady_clock::now();
+            recording.store(true, std::memory_order_release);
+        }
+
+        bool active() const { return recording.load(std::memory_order_relaxed); }
+
+        // microseconds since start()
+        double now_us() const {
+            std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - origin;
+            return elapsed.count();
+        }
+
+        void record(const trace_event& event) {
+            std::lock_guard<std::mutex> guard(lock);
+            events.push_back(event);
+        }
+
+        // small sequential id of the calling thread, 0 for the first thread that asks
+        int thread_id() {
+            int& id = this_thread_id();
+            if (id < 0) {
+                std::lock_guard<std::mutex> guard(lock);
+                id = thread_count++;
+            }
+            return id;
+        }
+
+        // give the calling thread the id (lane) id from now on, whatever it had
+        void set_thread_id(int id) {
+            std::lock_guard<std::mutex> guard(lock);
+            this_thread_id() = id;
+            thread_count = std::max(thread_count, id + 1);
+        }
+
+        // Write everything recorded as a Chrome trace event JSON file
+        bool write(const std::string& path) {
+            std::lock_guard<std::mutex> guard(lock);
+            FILE* file = std::fopen(path.c_str(), "w");
+            if (file == nullptr) {
+                return false;
+            }
+            std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+            std::fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"main\"}},\n");
+            for (int t = 1; t < thread_count; ++t) {
+                std::fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}},\n", t, t);
+            }
+            for (size_t k = 0; k < events.size(); ++k) {
+                const trace_event& e = events[k];
+                std::fprintf(file, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                             e.name, e.category, e.thread, e.start_us, e.duration_us);
+                if (e.rect[0] >= 0) {
+                    std::fprintf(file, ", \"args\": {\"x0\": %d, \"y0\": %d, \"x1\": %d, \"y1\": %d}", e.rect[0], e.rect[1], e.rect[2], e.rect[3]);
+                }
+                std::fprintf(file, "}%s\n", (k + 1 < events.size()) ? "," : "");
+            }
+            std::fprintf(file, "]}\n");
+            return std::fclose(file) == 0;
+        }
+
+    private:
+        trace_recorder() {}
+
+        static int& this_thread_id() {
+            static thread_local int id = -1;
+            return id;
+        }
+
+        std::mutex lock;
+        std::vector<trace_event> events;
+        std::chrono::steady_clock::time_point origin;
+        std::atomic<bool> recording{false};
+        int thread_count = 0;
+};
+
+// records the time between its construction and destruction, if the recorder is active
+class trace_scope {
+    public:
+        trace_scope(const char* name, const char* category, int x0 = -1, int y0 = 0, int x1 = 0, int y1 = 0) {
+            trace_recorder& recorder = trace_recorder::get();
+            if (!recorder.active()) {
+                return;
+            }
+            event.name = name;
+            event.category = category;
+            event.start_us = recorder.now_us();
+            event.rect[0] = x0;
+            event.rect[1] = y0;
+            event.rect[2] = x1;
+            event.rect[3] = y1;
+            live = true;
+        }
+
+        ~trace_scope() {
+            if (!live) {
+                return;
+            }
+            trace_recorder& recorder = trace_recorder::get();
+            event.duration_us = recorder.now_us() - event.start_us;
+            event.thread = recorder.thread_id();
+            recorder.record(event);
+        }
+
+        trace_scope(const trace_scope&) = delete;
+        trace_scope& operator=(const trace_scope&) = delete;
+
+    private:
+        trace_event event;
+        bool live = false;
+};
+
+#if RENDER_TRACE
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name, category) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name, category)
+#define TRACE_TILE(x0, y0, x1, y1) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)("tile", "render", x0, y0, x1, y1)
+#define TRACE_LANE(n) do { if (trace_recorder::get().active()) trace_recorder::get().set_thread_id(n); } while (0)
+
+#else
+
+#define TRACE_SCOPE(name, category) ((void)0)
+#define TRACE_TILE(x0, y0, x1, y1) ((void)0)
+#define TRACE_LANE(n) ((void)0)
+
+#endif
+
+#endif
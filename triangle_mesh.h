@@ -0,0 +1,171 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/*
+Indexed triangle mesh
+
+All the triangles of a mesh share one vertex buffer and one index buffer (three vertex indices per triangle),
+instead of being separate hittable objects each holding a shared_ptr, which is what made big meshes impossible
+with one object per primitive. The mesh has its own BVH over its triangles (see bvh.h); building it reorders
+the index buffer into leaf order, the vertex buffer stays as loaded.
+
+Vertices are floats like the sphere records. Intersection is Moller-Trumbore done in double, and shading uses
+the flat geometric normal, with the winding order (counter-clockwise seen from outside) deciding which side is front.
+*/
+
+struct mesh_vertex {
+    float p[3];
+};
+
+class triangle_mesh : public hittable {
+    public:
+        std::vector<mesh_vertex> vertices;
+        std::vector<uint32_t> indices; // 3 per triangle
+        std::vector<bvh_node> nodes;
+        shared_ptr<material> mat;
+
+        triangle_mesh() {}
+        triangle_mesh(shared_ptr<material> _mat) : mat(_mat) {}
+
+        size_t triangle_count() const { return indices.size() / 3; }
+
+        // bytes held by the vertex, index and BVH buffers
+        size_t memory_bytes() const {
+            return vertices.capacity() * sizeof(mesh_vertex)
+                 + indices.capacity() * sizeof(uint32_t)
+                 + nodes.capacity() * sizeof(bvh_node);
+        }
+
+        // build the BVH over the triangles, call once after the buffers are filled
+        void build_bvh() {
+            size_t count = triangle_count();
+            std::vector<bvh_box> bounds = triangle_bounds();
+            std::vector<uint32_t> order;
+            bvh_builder builder;
+            builder.build(bounds, nodes, order);
+
+            std::vector<uint32_t> sorted(indices.size());
+            for (size_t k = 0; k < count; ++k) {
+                sorted[3*k + 0] = indices[3*order[k] + 0];
+                sorted[3*k + 1] = indices[3*order[k] + 1];
+                sorted[3*k + 2] = indices[3*order[k] + 2];
+            }
+            indices.swap(sorted);
+            nodes.shrink_to_fit();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            triangle_leaf leaf(*this, r);
+            if (!bvh_traverse(nodes.data(), nodes.size(), r, ray_t, leaf)) {
+                return false;
+            }
+
+            rec.t = ray_t.max;
+            rec.point = r.at(rec.t);
+            vec3 e1, e2;
+            edges(leaf.closest, e1, e2);
+            rec.set_face_normal(r, unit_vector(cross(e1, e2)));
+            rec.mat = mat;
+            rec.primitive = leaf.closest;
+            return true;
+        }
+
+        bvh_box bounding_box() const override {
+            return nodes.empty() ? bvh_box::empty() : nodes[0].bounds;
+        }
+
+    private:
+        std::vector<bvh_box> triangle_bounds() const {
+            std::vector<bvh_box> bounds(triangle_count());
+            for (size_t k = 0; k < bounds.size(); ++k) {
+                bvh_box b = bvh_box::empty();
+                for (int c = 0; c < 3; ++c) {
+                    const mesh_vertex& v = vertices[indices[3*k + c]];
+                    for (int a = 0; a < 3; ++a) {
+                        b.min[a] = std::min(b.min[a], v.p[a]);
+                        b.max[a] = std::max(b.max[a], v.p[a]);
+                    }
+                }
+                bounds[k] = b;
+            }
+            return bounds;
+        }
+
+        point3 vertex(uint32_t index) const {
+            const mesh_vertex& v = vertices[index];
+            return point3(v.p[0], v.p[1], v.p[2]);
+        }
+
+        void edges(uint32_t tri, vec3& e1, vec3& e2) const {
+            point3 v0 = vertex(indices[3*tri]);
+            e1 = vertex(indices[3*tri + 1]) - v0;
+            e2 = vertex(indices[3*tri + 2]) - v0;
+        }
+
+        // Moller-Trumbore ray/triangle test, t of the hit if it's inside ray_t
+        bool hit_triangle(uint32_t tri, const ray& r, const interval& ray_t, double& t) const {
+            point3 v0 = vertex(indices[3*tri]);
+            vec3 e1 = vertex(indices[3*tri + 1]) - v0;
+            vec3 e2 = vertex(indices[3*tri + 2]) - v0;
+
+            vec3 pvec = cross(r.direction(), e2);
+            double det = dot(e1, pvec);
+            if (std::fabs(det) < 1e-14) {
+                return false; // ray parallel to the triangle (or a degenerate triangle)
+            }
+            double inv_det = 1.0 / det;
+
+            vec3 tvec = r.origin() - v0;
+            double u = dot(tvec, pvec) * inv_det;
+            if (u < 0.0 || u > 1.0) {
+                return false;
+            }
+            vec3 qvec = cross(tvec, e1);
+            double v = dot(r.direction(), qvec) * inv_det;
+            if (v < 0.0 || u + v > 1.0) {
+                return false;
+            }
+
+            double root = dot(e2, qvec) * inv_det;
+            if (!ray_t.surrounds(root)) {
+                return false;
+            }
+            t = root;
+            return true;
+        }
+
+        class triangle_leaf {
+            public:
+                const triangle_mesh& mesh;
+                const ray& r;
+                uint32_t closest = 0;
+
+                triangle_leaf(const triangle_mesh& _mesh, const ray& _r) : mesh(_mesh), r(_r) {}
+
+                bool operator()(uint32_t first, uint32_t count, interval& ray_t) {
+                    bool found = false;
+                    RAY_STAT_ADD(primitive_tests, count);
+                    for (uint32_t k = first; k < first + count; ++k) {
+                        double t;
+                        if (mesh.hit_triangle(k, r, ray_t, t)) {
+                            RAY_STAT(primitive_hits);
+                            ray_t.max = t;
+                            closest = k;
+                            found = true;
+                        }
+                    }
+                    return found;
+                }
+        };
+};
+
+#endif